@@ -0,0 +1,973 @@
+/*
+ * augbench.c: run performance scenarios against the Augeas API and libfa
+ *
+ * Copyright (C) 2026 The Augeas authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/*
+ * Every scenario runs in its own child process, so that the peak RSS we
+ * report belongs to that scenario alone, and so that a crash in one
+ * scenario does not take the others down with it. The child runs the
+ * scenario's setup once, then WARMUP untimed and REPEAT timed repetitions
+ * and sends the timings back to the parent through a pipe. The parent
+ * writes a JSON report that looks like
+ *
+ *   { "version": "1.11.0", "scale": 1000, "warmup": 2, "repeat": 10,
+ *     "scenarios": [
+ *       { "name": "load", "ok": true, "median_ms": 12.3, "p95_ms": 13.1,
+ *         "min_ms": 12.0, "max_ms": 13.4, "mean_ms": 12.5,
+ *         "allocations": 51234, "alloc_bytes": 4312345,
+ *         "peak_rss_kb": 10240 }, ... ] }
+ *
+ * Allocations are the number and size of the allocations that
+ * aug_alloc_stats counts during one timed repetition, averaged over all
+ * repetitions.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "augeas.h"
+#include "fa.h"
+#include "corpus.h"
+
+#ifndef ATTRIBUTE_UNUSED
+#define ATTRIBUTE_UNUSED __attribute__((__unused__))
+#endif
+
+#define DEFAULT_SCALE  1000
+#define DEFAULT_REPEAT 10
+#define DEFAULT_WARMUP 2
+
+static const char *progname;
+
+static const char *const alloc_subsystems[] = {
+    "other", "tree", "pathx", "get", "put", "fa", "jmt", "interpreter", NULL
+};
+
+/* The state a scenario works with */
+struct bench {
+    const char *root;
+    const char *loadpath;
+    unsigned int scale;
+    unsigned int flags;      /* Passed to aug_init in addition to ours */
+    struct augeas *aug;
+    unsigned int rep;        /* Number of calls to PREPARE so far */
+    struct fa *fa;           /* Used by the libfa scenarios */
+};
+
+struct scenario {
+    const char *name;
+    const char *desc;
+    /* The corpus files to load; NULL means that aug_init should
+     * autoload all modules with their default transforms */
+    const char *const *files;
+    unsigned int flags;
+    /* Scenario-specific argument, e.g. the path expression to match */
+    const char *arg;
+    /* Untimed, once before all repetitions */
+    int (*setup)(struct bench *b, const struct scenario *s);
+    /* Untimed, before each repetition */
+    int (*prepare)(struct bench *b, const struct scenario *s);
+    /* Timed */
+    int (*run)(struct bench *b, const struct scenario *s);
+};
+
+/* What a child sends back to the parent, followed by NTIMES doubles */
+struct result_header {
+    int ok;
+    unsigned int ntimes;
+    double allocations;
+    double alloc_bytes;
+};
+
+/*
+ * Helpers
+ */
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1.0e6;
+}
+
+static void alloc_totals(size_t *count, size_t *bytes) {
+    *count = 0;
+    *bytes = 0;
+    for (int i = 0; alloc_subsystems[i] != NULL; i++) {
+        size_t c, s;
+        if (aug_alloc_stats(alloc_subsystems[i], &c, &s) == 0) {
+            *count += c;
+            *bytes += s;
+        }
+    }
+}
+
+static void report_aug_error(const struct scenario *s, struct augeas *aug) {
+    const char *msg, *minor, *details;
+
+    if (aug == NULL) {
+        fprintf(stderr, "%s: %s: failed\n", progname, s->name);
+        return;
+    }
+    if (aug_error(aug) != AUG_NOERROR) {
+        msg = aug_error_message(aug);
+        minor = aug_error_minor_message(aug);
+        details = aug_error_details(aug);
+        fprintf(stderr, "%s: %s: %s", progname, s->name, msg);
+        if (minor != NULL)
+            fprintf(stderr, ": %s", minor);
+        if (details != NULL)
+            fprintf(stderr, ": %s", details);
+        fputc('\n', stderr);
+    } else {
+        fprintf(stderr, "%s: %s: failed\n", progname, s->name);
+    }
+}
+
+/* Create a fresh instance in B->AUG that loads the files S->FILES */
+static int bench_open(struct bench *b, const struct scenario *s) {
+    unsigned int flags = AUG_NO_LOAD | b->flags | s->flags;
+
+    aug_close(b->aug);
+    if (b->loadpath != NULL)
+        flags |= AUG_NO_STDINC;
+    if (s->files != NULL)
+        flags |= AUG_NO_MODL_AUTOLOAD;
+
+    b->aug = aug_init(b->root, b->loadpath, flags);
+    if (b->aug == NULL || aug_error(b->aug) != AUG_NOERROR)
+        return -1;
+
+    if (s->files == NULL)
+        return 0;
+
+    for (int i = 0; s->files[i] != NULL; i++) {
+        const struct corpus_file *f = corpus_file(s->files[i]);
+        char *path = NULL;
+        int r;
+
+        if (f == NULL)
+            return -1;
+        r = asprintf(&path, "/augeas/load/%s/lens", f->name);
+        if (r < 0)
+            return -1;
+        r = aug_set(b->aug, path, f->lens);
+        free(path);
+        if (r < 0)
+            return -1;
+
+        r = asprintf(&path, "/augeas/load/%s/incl", f->name);
+        if (r < 0)
+            return -1;
+        r = aug_set(b->aug, path, f->path);
+        free(path);
+        if (r < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Open and load, and make sure that all files parsed */
+static int bench_load(struct bench *b, const struct scenario *s) {
+    if (bench_open(b, s) < 0)
+        return -1;
+    if (aug_load(b->aug) < 0)
+        return -1;
+    if (aug_match(b->aug, "/augeas/files//error", NULL) != 0) {
+        fprintf(stderr, "%s: %s: some files failed to parse\n",
+                progname, s->name);
+        aug_print(b->aug, stderr, "/augeas/files//error");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Scenario implementations
+ */
+static int prepare_close(struct bench *b,
+                         ATTRIBUTE_UNUSED const struct scenario *s) {
+    aug_close(b->aug);
+    b->aug = NULL;
+    return 0;
+}
+
+static int run_init(struct bench *b, const struct scenario *s) {
+    return bench_open(b, s);
+}
+
+static int prepare_open(struct bench *b, const struct scenario *s) {
+    return bench_open(b, s);
+}
+
+static int run_load(struct bench *b, const struct scenario *s) {
+    if (aug_load(b->aug) < 0)
+        return -1;
+    if (aug_match(b->aug, "/augeas/files//error", NULL) != 0) {
+        fprintf(stderr, "%s: %s: some files failed to parse\n",
+                progname, s->name);
+        return -1;
+    }
+    return 0;
+}
+
+static int run_match(struct bench *b, const struct scenario *s) {
+    int r = aug_match(b->aug, s->arg, NULL);
+
+    if (r == 0) {
+        fprintf(stderr, "%s: %s: no matches for %s\n",
+                progname, s->name, s->arg);
+        return -1;
+    }
+    return r < 0 ? -1 : 0;
+}
+
+/* Throw away the changes of the previous repetition */
+static int prepare_reload(struct bench *b,
+                          ATTRIBUTE_UNUSED const struct scenario *s) {
+    return aug_load(b->aug);
+}
+
+/* Look up the same value 10000 * SCALE times */
+static int run_get(struct bench *b, const struct scenario *s) {
+    unsigned long n = 10000UL * b->scale;
+    const char *value;
+
+    for (unsigned long i = 0; i < n; i++) {
+        if (aug_get(b->aug, s->arg, &value) != 1)
+            return -1;
+    }
+    return 0;
+}
+
+static int run_get_session(struct bench *b, const struct scenario *s) {
+    if (aug_session_begin(b->aug) < 0)
+        return -1;
+    if (run_get(b, s) < 0) {
+        aug_session_end(b->aug);
+        return -1;
+    }
+    return aug_session_end(b->aug);
+}
+
+/* Append 1000 * SCALE siblings one at a time, each with label[count+1] */
+static int run_append(struct bench *b,
+                      ATTRIBUTE_UNUSED const struct scenario *s) {
+    unsigned long n = 1000UL * b->scale;
+    char path[64];
+
+    for (unsigned long i = 1; i <= n; i++) {
+        snprintf(path, sizeof(path), "/test/service[%lu]", i);
+        if (aug_set(b->aug, path, "test") < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int run_set_bulk(struct bench *b,
+                        ATTRIBUTE_UNUSED const struct scenario *s) {
+    char path[64], value[64];
+
+    /* Entries in /etc/hosts are numbered from 1, and the file has
+     * SCALE + 1 of them */
+    for (unsigned int i = 1; i <= b->scale; i++) {
+        snprintf(path, sizeof(path), "/files/etc/hosts/%u/canonical", i);
+        snprintf(value, sizeof(value), "bench%u.example.com", i);
+        if (aug_set(b->aug, path, value) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int run_setm(struct bench *b, const struct scenario *s) {
+    return aug_setm(b->aug, s->arg, "opt", "defaults") < 0 ? -1 : 0;
+}
+
+static int run_rm(struct bench *b, const struct scenario *s) {
+    int r = aug_rm(b->aug, s->arg);
+
+    if (r == 0) {
+        fprintf(stderr, "%s: %s: nothing removed for %s\n",
+                progname, s->name, s->arg);
+        return -1;
+    }
+    return r < 0 ? -1 : 0;
+}
+
+/* Change one value in S->ARG, so that the next aug_save has work to do */
+static int prepare_modify(struct bench *b, const struct scenario *s) {
+    char value[64];
+
+    b->rep += 1;
+    snprintf(value, sizeof(value), "%u", b->rep);
+    return aug_setm(b->aug, s->arg, NULL, value) <= 0 ? -1 : 0;
+}
+
+static int run_save(struct bench *b,
+                    ATTRIBUTE_UNUSED const struct scenario *s) {
+    return aug_save(b->aug);
+}
+
+/* Compile RE into *FA without minimizing it */
+static int bench_fa_compile(const struct scenario *s, const char *re,
+                            struct fa **fa) {
+    int r = fa_compile(re, strlen(re), fa);
+
+    if (r != REG_NOERROR) {
+        fprintf(stderr, "%s: %s: fa_compile failed with %d\n",
+                progname, s->name, r);
+        return -1;
+    }
+    return 0;
+}
+
+/* Compile the union of SCALE different words into B->FA */
+static int prepare_fa_words(struct bench *b, const struct scenario *s) {
+    char *re = NULL, *p;
+    int r;
+
+    fa_free(b->fa);
+    b->fa = NULL;
+
+    /* Each word is at most 'w' and 10 digits and a '|' long */
+    re = malloc(12 * (size_t) b->scale + 1);
+    if (re == NULL)
+        return -1;
+    p = re;
+    for (unsigned int i = 0; i < b->scale; i++)
+        p += sprintf(p, "%sw%u", i > 0 ? "|" : "", i);
+    r = bench_fa_compile(s, re, &b->fa);
+    free(re);
+    return r;
+}
+
+static int run_fa_minimize(struct bench *b,
+                           ATTRIBUTE_UNUSED const struct scenario *s) {
+    return fa_minimize(b->fa);
+}
+
+/* Compile S->ARG and determinize and minimize it */
+static int run_fa_determinize(struct bench *b, const struct scenario *s) {
+    int r;
+
+    fa_free(b->fa);
+    b->fa = NULL;
+    if (bench_fa_compile(s, s->arg, &b->fa) < 0)
+        return -1;
+    r = fa_minimize(b->fa);
+    fa_free(b->fa);
+    b->fa = NULL;
+    return r;
+}
+
+/* Intersect the words of length up to 64 with the complement of S->ARG */
+static int run_fa_intersect(ATTRIBUTE_UNUSED struct bench *b,
+                            const struct scenario *s) {
+    struct fa *words = NULL, *fa = NULL, *comp = NULL, *isect = NULL;
+    int result = -1;
+
+    if (bench_fa_compile(s, "[a-z0-9]{0,64}", &words) < 0)
+        goto done;
+    if (bench_fa_compile(s, s->arg, &fa) < 0)
+        goto done;
+    comp = fa_complement(fa);
+    if (comp == NULL)
+        goto done;
+    isect = fa_intersect(words, comp);
+    if (isect == NULL)
+        goto done;
+    result = fa_minimize(isect);
+ done:
+    fa_free(words);
+    fa_free(fa);
+    fa_free(comp);
+    fa_free(isect);
+    return result;
+}
+
+/*
+ * The scenarios
+ */
+static const char *const flat_files[] = {
+    "hosts", "services", "sshd_config", "fstab", NULL
+};
+static const char *const all_files[] = {
+    "hosts", "services", "sshd_config", "fstab", "json", "xml", NULL
+};
+static const char *const no_files[] = { NULL };
+static const char *const json_files[] = { "json", NULL };
+static const char *const xml_files[] = { "xml", NULL };
+
+static const struct scenario scenarios[] = {
+    { .name = "init",
+      .desc = "aug_init, autoloading all modules",
+      .prepare = prepare_close, .run = run_init },
+    { .name = "init_noautoload",
+      .desc = "aug_init with AUG_NO_MODL_AUTOLOAD",
+      .files = flat_files, .prepare = prepare_close, .run = run_init },
+    { .name = "load",
+      .desc = "aug_load of hosts, services, sshd_config and fstab",
+      .files = flat_files, .prepare = prepare_open, .run = run_load },
+    { .name = "load_lazy",
+      .desc = "aug_load of the flat files with AUG_LAZY_LOAD",
+      .files = flat_files, .flags = AUG_LAZY_LOAD,
+      .prepare = prepare_open, .run = run_load },
+    { .name = "load_json",
+      .desc = "aug_load of a JSON file (recursive lens)",
+      .files = json_files, .prepare = prepare_open, .run = run_load },
+    { .name = "load_xml",
+      .desc = "aug_load of an XML file (recursive lens)",
+      .files = xml_files, .prepare = prepare_open, .run = run_load },
+    { .name = "match_children",
+      .desc = "aug_match of all children of a file",
+      .files = all_files, .setup = bench_load, .run = run_match,
+      .arg = "/files/etc/hosts/*" },
+    { .name = "match_value",
+      .desc = "aug_match with an equality predicate",
+      .files = all_files, .setup = bench_load, .run = run_match,
+      .arg = "/files/etc/hosts/*[canonical = 'host1.example.com']" },
+    { .name = "match_regexp",
+      .desc = "aug_match with a regexp predicate",
+      .files = all_files, .setup = bench_load, .run = run_match,
+      .arg = "/files/etc/services/service-name[port =~ regexp('10[3-4][0-9]')]" },
+    { .name = "match_and",
+      .desc = "aug_match with a conjunction of predicates",
+      .files = all_files, .setup = bench_load, .run = run_match,
+      .arg = "/files/etc/services/service-name[protocol = 'udp' and alias]" },
+    { .name = "match_last",
+      .desc = "aug_match with a position predicate",
+      .files = all_files, .setup = bench_load, .run = run_match,
+      .arg = "/files/etc/fstab/*[last()]" },
+    { .name = "match_descendant",
+      .desc = "aug_match of a descendant axis",
+      .files = all_files, .setup = bench_load, .run = run_match,
+      .arg = "/files/etc/ssh/sshd_config//X11Forwarding" },
+    { .name = "match_nested",
+      .desc = "aug_match with a nested predicate in an XML tree",
+      .files = all_files, .setup = bench_load, .run = run_match,
+      .arg = "/files/etc/xml/data.xml/items/item[#attribute/id = '1']/value" },
+    { .name = "get",
+      .desc = "10000 * SCALE calls of aug_get",
+      .files = no_files, .setup = bench_open, .run = run_get,
+      .arg = "/augeas/version" },
+    { .name = "get_session",
+      .desc = "10000 * SCALE calls of aug_get inside a session",
+      .files = no_files, .setup = bench_open, .run = run_get_session,
+      .arg = "/augeas/version" },
+    { .name = "append",
+      .desc = "aug_set of 1000 * SCALE new siblings, one at a time",
+      .files = no_files, .prepare = prepare_open, .run = run_append },
+    { .name = "set_bulk",
+      .desc = "aug_set of one value in each entry of /etc/hosts",
+      .files = flat_files, .setup = bench_load, .prepare = prepare_reload,
+      .run = run_set_bulk },
+    { .name = "setm",
+      .desc = "aug_setm of one value in each entry of /etc/fstab",
+      .files = flat_files, .setup = bench_load, .prepare = prepare_reload,
+      .run = run_setm, .arg = "/files/etc/fstab/*[spec]" },
+    { .name = "rm",
+      .desc = "aug_rm of half the entries in /etc/services",
+      .files = flat_files, .setup = bench_load, .prepare = prepare_reload,
+      .run = run_rm, .arg = "/files/etc/services/service-name[protocol = 'udp']" },
+    { .name = "save",
+      .desc = "aug_save of the flat files with one change each",
+      .files = flat_files, .flags = AUG_SAVE_NEWFILE,
+      .setup = bench_load, .prepare = prepare_modify, .run = run_save,
+      .arg = "(/files/etc/hosts/1/alias | /files/etc/services/service-name[1]/port"
+             " | /files/etc/ssh/sshd_config/Port | /files/etc/fstab/1/dump)" },
+    { .name = "save_json",
+      .desc = "aug_save of a JSON file with one change",
+      .files = json_files, .flags = AUG_SAVE_NEWFILE,
+      .setup = bench_load, .prepare = prepare_modify, .run = run_save,
+      .arg = "/files/etc/bench/data.json/dict/entry[1]/string" },
+    { .name = "save_xml",
+      .desc = "aug_save of an XML file with one change",
+      .files = xml_files, .flags = AUG_SAVE_NEWFILE,
+      .setup = bench_load, .prepare = prepare_modify, .run = run_save,
+      .arg = "/files/etc/xml/data.xml/items/item[1]/value/#text" },
+    { .name = "save_xml_keep_parse",
+      .desc = "aug_save of an XML file with AUG_KEEP_PARSE",
+      .files = xml_files, .flags = AUG_SAVE_NEWFILE | AUG_KEEP_PARSE,
+      .setup = bench_load, .prepare = prepare_modify, .run = run_save,
+      .arg = "/files/etc/xml/data.xml/items/item[1]/value/#text" },
+    { .name = "fa_minimize",
+      .desc = "fa_minimize of the union of SCALE words",
+      .prepare = prepare_fa_words, .run = run_fa_minimize },
+    { .name = "fa_determinize",
+      .desc = "fa_compile and fa_minimize of an automaton with many states",
+      .run = run_fa_determinize, .arg = "(a|b)*a(a|b){12}" },
+    { .name = "fa_intersect",
+      .desc = "fa_intersect of a language with a complement",
+      .run = run_fa_intersect, .arg = "[a-z]*(ab|cd)[0-9]{2,6}[a-z]*" },
+    { .name = NULL }
+};
+
+static const struct scenario *find_scenario(const char *name) {
+    for (const struct scenario *s = scenarios; s->name != NULL; s++)
+        if (strcmp(s->name, name) == 0)
+            return s;
+    return NULL;
+}
+
+/*
+ * Running scenarios
+ */
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Run scenario S in the current process and write the results to FD */
+static void run_child(const struct scenario *s, struct bench *b,
+                      unsigned int warmup, unsigned int repeat, int fd) {
+    struct result_header hdr;
+    double *times = NULL;
+    size_t count0, bytes0, count1, bytes1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    times = calloc(repeat, sizeof(*times));
+    if (times == NULL)
+        goto done;
+
+    if (s->setup != NULL && s->setup(b, s) < 0) {
+        report_aug_error(s, b->aug);
+        goto done;
+    }
+
+    for (unsigned int i = 0; i < warmup + repeat; i++) {
+        double start;
+
+        if (s->prepare != NULL && s->prepare(b, s) < 0) {
+            report_aug_error(s, b->aug);
+            goto done;
+        }
+        alloc_totals(&count0, &bytes0);
+        start = now_ms();
+        if (s->run(b, s) < 0) {
+            report_aug_error(s, b->aug);
+            goto done;
+        }
+        if (i >= warmup) {
+            times[i - warmup] = now_ms() - start;
+            alloc_totals(&count1, &bytes1);
+            hdr.allocations += count1 - count0;
+            hdr.alloc_bytes += bytes1 - bytes0;
+        }
+    }
+    hdr.ok = 1;
+    hdr.ntimes = repeat;
+    hdr.allocations /= repeat;
+    hdr.alloc_bytes /= repeat;
+
+ done:
+    aug_close(b->aug);
+    b->aug = NULL;
+    fa_free(b->fa);
+    b->fa = NULL;
+    if (write_all(fd, &hdr, sizeof(hdr)) == 0 && hdr.ok)
+        write_all(fd, times, repeat * sizeof(*times));
+    free(times);
+}
+
+struct stats {
+    int ok;
+    double median, p95, min, max, mean;
+    double allocations, alloc_bytes;
+    long peak_rss_kb;
+};
+
+static int cmp_double(const void *p1, const void *p2) {
+    double d1 = *(const double *) p1;
+    double d2 = *(const double *) p2;
+
+    return (d1 > d2) - (d1 < d2);
+}
+
+static void compute_stats(struct stats *st, double *times, unsigned int n) {
+    double sum = 0;
+    unsigned int rank;
+
+    qsort(times, n, sizeof(*times), cmp_double);
+    for (unsigned int i = 0; i < n; i++)
+        sum += times[i];
+
+    st->min = times[0];
+    st->max = times[n - 1];
+    st->mean = sum / n;
+    if (n % 2 == 1)
+        st->median = times[n / 2];
+    else
+        st->median = (times[n / 2 - 1] + times[n / 2]) / 2;
+    /* Nearest-rank percentile, ceil(0.95 * n) */
+    rank = (95 * n + 99) / 100;
+    st->p95 = times[rank > 0 ? rank - 1 : 0];
+}
+
+static void run_scenario(const struct scenario *s, struct bench *b,
+                         unsigned int warmup, unsigned int repeat,
+                         struct stats *st) {
+    struct result_header hdr;
+    struct rusage ru;
+    double *times = NULL;
+    int fds[2], status;
+    pid_t pid;
+
+    memset(st, 0, sizeof(*st));
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        run_child(s, b, warmup, repeat, fds[1]);
+        close(fds[1]);
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(fds[1]);
+    if (read_all(fds[0], &hdr, sizeof(hdr)) == 0 && hdr.ok
+        && hdr.ntimes == repeat) {
+        times = calloc(repeat, sizeof(*times));
+        if (times != NULL
+            && read_all(fds[0], times, repeat * sizeof(*times)) == 0) {
+            compute_stats(st, times, repeat);
+            st->allocations = hdr.allocations;
+            st->alloc_bytes = hdr.alloc_bytes;
+            st->ok = 1;
+        }
+        free(times);
+    }
+    close(fds[0]);
+
+    while (wait4(pid, &status, 0, &ru) < 0) {
+        if (errno != EINTR) {
+            perror("wait4");
+            st->ok = 0;
+            return;
+        }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        if (WIFSIGNALED(status))
+            fprintf(stderr, "%s: %s: killed by signal %d\n",
+                    progname, s->name, WTERMSIG(status));
+        st->ok = 0;
+    }
+    st->peak_rss_kb = ru.ru_maxrss;
+}
+
+/*
+ * Output
+ */
+static void print_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        switch (*s) {
+        case '"':
+            fputs("\\\"", out);
+            break;
+        case '\\':
+            fputs("\\\\", out);
+            break;
+        case '\n':
+            fputs("\\n", out);
+            break;
+        case '\t':
+            fputs("\\t", out);
+            break;
+        default:
+            if ((unsigned char) *s < 0x20)
+                fprintf(out, "\\u%04x", (unsigned char) *s);
+            else
+                fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void print_json_scenario(FILE *out, const struct scenario *s,
+                                const struct stats *st, bool last) {
+    fprintf(out, "    { \"name\": ");
+    print_json_string(out, s->name);
+    fprintf(out, ",\n      \"description\": ");
+    print_json_string(out, s->desc);
+    if (s->arg != NULL) {
+        fprintf(out, ",\n      \"arg\": ");
+        print_json_string(out, s->arg);
+    }
+    fprintf(out, ",\n      \"ok\": %s", st->ok ? "true" : "false");
+    if (st->ok) {
+        fprintf(out, ",\n      \"median_ms\": %.3f, \"p95_ms\": %.3f,"
+                " \"min_ms\": %.3f, \"max_ms\": %.3f, \"mean_ms\": %.3f",
+                st->median, st->p95, st->min, st->max, st->mean);
+        fprintf(out, ",\n      \"allocations\": %.0f, \"alloc_bytes\": %.0f",
+                st->allocations, st->alloc_bytes);
+    }
+    fprintf(out, ",\n      \"peak_rss_kb\": %ld }%s\n",
+            st->peak_rss_kb, last ? "" : ",");
+}
+
+/*
+ * Temporary corpus
+ */
+static int remove_entry(const char *path,
+                        ATTRIBUTE_UNUSED const struct stat *sb,
+                        ATTRIBUTE_UNUSED int typeflag,
+                        ATTRIBUTE_UNUSED struct FTW *ftwbuf) {
+    return remove(path);
+}
+
+static int remove_tree(const char *dir) {
+    return nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void list_scenarios(void) {
+    for (const struct scenario *s = scenarios; s->name != NULL; s++)
+        printf("%-22s %s\n", s->name, s->desc);
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: %s [OPTIONS] [SCENARIO...]\n", progname);
+    fprintf(stderr,
+"Run performance scenarios against the Augeas API and libfa and print a\n"
+"JSON report with timings, allocation counts and peak memory usage. Without\n"
+"SCENARIO, run all scenarios.\n\n"
+"Options:\n\n"
+"  -I, --include DIR  search DIR for modules; can be given only once\n"
+"  -r, --root ROOT    generate the corpus in ROOT and keep it there; by\n"
+"                     default a temporary directory is used and removed\n"
+"  -s, --scale N      number of entries in each corpus file (default %d)\n"
+"  -n, --repeat N     number of timed repetitions (default %d)\n"
+"  -w, --warmup N     number of untimed repetitions (default %d)\n"
+"  -o, --output FILE  write the JSON report to FILE instead of stdout\n"
+"  -l, --list         list the scenarios and exit\n",
+            DEFAULT_SCALE, DEFAULT_REPEAT, DEFAULT_WARMUP);
+    exit(EXIT_SUCCESS);
+}
+
+static unsigned int parse_count(const char *opt, const char *arg,
+                                unsigned int min) {
+    char *end;
+    unsigned long v;
+
+    errno = 0;
+    v = strtoul(arg, &end, 10);
+    if (errno != 0 || *end != '\0' || end == arg || v < min || v > 100000000) {
+        fprintf(stderr, "%s: invalid value '%s' for %s\n", progname, arg, opt);
+        exit(EXIT_FAILURE);
+    }
+    return v;
+}
+
+int main(int argc, char **argv) {
+    struct option options[] = {
+        { "include", 1, 0, 'I' },
+        { "root",    1, 0, 'r' },
+        { "scale",   1, 0, 's' },
+        { "repeat",  1, 0, 'n' },
+        { "warmup",  1, 0, 'w' },
+        { "output",  1, 0, 'o' },
+        { "list",    0, 0, 'l' },
+        { "help",    0, 0, 'h' },
+        { 0, 0, 0, 0}
+    };
+    struct bench bench;
+    const struct scenario **todo = NULL;
+    char tmpdir[] = "/tmp/augbench.XXXXXX";
+    const char *root = NULL;
+    const char *output = NULL;
+    unsigned int scale = DEFAULT_SCALE;
+    unsigned int repeat = DEFAULT_REPEAT;
+    unsigned int warmup = DEFAULT_WARMUP;
+    int ntodo = 0;
+    int opt, idx;
+    int failed = 0;
+    FILE *out = stdout;
+
+    progname = argv[0];
+    memset(&bench, 0, sizeof(bench));
+
+    while ((opt = getopt_long(argc, argv, "I:r:s:n:w:o:lh", options, &idx)) != -1) {
+        switch (opt) {
+        case 'I':
+            bench.loadpath = optarg;
+            break;
+        case 'r':
+            root = optarg;
+            break;
+        case 's':
+            scale = parse_count("--scale", optarg, 4);
+            break;
+        case 'n':
+            repeat = parse_count("--repeat", optarg, 1);
+            break;
+        case 'w':
+            warmup = parse_count("--warmup", optarg, 0);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'l':
+            list_scenarios();
+            exit(EXIT_SUCCESS);
+        case 'h':
+            usage();
+            break;
+        default:
+            fprintf(stderr, "Try '%s --help' for more information.\n",
+                    progname);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    todo = calloc(sizeof(scenarios) / sizeof(scenarios[0]) + argc, sizeof(*todo));
+    if (todo == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) {
+            todo[ntodo] = find_scenario(argv[i]);
+            if (todo[ntodo] == NULL) {
+                fprintf(stderr, "%s: unknown scenario '%s'\n",
+                        progname, argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            ntodo += 1;
+        }
+    } else {
+        for (const struct scenario *s = scenarios; s->name != NULL; s++)
+            todo[ntodo++] = s;
+    }
+
+    if (root == NULL) {
+        if (mkdtemp(tmpdir) == NULL) {
+            perror("mkdtemp");
+            exit(EXIT_FAILURE);
+        }
+        bench.root = tmpdir;
+    } else {
+        bench.root = root;
+    }
+    if (corpus_generate(bench.root, scale) < 0) {
+        fprintf(stderr, "%s: failed to generate corpus in %s: %s\n",
+                progname, bench.root, strerror(errno));
+        failed = 1;
+        goto done;
+    }
+    bench.scale = scale;
+
+    if (output != NULL) {
+        out = fopen(output, "w");
+        if (out == NULL) {
+            fprintf(stderr, "%s: can not open %s: %s\n",
+                    progname, output, strerror(errno));
+            failed = 1;
+            goto done;
+        }
+    }
+
+    fprintf(out, "{ \"version\": ");
+    print_json_string(out, PACKAGE_VERSION);
+    fprintf(out, ",\n  \"scale\": %u, \"warmup\": %u, \"repeat\": %u,\n",
+            scale, warmup, repeat);
+    fprintf(out, "  \"scenarios\": [\n");
+    for (int i = 0; i < ntodo; i++) {
+        struct stats st;
+
+        run_scenario(todo[i], &bench, warmup, repeat, &st);
+        if (st.ok)
+            fprintf(stderr, "%-22s median %10.3f ms  p95 %10.3f ms\n",
+                    todo[i]->name, st.median, st.p95);
+        else
+            fprintf(stderr, "%-22s FAILED\n", todo[i]->name);
+        failed |= !st.ok;
+        print_json_scenario(out, todo[i], &st, i + 1 == ntodo);
+    }
+    fprintf(out, "  ]\n}\n");
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "%s: error writing %s: %s\n",
+                progname, output, strerror(errno));
+        failed = 1;
+    }
+
+ done:
+    if (root == NULL)
+        remove_tree(tmpdir);
+    free(todo);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
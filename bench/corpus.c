@@ -0,0 +1,191 @@
+/*
+ * corpus.c: synthetic configuration files for augbench
+ *
+ * Copyright (C) 2026 The Augeas authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "corpus.h"
+
+/* The contents of the files only depend on SCALE, so that results from
+ * different runs can be compared */
+const struct corpus_file corpus_files[] = {
+    { "hosts", "/etc/hosts", "Hosts.lns" },
+    { "services", "/etc/services", "Services.lns" },
+    { "sshd_config", "/etc/ssh/sshd_config", "Sshd.lns" },
+    { "fstab", "/etc/fstab", "Fstab.lns" },
+    { "json", "/etc/bench/data.json", "Json.lns" },
+    { "xml", "/etc/xml/data.xml", "Xml.lns" },
+    { NULL, NULL, NULL }
+};
+
+/* The empty string stands for the root itself */
+static const char *const dirs[] = {
+    "", "/etc", "/etc/ssh", "/etc/bench", "/etc/xml", NULL
+};
+
+const struct corpus_file *corpus_file(const char *name) {
+    for (const struct corpus_file *f = corpus_files; f->name != NULL; f++)
+        if (strcmp(f->name, name) == 0)
+            return f;
+    return NULL;
+}
+
+static void gen_hosts(FILE *fp, unsigned int scale) {
+    fprintf(fp, "# /etc/hosts generated by augbench\n");
+    fprintf(fp, "127.0.0.1\tlocalhost localhost.localdomain\n");
+    for (unsigned int i = 0; i < scale; i++) {
+        if (i % 50 == 0)
+            fprintf(fp, "\n# block %u\n", i / 50);
+        fprintf(fp, "10.%u.%u.%u\thost%u.example.com host%u alias%u\n",
+                (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff, i, i, i);
+    }
+}
+
+static void gen_services(FILE *fp, unsigned int scale) {
+    fprintf(fp, "# /etc/services generated by augbench\n");
+    for (unsigned int i = 0; i < scale; i++) {
+        fprintf(fp, "svc%u\t\t%u/%s\t\tsvcalias%u\t# service %u\n",
+                i / 2, 1024 + i / 2, (i % 2 == 0) ? "tcp" : "udp", i / 2, i);
+    }
+}
+
+static void gen_sshd_config(FILE *fp, unsigned int scale) {
+    unsigned int nmatch = scale / 4;
+
+    fprintf(fp, "# sshd_config generated by augbench\n");
+    fprintf(fp, "Port 22\n");
+    fprintf(fp, "PermitRootLogin no\n");
+    fprintf(fp, "AcceptEnv LANG LC_CTYPE LC_NUMERIC LC_TIME\n");
+    fprintf(fp, "Subsystem sftp /usr/libexec/openssh/sftp-server\n");
+    for (unsigned int i = 0; i < scale - nmatch; i++) {
+        switch (i % 3) {
+        case 0:
+            fprintf(fp, "HostKey /etc/ssh/ssh_host_%u_key\n", i);
+            break;
+        case 1:
+            fprintf(fp, "ListenAddress 10.%u.%u.%u\n",
+                    (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+            break;
+        default:
+            fprintf(fp, "# setting %u\n", i);
+            break;
+        }
+    }
+    /* Match blocks must come last */
+    for (unsigned int i = 0; i < nmatch; i++) {
+        fprintf(fp, "Match User user%u\n", i);
+        fprintf(fp, "    X11Forwarding no\n");
+        fprintf(fp, "    AllowTcpForwarding %s\n", (i % 2) ? "yes" : "no");
+    }
+}
+
+static void gen_fstab(FILE *fp, unsigned int scale) {
+    fprintf(fp, "# /etc/fstab generated by augbench\n");
+    fprintf(fp, "/dev/sda1\t/\text4\tdefaults\t1 1\n");
+    for (unsigned int i = 0; i < scale; i++) {
+        fprintf(fp, "/dev/disk/by-id/disk%u\t/srv/d%u\t%s\t%s\t0 2\n",
+                i, i, (i % 2) ? "xfs" : "ext4",
+                (i % 3) ? "defaults,noatime" : "ro,nosuid,nodev");
+    }
+}
+
+static void gen_json(FILE *fp, unsigned int scale) {
+    unsigned int n = scale / 4;
+
+    fprintf(fp, "{\n  \"generator\": \"augbench\",\n  \"items\": [\n");
+    for (unsigned int i = 0; i < n; i++) {
+        fprintf(fp, "    { \"id\": %u, \"name\": \"item%u\", "
+                "\"enabled\": %s, \"tags\": [ \"a\", \"b%u\" ] }%s\n",
+                i, i, (i % 2) ? "true" : "false", i,
+                (i + 1 < n) ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+static void gen_xml(FILE *fp, unsigned int scale) {
+    unsigned int n = scale / 4;
+
+    fprintf(fp, "<?xml version=\"1.0\"?>\n<items>\n");
+    for (unsigned int i = 0; i < n; i++) {
+        fprintf(fp, "  <item id=\"%u\" name=\"item%u\">\n", i, i);
+        fprintf(fp, "    <value>%u</value>\n", i);
+        fprintf(fp, "    <flag/>\n");
+        fprintf(fp, "  </item>\n");
+    }
+    fprintf(fp, "</items>\n");
+}
+
+static int write_file(const char *root, const char *path, unsigned int scale,
+                      void (*gen)(FILE *, unsigned int)) {
+    char *fname = NULL;
+    FILE *fp;
+    int r;
+
+    if (asprintf(&fname, "%s%s", root, path) < 0)
+        return -1;
+    fp = fopen(fname, "w");
+    free(fname);
+    if (fp == NULL)
+        return -1;
+    gen(fp, scale);
+    r = ferror(fp) ? -1 : 0;
+    if (fclose(fp) != 0)
+        r = -1;
+    return r;
+}
+
+int corpus_generate(const char *root, unsigned int scale) {
+    static void (*const gens[])(FILE *, unsigned int) = {
+        gen_hosts, gen_services, gen_sshd_config, gen_fstab, gen_json, gen_xml
+    };
+
+    for (int i = 0; dirs[i] != NULL; i++) {
+        char *dir = NULL;
+        int r;
+
+        if (asprintf(&dir, "%s%s", root, dirs[i]) < 0)
+            return -1;
+        r = mkdir(dir, 0755);
+        free(dir);
+        if (r < 0 && errno != EEXIST)
+            return -1;
+    }
+
+    for (int i = 0; corpus_files[i].name != NULL; i++) {
+        if (write_file(root, corpus_files[i].path, scale, gens[i]) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
@@ -0,0 +1,57 @@
+/*
+ * corpus.h: synthetic configuration files for augbench
+ *
+ * Copyright (C) 2026 The Augeas authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef CORPUS_H_
+#define CORPUS_H_
+
+/* A file in the corpus, relative to the corpus root, and the lens that
+ * reads it */
+struct corpus_file {
+    const char *name;
+    const char *path;
+    const char *lens;
+};
+
+/* The files that corpus_generate writes, terminated by an entry with a
+ * NULL name */
+extern const struct corpus_file corpus_files[];
+
+/* Look up the file called NAME in CORPUS_FILES, or return NULL */
+const struct corpus_file *corpus_file(const char *name);
+
+/* Write every file in CORPUS_FILES underneath the directory ROOT, creating
+ * ROOT and its subdirectories as needed. SCALE is the number of entries in the line-oriented files;
+ * the JSON and XML files get SCALE / 4 elements, since each of them is
+ * several lines long.
+ *
+ * Returns 0 on success, and -1 with errno set on failure
+ */
+int corpus_generate(const char *root, unsigned int scale);
+
+#endif
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
@@ -48,10 +48,14 @@ struct dict_node {
     char *key;
     struct dict_entry *entry; /* This will change as entries are looked up */
     struct dict_entry *mark;  /* Pointer to initial entry, will never change */
+    uint32_t order;           /* Position of the node before sorting */
 };
 
-/* Nodes are kept sorted by their key, with NULL being smaller than any
-   string */
+/* During construction, nodes are simply appended, and the same key may be
+   used by several nodes. The first lookup sorts the nodes by their key,
+   with NULL being smaller than any string, and merges the nodes for the
+   same key, so that each construction step takes constant time even for
+   dicts with many keys */
 struct dict {
     struct dict_node **nodes;
     uint32_t          size;
@@ -60,7 +64,6 @@ struct dict {
 };
 
 static const int dict_initial_size = 2;
-static const int dict_max_expansion = 128;
 static const uint32_t dict_max_size = (1<<24) - 1;
 
 struct dict *make_dict(char *key, struct skel *skel, struct dict *subdict) {
@@ -140,19 +143,17 @@ static int dict_pos(struct dict *dict, const char *key) {
     return -(l + 1);
 }
 
-static int dict_expand(struct dict *dict) {
+static int dict_expand(struct dict *dict, uint32_t needed) {
     uint32_t size = dict->size;
 
-    if (size == dict_max_size)
+    if (needed > dict_max_size)
+        return -1;
+    while (size < needed)
+        size = (size > dict_max_size / 2) ? dict_max_size : 2 * size;
+    if (REALLOC_N(dict->nodes, size) < 0)
         return -1;
-    if (size > dict_max_expansion)
-        size += dict_max_expansion;
-    else
-        size *= 2;
-    if (size > dict_max_size)
-        size = dict_max_size;
     dict->size = size;
-    return REALLOC_N(dict->nodes, dict->size);
+    return 0;
 }
 
 int dict_append(struct dict **dict, struct dict *d2) {
@@ -165,42 +166,66 @@ int dict_append(struct dict **dict, struct dict *d2) {
     }
 
     struct dict *d1 = *dict;
-    for (int i2 = 0; i2 < d2->used; i2++) {
-        struct dict_node *n2 = d2->nodes[i2];
-        int i1 = dict_pos(d1, n2->key);
-        if (i1 < 0) {
-            i1 = - i1 - 1;
-            if (d1->size == d1->used) {
-                if (dict_expand(d1) < 0)
-                    return -1;
-            }
-            memmove(d1->nodes + i1 + 1, d1->nodes + i1,
-                    sizeof(*d1->nodes) * (d1->used - i1));
-            d1->nodes[i1] = n2;
-            d1->used += 1;
-        } else {
-            struct dict_node *n1 = d1->nodes[i1];
-            list_tail_cons(n1->entry, n1->mark, n2->entry);
-            FREE(n2->key);
-            FREE(n2);
-        }
+    if (d1->used + d2->used > d1->size) {
+        if (dict_expand(d1, d1->used + d2->used) < 0)
+            return -1;
     }
+    memcpy(d1->nodes + d1->used, d2->nodes, sizeof(*d2->nodes) * d2->used);
+    d1->used += d2->used;
     FREE(d2->nodes);
     FREE(d2);
     return 0;
 }
 
+static int dict_node_cmp(const void *p1, const void *p2) {
+    const struct dict_node *n1 = *(const struct dict_node **) p1;
+    const struct dict_node *n2 = *(const struct dict_node **) p2;
+    int cmp;
+
+    if (n1->key == NULL || n2->key == NULL)
+        cmp = (n1->key != NULL) - (n2->key != NULL);
+    else
+        cmp = strcmp(n1->key, n2->key);
+    if (cmp == 0)
+        cmp = (n1->order > n2->order) - (n1->order < n2->order);
+    return cmp;
+}
+
+/* Finish construction of DICT: sort its nodes, merge the entries of nodes
+   with the same key in the order in which they were appended, and point
+   MARK at the head of each list of entries */
+static void dict_mark(struct dict *dict) {
+    uint32_t used = 0;
+
+    for (uint32_t i=0; i < dict->used; i++)
+        dict->nodes[i]->order = i;
+    qsort(dict->nodes, dict->used, sizeof(*dict->nodes), dict_node_cmp);
+
+    for (uint32_t i=0; i < dict->used; i++) {
+        struct dict_node *node = dict->nodes[i];
+        if (used > 0 && streqv(dict->nodes[used - 1]->key, node->key)) {
+            struct dict_node *prev = dict->nodes[used - 1];
+            list_tail_cons(prev->entry, prev->mark, node->entry);
+            free(node->key);
+            free(node);
+        } else {
+            dict->nodes[used++] = node;
+        }
+    }
+    dict->used = used;
+
+    for (uint32_t i=0; i < dict->used; i++)
+        dict->nodes[i]->mark = dict->nodes[i]->entry;
+    dict->marked = 1;
+}
+
 void dict_lookup(const char *key, struct dict *dict,
                  struct skel **skel, struct dict **subdict) {
     *skel = NULL;
     *subdict = NULL;
     if (dict != NULL) {
-        if (! dict->marked) {
-            for (int i=0; i < dict->used; i++) {
-                dict->nodes[i]->mark = dict->nodes[i]->entry;
-            }
-            dict->marked = 1;
-        }
+        if (! dict->marked)
+            dict_mark(dict);
         int p = dict_pos(dict, key);
         if (p >= 0) {
             struct dict_node *node = dict->nodes[p];
@@ -21,9 +21,13 @@
  */
 
 #include <config.h>
+
+#define MEM_SUBSYS MEM_TREE
+
 #include "augeas.h"
 #include "internal.h"
 #include "memory.h"
+#include "ref.h"
 #include "syntax.h"
 #include "transform.h"
 #include "errcode.h"
@@ -33,6 +37,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <locale.h>
+#include <stddef.h>
 
 /* Some popular labels that we use in /augeas */
 static const char *const s_augeas = "augeas";
@@ -45,6 +50,7 @@ static const char *const s_vars   = "variables";
 static const char *const s_lens   = "lens";
 static const char *const s_excl   = "excl";
 static const char *const s_incl   = "incl";
+static const char *const s_metrics = "metrics";
 
 #define AUGEAS_META_PATHX_FUNC AUGEAS_META_TREE "/version/pathx/functions"
 
@@ -138,6 +144,73 @@ struct tree *tree_path_cr(struct tree *tree, int n, ...) {
     return tree;
 }
 
+/* The timers in struct aug_metrics and their labels under
+ * AUGEAS_META_METRICS */
+static const struct {
+    const char *name;
+    size_t      offset;
+} metric_timers[] = {
+    { "module_load", offsetof(struct aug_metrics, module_load) },
+    { "glob",        offsetof(struct aug_metrics, glob) },
+    { "read",        offsetof(struct aug_metrics, read) },
+    { "get",         offsetof(struct aug_metrics, get) },
+    { "parse",       offsetof(struct aug_metrics, parse) },
+    { "put",         offsetof(struct aug_metrics, put) },
+    { "write",       offsetof(struct aug_metrics, write) },
+    { "rename",      offsetof(struct aug_metrics, rename) },
+    { "pathx_parse", offsetof(struct aug_metrics, pathx_parse) },
+    { "pathx_eval",  offsetof(struct aug_metrics, pathx_eval) }
+};
+
+/* Copy the timers of AUG into AUGEAS_META_METRICS. This only happens at
+ * the end of aug_init, aug_load, aug_load_file and aug_save, and in
+ * aug_metrics_reset, so that values obtained from the tree stay valid
+ * until the next such call. Failing to allocate a node only means that
+ * the timers are not all visible, so we do not report that */
+static void metrics_to_tree(struct augeas *aug) {
+    struct tree *meta = tree_child_cr(aug->origin, s_augeas);
+    struct tree *metrics = tree_child_cr(meta, s_metrics);
+    bool origin_dirty, meta_dirty;
+    char buf[32];
+
+    if (metrics == NULL)
+        return;
+    /* The snapshot is not a change that needs saving; leave the dirty
+     * flags of the nodes above it as they were */
+    origin_dirty = aug->origin->dirty;
+    meta_dirty = meta->dirty;
+    for (int i=0; i < ARRAY_CARDINALITY(metric_timers); i++) {
+        const struct aug_timer *timer = (const struct aug_timer *)
+            ((const char *) &aug->metrics + metric_timers[i].offset);
+        struct tree *t = tree_child_cr(metrics, metric_timers[i].name);
+        struct tree *count = tree_child_cr(t, "count");
+        struct tree *nsec = tree_child_cr(t, "nsec");
+
+        if (count == NULL || nsec == NULL)
+            break;
+        snprintf(buf, sizeof(buf), "%lu", timer->count);
+        tree_set_value(count, buf);
+        snprintf(buf, sizeof(buf), "%llu", timer->nsec);
+        tree_set_value(nsec, buf);
+    }
+    tree_clean(metrics);
+    meta->dirty = meta_dirty;
+    aug->origin->dirty = origin_dirty;
+}
+
+void tree_load_lazy(const struct augeas *aug, struct tree *tree) {
+    if (tree->lazy && aug != NULL)
+        transform_load_lazy((struct augeas *) aug, tree);
+}
+
+void tree_load_lazy_all(const struct augeas *aug, struct tree *tree) {
+    if (aug == NULL || !(aug->flags & AUG_LAZY_LOAD))
+        return;
+    tree_load_lazy(aug, tree);
+    list_for_each(c, tree->children)
+        tree_load_lazy_all(aug, c);
+}
+
 static struct tree *tree_fpath_int(struct augeas *aug, const char *fpath,
                                    bool create) {
     int r;
@@ -149,6 +222,7 @@ static struct tree *tree_fpath_int(struct augeas *aug, const char *fpath,
     ERR_NOMEM(r < 0, aug);
     result = aug->origin;
     while ((step = argz_next(steps, nsteps, step))) {
+        tree_load_lazy(aug, result);
         if (create) {
             result = tree_child_cr(result, step);
             ERR_THROW(result == NULL, aug, AUG_ENOMEM,
@@ -181,7 +255,7 @@ struct tree *tree_find(struct augeas *aug, const char *path) {
     struct tree *result = NULL;
     int r;
 
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
+    p = pathx_aug_parse_ctx(aug, path, true);
     ERR_BAIL(aug);
 
     r = pathx_find_one(p, &result);
@@ -201,7 +275,7 @@ struct tree *tree_find_cr(struct augeas *aug, const char *path) {
     struct tree *result = NULL;
     int r;
 
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
+    p = pathx_aug_parse_ctx(aug, path, true);
     ERR_BAIL(aug);
 
     r = pathx_expand_tree(p, &result);
@@ -212,6 +286,77 @@ struct tree *tree_find_cr(struct augeas *aug, const char *path) {
     return result;
 }
 
+struct tree_text {
+    ref_t  ref;
+    size_t used;
+    size_t size;
+    char  *buf;
+};
+
+struct tree_text *make_tree_text(size_t size) {
+    struct tree_text *text = NULL;
+
+    if (make_ref(text) < 0)
+        return NULL;
+    if (ALLOC_N(text->buf, size) < 0) {
+        free(text);
+        return NULL;
+    }
+    text->size = size;
+    return text;
+}
+
+static void free_tree_text(struct tree_text *text) {
+    if (text == NULL)
+        return;
+    assert(text->ref == 0);
+    free(text->buf);
+    free(text);
+}
+
+void tree_text_release(struct tree_text *text) {
+    unref(text, tree_text);
+}
+
+char *tree_text_add(struct tree_text *text, const char *s, size_t len) {
+    char *result;
+
+    if (len >= text->size - text->used)
+        return NULL;
+    result = text->buf + text->used;
+    memcpy(result, s, len);
+    result[len] = '\0';
+    text->used += len + 1;
+    return result;
+}
+
+bool tree_text_has(const struct tree_text *text, const char *s) {
+    return text != NULL && s != NULL
+        && s >= text->buf && s < text->buf + text->used;
+}
+
+void tree_share_text(struct tree *tree, struct tree_text *text) {
+    if (tree->text != NULL)
+        return;
+    if (tree_text_has(text, tree->label) || tree_text_has(text, tree->value))
+        tree->text = ref(text);
+}
+
+void tree_free_str(struct tree *tree, char *s) {
+    if (! tree_text_has(tree->text, s))
+        free(s);
+}
+
+int tree_own_value(struct tree *tree) {
+    if (tree_text_has(tree->text, tree->value)) {
+        char *v = strdup(tree->value);
+        if (v == NULL)
+            return -1;
+        tree->value = v;
+    }
+    return 0;
+}
+
 void tree_store_value(struct tree *tree, char **value) {
     if (streqv(tree->value, *value)) {
         free(*value);
@@ -219,7 +364,7 @@ void tree_store_value(struct tree *tree, char **value) {
         return;
     }
     if (tree->value != NULL) {
-        free(tree->value);
+        tree_free_str(tree, tree->value);
         tree->value = NULL;
     }
     if (*value != NULL) {
@@ -291,6 +436,59 @@ struct pathx *pathx_aug_parse(const struct augeas *aug,
     return result;
 }
 
+struct pathx *pathx_aug_parse_ctx(const struct augeas *aug,
+                                  const char *path, bool need_nodeset) {
+    struct pathx *result;
+    struct tree *root_ctx;
+
+    result = pathx_aug_parse(aug, aug->origin, NULL, path, need_nodeset);
+    if (result == NULL || HAS_ERR(aug) || ! pathx_uses_root_ctx(result))
+        return result;
+
+    root_ctx = tree_root_ctx(aug);
+    pathx_set_root_ctx(result, root_ctx);
+    return result;
+}
+
+/* Look up PATH by walking down from ORIGIN, without going through a path
+ * expression. This only works for absolute PATHs that are nothing but
+ * plain labels separated by '/', and where every step matches exactly one
+ * node. Return NULL if that is not the case, and the caller needs to use
+ * a full path expression instead. */
+static struct tree *tree_find_plain(const struct augeas *aug,
+                                    const char *path) {
+    static const char plain[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-.";
+    struct tree *tree = aug->origin;
+
+    if (*path != SEP)
+        return NULL;
+    while (*path == SEP) {
+        const char *step = path + 1;
+        size_t len = strspn(step, plain);
+        struct tree *found = NULL;
+
+        path = step + len;
+        if (len == 0 || (*path != SEP && *path != '\0'))
+            return NULL;
+        if (step[0] == '.' && (len == 1 || (len == 2 && step[1] == '.')))
+            return NULL;
+        tree_load_lazy(aug, tree);
+        list_for_each(child, tree->children) {
+            if (child->label != NULL && strlen(child->label) == len
+                && STREQLEN(child->label, step, len)) {
+                if (found != NULL)
+                    return NULL;
+                found = child;
+            }
+        }
+        if (found == NULL)
+            return NULL;
+        tree = found;
+    }
+    return *path == '\0' ? tree : NULL;
+}
+
 /* Find the tree stored in AUGEAS_CONTEXT */
 struct tree *tree_root_ctx(const struct augeas *aug) {
     struct pathx *p = NULL;
@@ -298,20 +496,29 @@ struct tree *tree_root_ctx(const struct augeas *aug) {
     const char *ctx_path;
     int r;
 
-    p = pathx_aug_parse(aug, aug->origin, NULL, AUGEAS_CONTEXT, true);
-    ERR_BAIL(aug);
+    match = tree_find_plain(aug, AUGEAS_CONTEXT);
+    if (match == NULL) {
+        p = pathx_aug_parse(aug, aug->origin, NULL, AUGEAS_CONTEXT, true);
+        ERR_BAIL(aug);
 
-    r = pathx_find_one(p, &match);
-    ERR_THROW(r > 1, aug, AUG_EMMATCH,
-              "There are %d nodes matching %s, expecting one",
-              r, AUGEAS_CONTEXT);
+        r = pathx_find_one(p, &match);
+        ERR_THROW(r > 1, aug, AUG_EMMATCH,
+                  "There are %d nodes matching %s, expecting one",
+                  r, AUGEAS_CONTEXT);
+        free_pathx(p);
+        p = NULL;
+    }
 
     if (match == NULL || match->value == NULL || *match->value == '\0')
         goto error;
 
     /* Clean via augrun's helper to ensure it's valid */
     ctx_path = cleanpath(match->value);
-    free_pathx(p);
+
+    /* The context is almost always a plain path like /files/etc */
+    match = tree_find_plain(aug, ctx_path);
+    if (match != NULL)
+        return match;
 
     p = pathx_aug_parse(aug, aug->origin, NULL, ctx_path, true);
     ERR_BAIL(aug);
@@ -338,11 +545,56 @@ struct tree *tree_root_ctx(const struct augeas *aug) {
     goto done;
 }
 
+void tree_children_changed(struct tree *tree) {
+    tree->last = NULL;
+    tree->nlast = 0;
+}
+
+struct tree *tree_last_child(struct tree *parent, unsigned int *count) {
+    struct tree *last = parent->last;
+
+    if (last == NULL) {
+        last = parent->children;
+        if (last == NULL)
+            return NULL;
+        while (last->next != NULL)
+            last = last->next;
+        parent->last = last;
+        parent->nlast = 0;
+    }
+    if (count != NULL) {
+        if (parent->nlast == 0) {
+            list_for_each(c, parent->children) {
+                if (streqv(c->label, last->label))
+                    parent->nlast += 1;
+            }
+        }
+        *count = parent->nlast;
+    }
+    return last;
+}
+
+void tree_append_child(struct tree *parent, struct tree *child) {
+    struct tree *last = tree_last_child(parent, NULL);
+
+    if (last == NULL) {
+        parent->children = child;
+        parent->nlast = 1;
+    } else {
+        last->next = child;
+        if (parent->nlast > 0 && streqv(last->label, child->label))
+            parent->nlast += 1;
+        else
+            parent->nlast = 0;
+    }
+    parent->last = child;
+}
+
 struct tree *tree_append(struct tree *parent,
                          char *label, char *value) {
     struct tree *result = make_tree(label, value, parent, NULL);
     if (result != NULL)
-        list_append(parent->children, result);
+        tree_append_child(parent, result);
     return result;
 }
 
@@ -432,6 +684,10 @@ static void restore_locale(ATTRIBUTE_UNUSED struct augeas *aug) { }
  * count of how many times a public API call was made, and only reset when
  * that count is 0. That requires that all public functions enclose their
  * work within a matching pair of api_entry/api_exit calls.
+ *
+ * The error is only touched when the previous call actually failed, and
+ * inside a session the locale stays as it is, so that a successful
+ * read-only call does not write anything but the entry count.
  */
 void api_entry(const struct augeas *aug) {
     struct error *err = ((struct augeas *) aug)->error;
@@ -441,8 +697,10 @@ void api_entry(const struct augeas *aug) {
     if (aug->api_entries > 1)
         return;
 
-    reset_error(err);
-    save_locale((struct augeas *) aug);
+    if (err->code != AUG_NOERROR || err->details != NULL)
+        reset_error(err);
+    if (aug->sessions == 0)
+        save_locale((struct augeas *) aug);
 }
 
 void api_exit(const struct augeas *aug) {
@@ -450,10 +708,39 @@ void api_exit(const struct augeas *aug) {
     ((struct augeas *) aug)->api_entries -= 1;
     if (aug->api_entries == 0) {
         store_pathx_error(aug);
-        restore_locale((struct augeas *) aug);
+        if (aug->sessions == 0)
+            restore_locale((struct augeas *) aug);
     }
 }
 
+int aug_session_begin(struct augeas *aug) {
+    int result = -1;
+
+    api_entry(aug);
+    ERR_THROW(aug->api_entries > 1, aug, AUG_EINTERNAL,
+              "a session can not begin inside another API call");
+    /* Keep the locale that api_entry switched to until the session ends */
+    aug->sessions += 1;
+    result = 0;
+ error:
+    api_exit(aug);
+    return result;
+}
+
+int aug_session_end(struct augeas *aug) {
+    int result = -1;
+
+    api_entry(aug);
+    ERR_THROW(aug->sessions == 0, aug, AUG_EBADARG, "not in a session");
+    ERR_THROW(aug->api_entries > 1, aug, AUG_EINTERNAL,
+              "a session can not end inside another API call");
+    aug->sessions -= 1;
+    result = 0;
+ error:
+    api_exit(aug);
+    return result;
+}
+
 static int init_root(struct augeas *aug, const char *root0) {
     if (root0 == NULL)
         root0 = getenv(AUGEAS_ROOT_ENV);
@@ -606,6 +893,8 @@ struct augeas *aug_init(const char *root, const char *loadpath,
     init_save_mode(result);
     ERR_BAIL(result);
 
+    metrics_to_tree(result);
+
     const char *v = (flags & AUG_ENABLE_SPAN) ? AUG_ENABLE : AUG_DISABLE;
     aug_set(result, AUGEAS_SPAN_OPTION, v);
     ERR_BAIL(result);
@@ -644,8 +933,9 @@ static void free_tree_node(struct tree *tree) {
 
     if (tree->span != NULL)
         free_span(tree->span);
-    free(tree->label);
-    free(tree->value);
+    tree_free_str(tree, tree->label);
+    tree_free_str(tree, tree->value);
+    unref(tree->text, tree_text);
     free(tree);
 }
 
@@ -655,6 +945,7 @@ static int tree_unlink_raw(struct tree *tree) {
 
     assert (tree->parent != NULL);
     list_remove(tree, tree->parent->children);
+    tree_children_changed(tree->parent);
     tree_mark_dirty(tree->parent);
     result = free_tree(tree->children) + 1;
     free_tree_node(tree);
@@ -782,9 +1073,11 @@ int aug_load(struct augeas *aug) {
         ERR_BAIL(aug);
     }
 
+    metrics_to_tree(aug);
     api_exit(aug);
     return 0;
  error:
+    metrics_to_tree(aug);
     api_exit(aug);
     return -1;
 }
@@ -816,13 +1109,20 @@ int aug_get(const struct augeas *aug, const char *path, const char **value) {
 
     api_entry(aug);
 
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
-    ERR_BAIL(aug);
+    /* Plain paths, the most common case in read loops, need no path
+     * expression */
+    match = tree_find_plain(aug, path);
+    if (match != NULL) {
+        r = 1;
+    } else {
+        p = pathx_aug_parse_ctx(aug, path, true);
+        ERR_BAIL(aug);
 
-    r = pathx_find_one(p, &match);
-    ERR_BAIL(aug);
-    ERR_THROW(r > 1, aug, AUG_EMMATCH, "There are %d nodes matching %s",
-              r, path);
+        r = pathx_find_one(p, &match);
+        ERR_BAIL(aug);
+        ERR_THROW(r > 1, aug, AUG_EMMATCH, "There are %d nodes matching %s",
+                  r, path);
+    }
 
     if (r == 1 && value != NULL)
         *value = match->value;
@@ -843,16 +1143,21 @@ int aug_label(const struct augeas *aug, const char *path, const char **label) {
 
     api_entry(aug);
 
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
-    ERR_BAIL(aug);
-
     if (label != NULL)
         *label = NULL;
 
-    r = pathx_find_one(p, &match);
-    ERR_BAIL(aug);
-    ERR_THROW(r > 1, aug, AUG_EMMATCH, "There are %d nodes matching %s",
-              r, path);
+    match = tree_find_plain(aug, path);
+    if (match != NULL) {
+        r = 1;
+    } else {
+        p = pathx_aug_parse_ctx(aug, path, true);
+        ERR_BAIL(aug);
+
+        r = pathx_find_one(p, &match);
+        ERR_BAIL(aug);
+        ERR_THROW(r > 1, aug, AUG_EMMATCH, "There are %d nodes matching %s",
+                  r, path);
+    }
 
     if (r == 1 && label != NULL)
         *label = match->label;
@@ -891,7 +1196,7 @@ int aug_defvar(augeas *aug, const char *name, const char *expr) {
     if (expr == NULL) {
         result = pathx_symtab_undefine(&(aug->symtab), name);
     } else {
-        p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), expr, false);
+        p = pathx_aug_parse_ctx(aug, expr, false);
         ERR_BAIL(aug);
         result = pathx_symtab_define(&(aug->symtab), name, p);
     }
@@ -919,7 +1224,7 @@ int aug_defnode(augeas *aug, const char *name, const char *expr,
     if (created == NULL)
         created = &cr;
 
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), expr, false);
+    p = pathx_aug_parse_ctx(aug, expr, false);
     ERR_BAIL(aug);
 
     if (pathx_first(p) == NULL) {
@@ -962,6 +1267,9 @@ struct tree *tree_set(struct pathx *p, const char *value) {
     if (r == -1)
         return NULL;
 
+    /* The file's contents must be there before it can be changed */
+    tree_load_lazy(aug_of_pathx(p), tree);
+
     r = tree_set_value(tree, value);
     if (r < 0)
         return NULL;
@@ -974,12 +1282,9 @@ int aug_set(struct augeas *aug, const char *path, const char *value) {
 
     api_entry(aug);
 
-    /* Get-out clause, in case context is broken */
-    struct tree *root_ctx = NULL;
-    if (STRNEQ(path, AUGEAS_CONTEXT))
-        root_ctx = tree_root_ctx(aug);
-
-    p = pathx_aug_parse(aug, aug->origin, root_ctx, path, true);
+    /* Since AUGEAS_CONTEXT is absolute, setting it never looks at the
+     * current context, even if that is broken */
+    p = pathx_aug_parse_ctx(aug, path, true);
     ERR_BAIL(aug);
 
     result = tree_set(p, value) == NULL ? -1 : 0;
@@ -989,6 +1294,29 @@ int aug_set(struct augeas *aug, const char *path, const char *value) {
     return result;
 }
 
+int aug_set_take(struct augeas *aug, const char *path, char *value) {
+    struct pathx *p = NULL;
+    struct tree *tree;
+    int result = -1, r;
+
+    api_entry(aug);
+
+    p = pathx_aug_parse_ctx(aug, path, true);
+    ERR_BAIL(aug);
+
+    r = pathx_expand_tree(p, &tree);
+    if (r == -1)
+        goto error;
+
+    tree_store_value(tree, &value);
+    result = 0;
+ error:
+    free(value);
+    free_pathx(p);
+    api_exit(aug);
+    return result;
+}
+
 int aug_setm(struct augeas *aug, const char *base,
              const char *sub, const char *value) {
     struct pathx *bx = NULL, *sx = NULL;
@@ -997,7 +1325,7 @@ int aug_setm(struct augeas *aug, const char *base,
 
     api_entry(aug);
 
-    bx = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), base, true);
+    bx = pathx_aug_parse_ctx(aug, base, true);
     ERR_BAIL(aug);
 
     if (sub != NULL && STREQ(sub, "."))
@@ -1006,9 +1334,14 @@ int aug_setm(struct augeas *aug, const char *base,
     result = 0;
     for (bt = pathx_first(bx); bt != NULL; bt = pathx_next(bx)) {
         if (sub != NULL) {
-            /* Handle subnodes of BT */
-            sx = pathx_aug_parse(aug, bt, NULL, sub, true);
-            ERR_BAIL(aug);
+            /* Handle subnodes of BT; SUB is only parsed once, and then
+             * evaluated against each BT in turn */
+            if (sx == NULL) {
+                sx = pathx_aug_parse(aug, bt, NULL, sub, true);
+                ERR_BAIL(aug);
+            } else {
+                pathx_rebind(sx, bt);
+            }
             if (pathx_first(sx) != NULL) {
                 /* Change existing subnodes matching SUB */
                 for (st = pathx_first(sx); st != NULL; st = pathx_next(sx)) {
@@ -1025,8 +1358,6 @@ int aug_setm(struct augeas *aug, const char *base,
                 ERR_NOMEM(r < 0, aug);
                 result += 1;
             }
-            free_pathx(sx);
-            sx = NULL;
         } else {
             /* Set nodes matching BT directly */
             r = tree_set_value(bt, value);
@@ -1064,6 +1395,7 @@ int tree_insert(struct pathx *p, const char *label, int before) {
         new->next = match->next;
         match->next = new;
     }
+    tree_children_changed(new->parent);
     return 0;
  error:
     free_tree(new);
@@ -1077,7 +1409,7 @@ int aug_insert(struct augeas *aug, const char *path, const char *label,
 
     api_entry(aug);
 
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
+    p = pathx_aug_parse_ctx(aug, path, true);
     ERR_BAIL(aug);
 
     result = tree_insert(p, label, before);
@@ -1191,7 +1523,7 @@ int aug_rm(struct augeas *aug, const char *path) {
 
     api_entry(aug);
 
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
+    p = pathx_aug_parse_ctx(aug, path, true);
     ERR_BAIL(aug);
 
     result = tree_rm(p);
@@ -1212,13 +1544,14 @@ int aug_span(struct augeas *aug, const char *path, char **filename,
 
     api_entry(aug);
 
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
+    p = pathx_aug_parse_ctx(aug, path, true);
     ERR_BAIL(aug);
 
     tree = pathx_first(p);
     ERR_BAIL(aug);
 
     ERR_THROW(tree == NULL, aug, AUG_ENOMATCH, "No node matching %s", path);
+    tree_load_lazy(aug, tree);
     ERR_THROW(tree->span == NULL, aug, AUG_ENOSPAN, "No span info for %s", path);
     ERR_THROW(pathx_next(p) != NULL, aug, AUG_EMMATCH, "Multiple nodes match %s", path);
 
@@ -1267,10 +1600,10 @@ int aug_mv(struct augeas *aug, const char *src, const char *dst) {
     api_entry(aug);
 
     ret = -1;
-    s = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), src, true);
+    s = pathx_aug_parse_ctx(aug, src, true);
     ERR_BAIL(aug);
 
-    d = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), dst, true);
+    d = pathx_aug_parse_ctx(aug, dst, true);
     ERR_BAIL(aug);
 
     r = find_one_node(s, &ts);
@@ -1281,6 +1614,10 @@ int aug_mv(struct augeas *aug, const char *src, const char *dst) {
     if (r == -1)
         goto error;
 
+    /* Files underneath SRC can only be loaded where they belong */
+    tree_load_lazy_all(aug, ts);
+    tree_load_lazy(aug, td);
+
     /* Don't move SRC into its own descendent */
     t = td;
     do {
@@ -1289,17 +1626,23 @@ int aug_mv(struct augeas *aug, const char *src, const char *dst) {
         t = t->parent;
     } while (t != aug->origin);
 
+    /* TD does not share TS's text */
+    r = tree_own_value(ts);
+    ERR_NOMEM(r < 0, aug);
+
     free_tree(td->children);
 
     td->children = ts->children;
+    tree_children_changed(td);
     list_for_each(c, td->children) {
         c->parent = td;
     }
-    free(td->value);
+    tree_free_str(td, td->value);
     td->value = ts->value;
 
     ts->value = NULL;
     ts->children = NULL;
+    tree_children_changed(ts);
 
     tree_unlink(aug, ts);
     tree_mark_dirty(td);
@@ -1331,10 +1674,10 @@ int aug_cp(struct augeas *aug, const char *src, const char *dst) {
     api_entry(aug);
 
     ret = -1;
-    s = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), src, true);
+    s = pathx_aug_parse_ctx(aug, src, true);
     ERR_BAIL(aug);
 
-    d = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), dst, true);
+    d = pathx_aug_parse_ctx(aug, dst, true);
     ERR_BAIL(aug);
 
     r = find_one_node(s, &ts);
@@ -1345,6 +1688,9 @@ int aug_cp(struct augeas *aug, const char *src, const char *dst) {
     if (r == -1)
         goto error;
 
+    tree_load_lazy_all(aug, ts);
+    tree_load_lazy(aug, td);
+
     /* Don't copy SRC into its own descendent */
     t = td;
     do {
@@ -1356,6 +1702,7 @@ int aug_cp(struct augeas *aug, const char *src, const char *dst) {
     tree_set_value(td, ts->value);
     free_tree(td->children);
     td->children = NULL;
+    tree_children_changed(td);
     tree_copy_rec(ts, td);
     tree_mark_dirty(td);
 
@@ -1379,12 +1726,14 @@ int aug_rename(struct augeas *aug, const char *src, const char *lbl) {
     ERR_THROW(strchr(lbl, '/') != NULL, aug, AUG_ELABEL,
               "Label %s contains a /", lbl);
 
-    s = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), src, true);
+    s = pathx_aug_parse_ctx(aug, src, true);
     ERR_BAIL(aug);
 
     for (ts = pathx_first(s); ts != NULL; ts = pathx_next(s)) {
-        free(ts->label);
+        tree_load_lazy_all(aug, ts);
+        tree_free_str(ts, ts->label);
         ts->label = strdup(lbl);
+        tree_children_changed(ts->parent);
         tree_mark_dirty(ts);
         count ++;
     }
@@ -1412,7 +1761,7 @@ int aug_match(const struct augeas *aug, const char *pathin, char ***matches) {
         pathin = "/*";
     }
 
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), pathin, true);
+    p = pathx_aug_parse_ctx(aug, pathin, true);
     ERR_BAIL(aug);
 
     for (tree = pathx_first(p); tree != NULL; tree = pathx_next(p)) {
@@ -1456,6 +1805,264 @@ int aug_match(const struct augeas *aug, const char *pathin, char ***matches) {
     return -1;
 }
 
+/*
+ * Walking the subtrees matching a path expression for augmatch
+ */
+struct walk {
+    struct augeas *aug;
+    __aug_walk_fn  visit;
+    void          *data;
+    bool           exact;
+    struct tree  **matches;     /* Sorted, so we can bsearch them */
+    size_t         nmatches;
+    struct tree  **ancestors;   /* Sorted ancestors of the matches */
+    size_t         nancestors;
+    char          *prefix;      /* Path of the current node */
+    size_t         prefix_len;
+    size_t         prefix_size;
+    int            count;
+};
+
+static int ptr_cmp(const void *p1, const void *p2) {
+    uintptr_t t1 = (uintptr_t) *(struct tree * const *) p1;
+    uintptr_t t2 = (uintptr_t) *(struct tree * const *) p2;
+    return (t1 > t2) - (t1 < t2);
+}
+
+static bool tree_in(struct tree *tree, struct tree **trees, size_t ntrees) {
+    return bsearch(&tree, trees, ntrees, sizeof(*trees), ptr_cmp) != NULL;
+}
+
+struct sibling {
+    struct tree *tree;
+    size_t       pos;
+};
+
+static int sibling_cmp(const void *p1, const void *p2) {
+    const struct sibling *s1 = p1;
+    const struct sibling *s2 = p2;
+    const char *l1 = s1->tree->label, *l2 = s2->tree->label;
+    int cmp;
+
+    if (l1 == NULL || l2 == NULL)
+        cmp = (l1 != NULL) - (l2 != NULL);
+    else
+        cmp = strcmp(l1, l2);
+    if (cmp == 0)
+        cmp = (s1->pos > s2->pos) - (s1->pos < s2->pos);
+    return cmp;
+}
+
+/* Compute what tree_sibling_index returns for each child of PARENT, in
+ * time O(n log n) in the number N of children rather than O(n^2). The
+ * indices are stored in *INDEX, which the caller must free */
+static int sibling_indices(struct tree *parent, int **index) {
+    struct sibling *sib = NULL;
+    size_t n = 0;
+
+    *index = NULL;
+    list_for_each(c, parent->children)
+        n += 1;
+    if (n == 0)
+        return 0;
+    if (ALLOC_N(sib, n) < 0 || ALLOC_N(*index, n) < 0) {
+        free(sib);
+        return -1;
+    }
+
+    n = 0;
+    list_for_each(c, parent->children) {
+        sib[n].tree = c;
+        sib[n].pos = n;
+        n += 1;
+    }
+    qsort(sib, n, sizeof(*sib), sibling_cmp);
+
+    for (size_t i = 0, j; i < n; i = j) {
+        for (j = i + 1;
+             j < n && streqv(sib[i].tree->label, sib[j].tree->label);
+             j++);
+        if (j - i > 1) {
+            for (size_t k = i; k < j; k++)
+                (*index)[sib[k].pos] = k - i + 1;
+        }
+    }
+    free(sib);
+    return 0;
+}
+
+/* Append the path component for TREE, which has index IND among its
+ * siblings, to W->PREFIX */
+static int walk_push(struct walk *w, struct tree *tree, int ind) {
+    char *escaped = NULL;
+    const char *label = tree->label;
+    size_t len;
+    int r;
+
+    /* Matches are never hidden, but their ancestors can be; name them
+     * like path_expand does */
+    if (label == NULL)
+        label = "(none)";
+
+    r = pathx_escape_name(label, &escaped);
+    if (r < 0)
+        return -1;
+    if (escaped != NULL)
+        label = escaped;
+
+    /* Room for the slash, the label, an index, and the NUL */
+    len = w->prefix_len + strlen(label) + 3 * sizeof(int) + 4;
+    if (len > w->prefix_size) {
+        if (REALLOC_N(w->prefix, len) < 0) {
+            free(escaped);
+            return -1;
+        }
+        w->prefix_size = len;
+    }
+
+    char *p = w->prefix + w->prefix_len;
+    if (w->prefix_len > 0)
+        *p++ = '/';
+    p = stpcpy(p, label);
+    if (ind > 0)
+        p += sprintf(p, "[%d]", ind);
+    w->prefix_len = p - w->prefix;
+    free(escaped);
+    return 0;
+}
+
+/* Visit all the visible nodes below TREE, which is LEVEL levels below the
+ * match that it belongs to */
+static int walk_subtree(struct walk *w, struct tree *tree, int level) {
+    int *ind = NULL;
+    int i = 0;
+
+    if (sibling_indices(tree, &ind) < 0)
+        return -1;
+    list_for_each(c, tree->children) {
+        if (! TREE_HIDDEN(c)) {
+            w->visit(w->data, w->prefix, level, c->label, ind[i], c->value);
+            if (walk_subtree(w, c, level + 1) < 0) {
+                free(ind);
+                return -1;
+            }
+        }
+        i += 1;
+    }
+    free(ind);
+    return 0;
+}
+
+/* Look for matches below TREE, descending only into the ancestors of
+ * matches */
+static int walk_matches(struct walk *w, struct tree *tree) {
+    int *ind = NULL;
+    int i = 0;
+
+    if (sibling_indices(tree, &ind) < 0)
+        return -1;
+    list_for_each(c, tree->children) {
+        bool is_match, is_ancestor;
+        size_t len = w->prefix_len;
+
+        is_match = tree_in(c, w->matches, w->nmatches);
+        is_ancestor = tree_in(c, w->ancestors, w->nancestors);
+        if (is_match || is_ancestor) {
+            if (walk_push(w, c, ind[i]) < 0)
+                goto error;
+            if (is_match) {
+                w->count += 1;
+                w->visit(w->data, w->prefix, 0, c->label, ind[i], c->value);
+                if (! w->exact && walk_subtree(w, c, 1) < 0)
+                    goto error;
+            }
+            if (is_ancestor && walk_matches(w, c) < 0)
+                goto error;
+            w->prefix_len = len;
+            w->prefix[len] = '\0';
+        }
+        i += 1;
+    }
+    free(ind);
+    return 0;
+ error:
+    free(ind);
+    return -1;
+}
+
+int __aug_walk_matches(struct augeas *aug, const char *expr, bool exact,
+                       __aug_walk_fn visit, void *data) {
+    struct pathx *p = NULL;
+    struct tree *ctx, *tree;
+    struct walk w;
+    size_t n;
+    int r, result = -1;
+
+    api_entry(aug);
+
+    MEMZERO(&w, 1);
+    w.aug = aug;
+    w.visit = visit;
+    w.data = data;
+    w.exact = exact;
+
+    ctx = tree_root_ctx(aug);
+    ERR_BAIL(aug);
+    if (ctx == NULL)
+        ctx = aug->origin;
+
+    p = pathx_aug_parse_ctx(aug, expr, true);
+    ERR_BAIL(aug);
+
+    n = 0;
+    for (tree = pathx_first(p); tree != NULL; tree = pathx_next(p))
+        n += 1;
+    ERR_BAIL(aug);
+
+    r = ALLOC_N(w.matches, n);
+    ERR_NOMEM(r < 0, aug);
+    for (tree = pathx_first(p); tree != NULL; tree = pathx_next(p)) {
+        if (! TREE_HIDDEN(tree))
+            w.matches[w.nmatches++] = tree;
+    }
+    qsort(w.matches, w.nmatches, sizeof(*w.matches), ptr_cmp);
+
+    /* Collect the ancestors of all matches below CTX, so that we only
+     * need to descend into subtrees that contain matches */
+    n = 0;
+    for (size_t i=0; i < w.nmatches; i++) {
+        for (tree = w.matches[i]->parent;
+             tree != ctx && tree != tree->parent;
+             tree = tree->parent)
+            n += 1;
+    }
+    r = ALLOC_N(w.ancestors, n);
+    ERR_NOMEM(r < 0, aug);
+    for (size_t i=0; i < w.nmatches; i++) {
+        for (tree = w.matches[i]->parent;
+             tree != ctx && tree != tree->parent;
+             tree = tree->parent)
+            w.ancestors[w.nancestors++] = tree;
+    }
+    qsort(w.ancestors, w.nancestors, sizeof(*w.ancestors), ptr_cmp);
+
+    r = ALLOC_N(w.prefix, 1);
+    ERR_NOMEM(r < 0, aug);
+    w.prefix_size = 1;
+
+    r = walk_matches(&w, ctx);
+    ERR_NOMEM(r < 0, aug);
+
+    result = w.count;
+ error:
+    free(w.matches);
+    free(w.ancestors);
+    free(w.prefix);
+    free_pathx(p);
+    api_exit(aug);
+    return result;
+}
+
 /* XFM1 and XFM2 can both be used to save the same file. That is an error
    only if the two lenses in the two transforms are actually different. */
 static int check_save_dup(struct augeas *aug, const char *path,
@@ -1619,6 +2226,7 @@ int aug_save(struct augeas *aug) {
         tree_clean(aug->origin);
     }
 
+    metrics_to_tree(aug);
     api_exit(aug);
     return ret;
  error:
@@ -1683,6 +2291,7 @@ static int print_tree(FILE *out, struct pathx *p, int pr_hidden) {
         if (TREE_HIDDEN(tree) && ! pr_hidden)
             continue;
 
+        tree_load_lazy_all(aug_of_pathx(p), tree);
         path = path_of_tree(tree);
         if (path == NULL)
             goto error;
@@ -1725,7 +2334,7 @@ int aug_text_store(augeas *aug, const char *lens, const char *node,
     api_entry(aug);
 
     /* Validate PATH is syntactically correct */
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
+    p = pathx_aug_parse_ctx(aug, path, true);
     free_pathx(p);
     ERR_BAIL(aug);
 
@@ -1755,6 +2364,8 @@ int aug_text_retrieve(struct augeas *aug, const char *lens,
 
     tree = tree_find(aug, path);
     ERR_BAIL(aug);
+    if (tree != NULL)
+        tree_load_lazy_all(aug, tree);
 
     r = aug_get(aug, node_in, &src);
     ERR_BAIL(aug);
@@ -1890,6 +2501,7 @@ int aug_load_file(struct augeas *aug, const char *file) {
 
     result = 0;
 error:
+    metrics_to_tree(aug);
     api_exit(aug);
     free(tree_path);
     return result;
@@ -1905,7 +2517,7 @@ int aug_print(const struct augeas *aug, FILE *out, const char *pathin) {
         pathin = "/*";
     }
 
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), pathin, true);
+    p = pathx_aug_parse_ctx(aug, pathin, true);
     ERR_BAIL(aug);
 
     result = print_tree(out, p, 0);
@@ -1948,7 +2560,7 @@ int aug_source(const augeas *aug, const char *path, char **file_path) {
               "aug_source_file: FILE_PATH must not be NULL");
     *file_path = NULL;
 
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), path, true);
+    p = pathx_aug_parse_ctx(aug, path, true);
     ERR_BAIL(aug);
 
     r = pathx_find_one(p, &match);
@@ -1974,7 +2586,10 @@ void aug_close(struct augeas *aug) {
 
     /* There's no point in bothering with api_entry/api_exit here */
     free_tree(aug->origin);
+    transform_free_asts(aug);
     unref(aug->modules, module);
+    free_regexp_table(aug->regexps);
+    free_seq_table(aug->seqs);
     if (aug->error->exn != NULL) {
         aug->error->exn->ref = 0;
         free_value(aug->error->exn);
@@ -1984,11 +2599,75 @@ void aug_close(struct augeas *aug) {
     free(aug->modpathz);
     free_symtab(aug->symtab);
     unref(aug->error->info, info);
+    /* Must come last since anything else might still refer to it */
+    free_frozen(aug->frozen);
     free(aug->error->details);
     free(aug->error);
+#if HAVE_USELOCALE
+    if (aug->sessions > 0)
+        restore_locale(aug);
+    if (aug->c_locale != NULL)
+        freelocale(aug->c_locale);
+#endif
     free(aug);
 }
 
+void aug_set_allocator(void *(*calloc_fn)(size_t nmemb, size_t size),
+                       void *(*realloc_fn)(void *ptr, size_t size)) {
+    mem_set_allocator(calloc_fn, realloc_fn);
+    /* libfa keeps its own allocator when it is a separate shared library */
+    fa_set_allocator(calloc_fn, realloc_fn);
+}
+
+int aug_alloc_stats(const char *subsystem, size_t *count, size_t *bytes) {
+    for (enum mem_subsys s = 0; s < MEM_NSUBSYS; s++) {
+        if (STRNEQ(subsystem, mem_subsys_name(s)))
+            continue;
+        /* libfa keeps its own counters when it is a separate library */
+        if (s == MEM_FA)
+            return fa_alloc_stats(count, bytes);
+        return mem_stats(s, count, bytes);
+    }
+    return -1;
+}
+
+int aug_metrics(struct augeas *aug, struct aug_metrics *metrics,
+                size_t size) {
+    int result = -1;
+
+    if (aug == NULL)
+        return -1;
+
+    api_entry(aug);
+
+    ARG_CHECK(metrics == NULL, aug, "aug_metrics: METRICS must not be NULL");
+    ARG_CHECK(size < sizeof(struct aug_timer)
+              || size % sizeof(struct aug_timer) != 0, aug,
+              "aug_metrics: SIZE %zu is not a number of timers", size);
+
+    /* A caller built against an older struct aug_metrics only gets the
+     * timers it knows about; one built against a newer one gets the
+     * timers it does not know about zeroed */
+    memset(metrics, 0, size);
+    memcpy(metrics, &aug->metrics,
+           size < sizeof(aug->metrics) ? size : sizeof(aug->metrics));
+    result = 0;
+ error:
+    api_exit(aug);
+    return result;
+}
+
+int aug_metrics_reset(struct augeas *aug) {
+    if (aug == NULL)
+        return -1;
+
+    api_entry(aug);
+    MEMZERO(&aug->metrics, 1);
+    metrics_to_tree(aug);
+    api_exit(aug);
+    return 0;
+}
+
 int __aug_load_module_file(struct augeas *aug, const char *filename) {
     api_entry(aug);
     int r = load_module_file(aug, filename, NULL);
@@ -1996,6 +2675,27 @@ int __aug_load_module_file(struct augeas *aug, const char *filename) {
     return r;
 }
 
+int __aug_refresh_modules(struct augeas *aug) {
+    api_entry(aug);
+    int r = interpreter_refresh(aug);
+    api_exit(aug);
+    return r;
+}
+
+int __aug_has_module_file(struct augeas *aug, const char *filename) {
+    api_entry(aug);
+    int r = interpreter_has_file(aug, filename);
+    api_exit(aug);
+    return r;
+}
+
+int __aug_preload_modules(struct augeas *aug, char **files, int nfiles) {
+    api_entry(aug);
+    int r = interpreter_preload(aug, files, nfiles);
+    api_exit(aug);
+    return r;
+}
+
 int tree_equal(const struct tree *t1, const struct tree *t2) {
     while (t1 != NULL && t2 != NULL) {
         if (!streqv(t1->label, t2->label))
@@ -52,7 +52,29 @@ enum aug_flags {
     AUG_ENABLE_SPAN  = (1 << 7),  /* Track the span in the input of nodes */
     AUG_NO_ERR_CLOSE = (1 << 8),  /* Do not close automatically when
                                      encountering error during aug_init */
-    AUG_TRACE_MODULE_LOADING = (1 << 9) /* For use by augparse -t */
+    AUG_TRACE_MODULE_LOADING = (1 << 9), /* For use by augparse -t */
+    AUG_FREEZE_MODULES = (1 << 10), /* Make compiled lenses immutable and
+                                       keep them until AUG_CLOSE. This
+                                       does not make the handle safe to
+                                       use from several threads at once:
+                                       matching a regexp still writes to
+                                       its compiled pattern */
+    AUG_SHARE_TEXT   = (1 << 11), /* Keep the labels and values of each
+                                     loaded file in one buffer instead of
+                                     allocating them one by one */
+    AUG_LAZY_LOAD    = (1 << 12), /* Have aug_load only register the files
+                                     it finds, and parse each of them the
+                                     first time its subtree in /files is
+                                     used. Parse errors for a file only
+                                     show up under /augeas//error once
+                                     that has happened, so matching
+                                     /augeas//error right after aug_load
+                                     misses them; match all nodes under
+                                     /files first to parse every file */
+    AUG_KEEP_PARSE   = (1 << 13), /* Keep the parse of files read with
+                                     recursive lenses so that saving them
+                                     does not parse them again */
+    AUG_TIME_TESTS   = (1 << 14)  /* For use by augparse --timing */
 };
 
 #ifdef __cplusplus
@@ -172,6 +194,19 @@ int aug_label(const augeas *aug, const char *path, const char **label);
  */
 int aug_set(augeas *aug, const char *path, const char *value);
 
+/* Function: aug_set_take
+ *
+ * Like aug_set, but take ownership of VALUE instead of copying it. VALUE
+ * must have been allocated with malloc(3) or a function like strdup(3)
+ * and must not be used by the caller afterwards; Augeas frees it when it
+ * is no longer needed, including when aug_set_take fails.
+ *
+ * Returns:
+ * 0 on success, -1 on error. It is an error if more than one node
+ * matches PATH.
+ */
+int aug_set_take(augeas *aug, const char *path, char *value);
+
 /* Function: aug_setm
  *
  * Set the value of multiple nodes in one operation. Find or create a node
@@ -475,6 +510,35 @@ int aug_srun(augeas *aug, FILE *out, const char *text);
  */
 void aug_close(augeas *aug);
 
+/* Function: aug_session_begin
+ *
+ * Start a session for a series of calls on AUG, typically a tight loop
+ * of aug_get, aug_label or aug_ns_value. Every API call normally switches
+ * the calling thread to the C locale on entry and back to the user's
+ * locale on exit; during a session, the thread stays in the C locale
+ * until the matching aug_session_end. Sessions can be nested, and only
+ * the outermost aug_session_end switches back.
+ *
+ * The thread that calls aug_session_begin must make all calls on AUG
+ * until the session ends, and must not depend on its own locale in the
+ * meantime. Calling aug_close ends any session that is still open.
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int aug_session_begin(augeas *aug);
+
+/* Function: aug_session_end
+ *
+ * End the session started by the matching aug_session_begin and, for the
+ * outermost session, switch the calling thread back to the locale it was
+ * using when the session began.
+ *
+ * Returns:
+ * 0 on success, -1 if AUG is not in a session
+ */
+int aug_session_end(augeas *aug);
+
 // We can't put //* into the examples in these comments since the C
 // preprocessor complains about that. So we'll resort to the equivalent but
 // more wordy notation /descendant::*
@@ -568,6 +632,111 @@ int aug_ns_count(const augeas *aug, const char *var);
  */
 int aug_ns_path(const augeas *aug, const char *var, int i, char **path);
 
+/*
+ * Memory
+ */
+
+/* Function: aug_set_allocator
+ *
+ * Use CALLOC_FN and REALLOC_FN, which must behave like calloc(3) and
+ * realloc(3), for the allocations Augeas makes for its own data
+ * structures, for example to place them in a separate jemalloc arena or
+ * to make allocations fail on purpose. Passing NULL for either restores
+ * the C library's function.
+ *
+ * Augeas releases memory with free(3), and strings are still allocated
+ * with malloc(3), so the memory returned must be acceptable to
+ * free(3). The allocator is shared by all handles in the process and
+ * should be set before the first call to aug_init.
+ */
+void aug_set_allocator(void *(*calloc_fn)(size_t nmemb, size_t size),
+                       void *(*realloc_fn)(void *ptr, size_t size));
+
+/* Function: aug_alloc_stats
+ *
+ * Report how many allocations Augeas has made for SUBSYSTEM, and how many
+ * bytes they asked for. SUBSYSTEM is one of "tree", "pathx", "get",
+ * "put", "fa", "jmt", "interpreter" or "other". The counts cover all
+ * handles in the process and never decrease; a reallocation counts as a
+ * new allocation of the new size. The counters are only kept when Augeas
+ * was configured with --enable-alloc-stats, which is the default.
+ *
+ * Returns:
+ * 0 on success, -1 if SUBSYSTEM is not known or Augeas does not keep
+ * allocation counters
+ */
+int aug_alloc_stats(const char *subsystem, size_t *count, size_t *bytes);
+
+/*
+ * Metrics
+ */
+
+/* Struct: aug_timer
+ *
+ * How often a phase of processing ran, and how much time it took in
+ * total, in nanoseconds of a monotonic clock
+ */
+struct aug_timer {
+    unsigned long      count;
+    unsigned long long nsec;
+};
+
+/* Struct: aug_metrics
+ *
+ * Timers for the major phases of processing in one handle. Phases can
+ * nest; for example, a file that AUG_LAZY_LOAD left unloaded is read and
+ * parsed while a path expression that uses it is evaluated.
+ *
+ * Later versions of Augeas only add timers at the end of this struct.
+ *
+ * aug_init, aug_load, aug_load_file, aug_save and aug_metrics_reset copy
+ * the timers into the tree as /augeas/metrics/PHASE/count and
+ * /augeas/metrics/PHASE/nsec. In between, these nodes do not change, even
+ * though the timers keep running. Changes made to nodes under
+ * /augeas/metrics are overwritten by the next snapshot, and the snapshot
+ * itself does not mark the tree as changed.
+ */
+struct aug_metrics {
+    struct aug_timer module_load;  /* Loading a module from a .aug file,
+                                      including the modules it uses */
+    struct aug_timer glob;         /* Expanding incl and excl of a
+                                      transform into file names */
+    struct aug_timer read;         /* Reading a file for load or save */
+    struct aug_timer get;          /* lns_get, turning text into a tree */
+    struct aug_timer parse;        /* lns_parse, parsing the old text of
+                                      a file before writing it */
+    struct aug_timer put;          /* lns_put, turning a tree into text,
+                                      not counting lns_parse */
+    struct aug_timer write;        /* Writing a temporary file on save */
+    struct aug_timer rename;       /* Moving a saved file into place,
+                                      including any backup */
+    struct aug_timer pathx_parse;  /* Parsing a path expression */
+    struct aug_timer pathx_eval;   /* Evaluating a path expression */
+};
+
+/* Function: aug_metrics
+ *
+ * Copy the timers of AUG, accumulated since aug_init or the last
+ * aug_metrics_reset, into *METRICS. SIZE must be sizeof(struct
+ * aug_metrics) as the caller sees it; if the caller knows fewer timers
+ * than this version of Augeas, only those are copied, and if it knows
+ * more, the ones this version does not have are set to zero.
+ *
+ * Returns:
+ * 0 on success, -1 if AUG or METRICS is NULL or SIZE is not a multiple
+ * of sizeof(struct aug_timer)
+ */
+int aug_metrics(augeas *aug, struct aug_metrics *metrics, size_t size);
+
+/* Function: aug_metrics_reset
+ *
+ * Set all timers of AUG back to zero.
+ *
+ * Returns:
+ * 0 on success, -1 if AUG is NULL
+ */
+int aug_metrics_reset(augeas *aug);
+
 /*
  * Error reporting
  */
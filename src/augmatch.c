@@ -26,6 +26,7 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include <libgen.h>
+#include <sys/wait.h>
 
 #include "memory.h"
 #include "augeas.h"
@@ -39,6 +40,11 @@ const char *progname;
 bool print_all = false;
 bool print_only_values = false;
 bool print_exact = false;
+bool print_lens = false;
+bool quiet = false;
+/* The name of the file being printed when we print several files, so
+ * that we can start each line with it; NULL when there is only one */
+const char *print_file = NULL;
 
 static void freep(void *p) {
     free(*(void **)p);
@@ -50,9 +56,10 @@ static void aug_closep(struct augeas **p) {
 
 __attribute__((noreturn))
 static void usage(void) {
-    fprintf(stderr, "Usage: %s [OPTIONS] FILE\n", progname);
+    fprintf(stderr, "Usage: %s [OPTIONS] FILE...\n", progname);
     fprintf(stderr,
-"Print the contents of a file as parsed by augeas.\n\n"
+"Print the contents of files as parsed by augeas. When several files are\n"
+"given, each line of output starts with the name of the file it is for.\n\n"
 "Options:\n\n"
 "  -l, --lens LENS    use LENS to transform the file\n"
 "  -L, --print-lens   print the lens that will be used for a file an exit\n"
@@ -66,14 +73,18 @@ static void usage(void) {
 "  -r, --root ROOT    use ROOT as the root of the filesystem\n"
 "  -I, --include DIR  search DIR for modules; can be given mutiple times\n"
 "  -S, --nostdinc     do not search the builtin default directories\n"
-"                     for modules\n\n"
+"                     for modules\n"
+"  -j, --jobs N       parse up to N files in parallel; 0 means one for\n"
+"                     each processor\n\n"
 "Examples:\n\n"
 "  Print how augeas sees /etc/exports:\n"
 "    augmatch /etc/exports\n\n"
 "  Show only the entry for a specific mount:\n"
 "    augmatch -m 'dir[\"/home\"]' /etc/exports\n\n"
 "  Show all the clients to which we are exporting /home:\n"
-"    augmatch -eom 'dir[\"/home\"]/client' /etc/exports\n\n");
+"    augmatch -eom 'dir[\"/home\"]/client' /etc/exports\n\n"
+"  Find the files that mount something on /home:\n"
+"    augmatch -j 0 -qm 'spec[file = \"/home\"]' /etc/fstab*\n\n");
     exit(EXIT_SUCCESS);
 }
 
@@ -163,14 +174,13 @@ static void check_load_error(struct augeas *aug, const char *file) {
 }
 
 /* We keep track of where we are in the tree when we are printing it by
- * assigning to augeas variables and using one struct node for each level
- * in the tree. To keep things simple, we just preallocate a lot of them
- * (up to max_nodes many). If we ever have a tree deeper than this, we are
- * in trouble and will simply abort the program. */
+ * using one struct node for each level in the tree. To keep things
+ * simple, we just preallocate a lot of them (up to max_nodes many). If we
+ * ever have a tree deeper than this, we are in trouble and will simply
+ * abort the program. */
 static const size_t max_nodes = 256;
 
 struct node {
-    char *var;         /* The variable where we store the nodes for this level */
     const char *label; /* The label, index, and value of the current node */
     int   index;       /* at the level that this struct node is for */
     const char *value;
@@ -184,6 +194,9 @@ static void print_one(int level, const char *prefix, struct node *nodes) {
     if (nodes[level].value == NULL && ! print_all)
         return;
 
+    if (print_file != NULL)
+        printf("%s:", print_file);
+
     if (print_only_values && nodes[level].value != NULL) {
         printf("%s\n", nodes[level].value);
         return;
@@ -214,68 +227,37 @@ static void print_one(int level, const char *prefix, struct node *nodes) {
     }
 }
 
-/* Recursively print the tree starting at NODES[LEVEL] */
-static void print_tree(struct augeas *aug, int level,
-                       const char *prefix, struct node *nodes) {
-    die(level + 1 >= max_nodes,
+/* Called by __aug_walk_matches for every node we need to print */
+static void print_node(void *data, const char *prefix, int level,
+                       const char *label, int index, const char *value) {
+    struct node *nodes = data;
+
+    die(level >= max_nodes,
         "tree has more than %d levels, which is more than we can handle\n",
         max_nodes);
 
-    struct node *cur = nodes + level;
-    struct node *next = cur + 1;
-
-    int count = aug_ns_count(aug, cur->var);
-    for (int i=0; i < count; i++) {
-        cleanup(freep) char *pattern = NULL;
-
-        aug_ns_label(aug, cur->var, i, &(cur->label), &(cur->index));
-        aug_ns_value(aug, cur->var, i, &(cur->value));
-        print_one(level, prefix, nodes);
-
-        if (! print_exact) {
-            pattern = format("$%s[%d]/*", cur->var, i+1);
-            aug_defvar(aug, next->var, pattern);
-            check_error(aug);
-            print_tree(aug, level+1, prefix, nodes);
-        }
-    }
+    nodes[level].label = label;
+    nodes[level].index = index;
+    nodes[level].value = value;
+    print_one(level, prefix, nodes);
 }
 
-/* Print the tree for file PATH (which must already start with /files), but
- * only the nodes matching MATCH.
+/* Print the tree for the file in the context, but only the nodes matching
+ * MATCH and, unless we print only exact matches, the nodes below them.
+ * The tree is traversed only once, no matter how many matches there are.
  *
  * Return EXIT_SUCCESS if there was at least one match, and EXIT_FAILURE
  * if there was none.
  */
-static int print(struct augeas *aug, const char *path, const char *match) {
-    static const char *const match_var = "match";
-
+static int print(struct augeas *aug, const char *match) {
     struct node *nodes = NULL;
+    int count;
 
     nodes = calloc(max_nodes, sizeof(struct node));
     oom_when(nodes == NULL);
 
-    for (int i=0; i < max_nodes; i++) {
-        nodes[i].var = format("var%d", i);
-    }
-
-    /* Set $match to the nodes matching the user's match expression */
-    aug_defvar(aug, match_var, match);
+    count = __aug_walk_matches(aug, match, print_exact, print_node, nodes);
     check_error(aug);
-
-    /* Go through the matches in MATCH_VAR one by one. We need to do it
-     * this way, since the prefix we need to print for each entry in
-     * MATCH_VAR is different for each entry. */
-    int count = aug_ns_count(aug, match_var);
-    for (int i=0; i < count; i++) {
-        cleanup(freep) char *prefix = NULL;
-        aug_ns_path(aug, match_var, i, &prefix);
-        aug_defvar(aug, nodes[0].var, prefix);
-        print_tree(aug, 0, prefix + strlen(path) + 1, nodes);
-    }
-    for (int i=0; i < max_nodes; i++) {
-        free(nodes[i].var);
-    }
     free(nodes);
 
     return (count == 0) ? EXIT_FAILURE : EXIT_SUCCESS;
@@ -300,6 +282,180 @@ static char *guess_lens_name(const char *file) {
     return NULL;
 }
 
+/* Load FILE with LENS, or the lens augeas picks if LENS is NULL, and
+ * print what the user asked for.
+ *
+ * Return EXIT_SUCCESS if there was at least one match, and EXIT_FAILURE
+ * if there was none. Errors make us exit with EXIT_TROUBLE right away.
+ */
+static int process_file(struct augeas *aug, const char *file,
+                        const char *lens, const char *match) {
+    int result;
+
+    if (lens == NULL) {
+        aug_load_file(aug, file);
+    } else {
+        aug_transform(aug, lens, file, false);
+        aug_load(aug);
+    }
+    check_error(aug);
+
+    /* The user just wants the lens name */
+    if (print_lens) {
+        char *info = format("/augeas/files%s", file);
+        const char *lens_name;
+        aug_defvar(aug, "info", info);
+        free(info);
+        die(aug_ns_count(aug, "info") == 0,
+            "file %s does not exist\n", file);
+        aug_get(aug, "$info/lens", &lens_name);
+        /* We are being extra careful here - the check_error above would
+           have already aborted the program if we could not determine a
+           lens; dieing here indicates some sort of bug */
+        die(lens_name == NULL, "could not find lens for %s\n",
+            file);
+        if (lens_name[0] == '@')
+            lens_name += 1;
+        if (print_file != NULL)
+            printf("%s:", print_file);
+        printf("%s\n", lens_name);
+        return EXIT_SUCCESS;
+    }
+
+    check_load_error(aug, file);
+
+    char *path = format("/files%s", file);
+    aug_set(aug, "/augeas/context", path);
+    free(path);
+
+    if (quiet) {
+        int n = aug_match(aug, match, NULL);
+        check_error(aug);
+        result = (n == 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+    } else {
+        result = print(aug, match);
+    }
+    return result;
+}
+
+/* The lens to use for FILE: the one the user asked for, or one we guess
+ * from its name. NULL means augeas should pick one */
+static char *file_lens(const char *lens, const char *file) {
+    if (lens != NULL) {
+        char *result = strdup(lens);
+        oom_when(result == NULL);
+        return result;
+    }
+    return guess_lens_name(file);
+}
+
+/* A file processed by a child process when we are looking at several
+ * files. The child writes what it prints to OUT, which we copy to our
+ * standard output once all the files before it have been done, so that
+ * output appears in the order in which files were given */
+struct job {
+    const char *file;
+    pid_t       pid;
+    FILE       *out;
+    int         status;
+    bool        done;
+};
+
+static void start_job(struct augeas *aug, struct job *job,
+                      const char *lens, const char *match) {
+    job->out = tmpfile();
+    die(job->out == NULL, "could not create temporary file: %s\n",
+        strerror(errno));
+
+    fflush(stdout);
+    fflush(stderr);
+    job->pid = fork();
+    die(job->pid < 0, "could not fork: %s\n", strerror(errno));
+    if (job->pid == 0) {
+        char *file_lns = file_lens(lens, job->file);
+        int status;
+
+        die(dup2(fileno(job->out), STDOUT_FILENO) < 0,
+            "could not redirect output: %s\n", strerror(errno));
+        print_file = job->file;
+        status = process_file(aug, job->file, file_lns, match);
+        fflush(stdout);
+        /* Skip aug_close; the process is about to go away anyway */
+        _exit(status);
+    }
+}
+
+static void finish_job(struct job *job) {
+    char buf[BUFSIZ];
+    size_t n;
+
+    rewind(job->out);
+    while ((n = fread(buf, 1, sizeof(buf), job->out)) > 0)
+        fwrite(buf, 1, n, stdout);
+    fclose(job->out);
+    job->out = NULL;
+}
+
+/* Process the NFILES files in FILES, each in its own child process, and
+ * with up to NJOBS of them running at the same time. The children are
+ * forked after AUG has loaded its modules, and therefore do not need to
+ * load them again.
+ *
+ * Return EXIT_TROUBLE if there was an error with any file, otherwise
+ * EXIT_SUCCESS if any file had a match, and EXIT_FAILURE if none did.
+ */
+static int process_files(struct augeas *aug, char **files, int nfiles,
+                         int njobs, const char *lens, const char *match) {
+    struct job *jobs = NULL;
+    int next = 0, running = 0, printed = 0;
+    bool matched = false, trouble = false;
+
+    jobs = calloc(nfiles, sizeof(*jobs));
+    oom_when(jobs == NULL);
+    for (int i=0; i < nfiles; i++)
+        jobs[i].file = files[i];
+
+    while (printed < nfiles) {
+        int status;
+        pid_t pid;
+
+        while (running < njobs && next < nfiles) {
+            start_job(aug, jobs + next, lens, match);
+            next += 1;
+            running += 1;
+        }
+
+        pid = waitpid(-1, &status, 0);
+        if (pid < 0 && errno == EINTR)
+            continue;
+        die(pid < 0, "waiting for child failed: %s\n", strerror(errno));
+
+        for (int i=printed; i < next; i++) {
+            if (jobs[i].pid == pid) {
+                jobs[i].status = WIFEXITED(status) ?
+                    WEXITSTATUS(status) : EXIT_TROUBLE;
+                jobs[i].done = true;
+                running -= 1;
+                break;
+            }
+        }
+
+        while (printed < nfiles && jobs[printed].done) {
+            finish_job(jobs + printed);
+            if (jobs[printed].status == EXIT_SUCCESS)
+                matched = true;
+            else if (jobs[printed].status != EXIT_FAILURE)
+                trouble = true;
+            printed += 1;
+        }
+    }
+    free(jobs);
+
+    if (trouble)
+        return EXIT_TROUBLE;
+    return matched ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, char **argv) {
     int opt;
     cleanup(aug_closep) struct augeas *aug;
@@ -310,8 +466,8 @@ int main(int argc, char **argv) {
     cleanup(freep) char *matches = NULL;
     size_t matches_len = 0;
     const char *match = "*";
-    bool print_lens = false;
-    bool quiet = false;
+    int njobs = 1, nfiles;
+    char *end;
     int result = EXIT_SUCCESS;
 
     struct option options[] = {
@@ -327,13 +483,14 @@ int main(int argc, char **argv) {
         { "print-lens", 0, 0, 'L' },
         { "exact",      0, 0, 'e' },
         { "quiet",      0, 0, 'q' },
+        { "jobs",       1, 0, 'j' },
         { 0, 0, 0, 0}
     };
     unsigned int flags = AUG_NO_LOAD|AUG_NO_ERR_CLOSE;
     progname = basename(argv[0]);
 
     setlocale(LC_ALL, "");
-    while ((opt = getopt_long(argc, argv, "ahI:l:m:oSr:eLq", options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "ahI:l:m:oSr:eLqj:", options, NULL)) != -1) {
         switch(opt) {
         case 'I':
             argz_add(&loadpath, &loadpath_len, optarg);
@@ -373,6 +530,15 @@ int main(int argc, char **argv) {
         case 'q':
             quiet = true;
             break;
+        case 'j':
+            njobs = strtol(optarg, &end, 10);
+            die(*optarg == '\0' || *end != '\0' || njobs < 0,
+                "invalid number of jobs %s\n", optarg);
+            if (njobs == 0)
+                njobs = sysconf(_SC_NPROCESSORS_ONLN);
+            if (njobs < 1)
+                njobs = 1;
+            break;
         default:
             fprintf(stderr, "Try '%s --help' for more information.\n",
                     progname);
@@ -388,68 +554,34 @@ int main(int argc, char **argv) {
         exit(EXIT_TROUBLE);
     }
 
-    const char *file = argv[optind];
+    nfiles = argc - optind;
 
     argz_stringify(loadpath, loadpath_len, ':');
 
-    if (lens == NULL) {
-        lens = guess_lens_name(file);
-    }
-
-    if (lens != NULL) {
-        /* We know which lens we want, we do not need to load all of them */
-        flags |= AUG_NO_MODL_AUTOLOAD;
+    /* If we know which lens we want, we do not need to load all of
+     * them. With several files, we load all modules once before forking
+     * the processes that parse them, so that they all share them */
+    if (nfiles == 1) {
+        cleanup(freep) char *file_lns = file_lens(lens, argv[optind]);
+        if (file_lns != NULL)
+            flags |= AUG_NO_MODL_AUTOLOAD;
     }
 
     aug = aug_init(root, loadpath, flags|AUG_NO_ERR_CLOSE);
     check_error(aug);
 
-    if (lens == NULL) {
-        aug_load_file(aug, file);
-    } else {
-        aug_transform(aug, lens, file, false);
-        aug_load(aug);
-    }
-    check_error(aug);
-
-    /* The user just wants the lens name */
-    if (print_lens) {
-        char *info = format("/augeas/files%s", file);
-        const char *lens_name;
-        aug_defvar(aug, "info", info);
-        die(aug_ns_count(aug, "info") == 0,
-            "file %s does not exist\n", file);
-        aug_get(aug, "$info/lens", &lens_name);
-        /* We are being extra careful here - the check_error above would
-           have already aborted the program if we could not determine a
-           lens; dieing here indicates some sort of bug */
-        die(lens_name == NULL, "could not find lens for %s\n",
-            file);
-        if (lens_name[0] == '@')
-            lens_name += 1;
-        printf("%s\n", lens_name);
-        exit(EXIT_SUCCESS);
-    }
-
-    check_load_error(aug, file);
-
-    char *path = format("/files%s", file);
-    aug_set(aug, "/augeas/context", path);
-
-
     if (matches_len > 0) {
         argz_stringify(matches, matches_len, '|');
         match = matches;
     }
 
-    if (quiet) {
-        int n = aug_match(aug, match, NULL);
-        check_error(aug);
-        result = (n == 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+    if (nfiles == 1) {
+        cleanup(freep) char *file_lns = file_lens(lens, argv[optind]);
+        result = process_file(aug, argv[optind], file_lns, match);
     } else {
-        result = print(aug, path, match);
+        result = process_files(aug, argv + optind, nfiles, njobs,
+                               lens, match);
     }
-    free(path);
 
     return result;
 }
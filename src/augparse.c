@@ -23,22 +23,69 @@
 #include <config.h>
 #include <argz.h>
 #include <getopt.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "list.h"
+#include "memory.h"
 #include "syntax.h"
 #include "augeas.h"
 #include <locale.h>
 
 const char *progname;
 bool print_version = false;
+bool timing = false;
+bool watch = false;
+char *loadpath = NULL;
+unsigned int flags = AUG_TYPE_CHECK|AUG_NO_MODL_AUTOLOAD;
+
+/* The result of running the tests in one module file. When tests are run
+ * in worker processes, everything they print is collected in OUTPUT */
+struct result {
+    const char *file;
+    bool        done;
+    int         status;
+    long        elapsed;     /* in ms */
+    char       *output;
+    size_t      output_len;
+};
+
+/* What a worker sends back to the parent after running one file; it is
+ * followed by OUTPUT_LEN bytes of output */
+struct result_msg {
+    int    job;
+    int    status;
+    long   elapsed;
+    size_t output_len;
+};
+
+/* A worker process; JOB is the index of the file it is working on, or
+ * -1 if it is idle */
+struct worker {
+    pid_t pid;
+    int   cmd_fd;
+    int   res_fd;
+    int   job;
+};
 
 __attribute__((noreturn))
 static void usage(void) {
-    fprintf(stderr, "Usage: %s [OPTIONS] MODULE\n", progname);
+    fprintf(stderr, "Usage: %s [OPTIONS] MODULE...\n", progname);
     fprintf(stderr, "Evaluate MODULE. Generally, MODULE should contain unit tests.\n");
     fprintf(stderr, "\nOptions:\n\n");
     fprintf(stderr, "  -I, --include DIR  search DIR for modules; can be given multiple times\n");
     fprintf(stderr, "  -t, --trace        trace module loading\n");
+    fprintf(stderr, "  -j, --jobs N       run the tests in N modules in parallel; 0 means\n"
+                    "                     one job per CPU\n");
+    fprintf(stderr, "  --timing           report how long each module and each test took\n");
+    fprintf(stderr, "  --watch            keep running, and rerun MODULE whenever it or a module\n"
+                    "                     it uses changes\n");
     fprintf(stderr, "  --nostdinc         do not search the builtin default directories for modules\n");
     fprintf(stderr, "  --notypecheck      do not typecheck lenses\n");
     fprintf(stderr, "  --version          print version information and exit\n");
@@ -66,31 +113,399 @@ static void print_version_info(struct augeas *aug) {
     fprintf(stderr, "Something went terribly wrong internally - please file a bug\n");
 }
 
+static struct augeas *init_aug(void) {
+    struct augeas *aug = aug_init(NULL, loadpath, flags);
+    if (aug == NULL)
+        fprintf(stderr, "Memory exhausted\n");
+    return aug;
+}
+
+static long elapsed_ms(struct timeval *start, struct timeval *stop) {
+    return (stop->tv_sec - start->tv_sec)*1000
+        + (stop->tv_usec - start->tv_usec)/1000;
+}
+
+/* Load FILE and run its tests. Modules that FILE depends on are kept in
+ * AUG, so that running several files with the same AUG only compiles
+ * each library module once. Return 0 if all tests passed, -1 otherwise */
+static int run_module_file(struct augeas *aug, const char *file,
+                           long *elapsed) {
+    struct timeval start, stop;
+    int r;
+
+    gettimeofday(&start, NULL);
+    r = __aug_load_module_file(aug, file);
+    gettimeofday(&stop, NULL);
+    *elapsed = elapsed_ms(&start, &stop);
+
+    if (r == -1) {
+        fprintf(stderr, "%s\n", aug_error_message(aug));
+        const char *s = aug_error_details(aug);
+        if (s != NULL) {
+            fprintf(stderr, "%s\n", s);
+        }
+    }
+    return r;
+}
+
+/* Return a value that changes whenever FILE is modified */
+static unsigned long file_stamp(const char *file) {
+    struct stat st;
+    if (stat(file, &st) < 0)
+        return 0;
+    return (unsigned long) st.st_mtime * 1000003UL + st.st_size;
+}
+
+static int count_failed(struct result *results, int nfiles) {
+    int failed = 0;
+    for (int i=0; i < nfiles; i++) {
+        if (! results[i].done || results[i].status != 0)
+            failed += 1;
+    }
+    return failed;
+}
+
+static void print_result(struct result *res) {
+    if (res->output_len > 0) {
+        fwrite(res->output, 1, res->output_len, stdout);
+    }
+    if (timing) {
+        printf("%-50s %s (%ld ms)\n", res->file,
+               res->status == 0 ? "PASS" : "FAIL", res->elapsed);
+    }
+    fflush(stdout);
+}
+
+/* Rerun the tests in FILES whenever a module they use, or the files
+ * themselves change. Only the modules that changed, and the modules that
+ * use them, get recompiled; everything else stays loaded in AUG.
+ * This never returns */
+__attribute__((noreturn))
+static void watch_files(struct augeas *aug, struct result *results,
+                        int nfiles) {
+    unsigned long *stamps;
+
+    if (ALLOC_N(stamps, nfiles) < 0) {
+        fprintf(stderr, "Memory exhausted\n");
+        exit(2);
+    }
+    for (int i=0; i < nfiles; i++)
+        stamps[i] = file_stamp(results[i].file);
+
+    fprintf(stderr, "Watching for changes; press Ctrl-C to stop\n");
+    for (;;) {
+        int dropped, rerun = 0;
+
+        usleep(500 * 1000);
+        dropped = __aug_refresh_modules(aug);
+        if (dropped < 0) {
+            fprintf(stderr, "%s\n", aug_error_message(aug));
+            exit(2);
+        }
+        for (int i=0; i < nfiles; i++) {
+            unsigned long stamp = file_stamp(results[i].file);
+            bool changed = (stamp != stamps[i]);
+
+            stamps[i] = stamp;
+            if (__aug_has_module_file(aug, results[i].file))
+                continue;
+            if (dropped == 0 && !changed)
+                continue;
+            results[i].status = run_module_file(aug, results[i].file,
+                                                &results[i].elapsed);
+            print_result(results + i);
+            rerun += 1;
+        }
+        if (rerun > 0) {
+            int failed = count_failed(results, nfiles);
+            if (failed > 0)
+                fprintf(stderr, "%d of %d modules failed\n", failed, nfiles);
+            else
+                fprintf(stderr, "All %d modules passed\n", nfiles);
+        }
+    }
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* The main loop of a worker process: read the index of the next file from
+ * CMD_FD, run it with AUG, the worker's copy of the parent's handle, and
+ * send the result back over RES_FD. Everything the
+ * tests print is captured in a temporary file and sent back along with
+ * the result, so that the parent can print it without interleaving it
+ * with the output of other workers */
+__attribute__((noreturn))
+static void worker_main(struct augeas *aug, char **files, int cmd_fd,
+                        int res_fd) {
+    struct result_msg msg;
+    char *output = NULL;
+    FILE *capture;
+    int capture_fd, job;
+
+    capture = tmpfile();
+    if (capture == NULL)
+        _exit(EXIT_FAILURE);
+    capture_fd = fileno(capture);
+    if (dup2(capture_fd, STDOUT_FILENO) < 0
+        || dup2(capture_fd, STDERR_FILENO) < 0)
+        _exit(EXIT_FAILURE);
+
+    while (read_all(cmd_fd, &job, sizeof(job)) == 0 && job >= 0) {
+        off_t len;
+
+        if (ftruncate(capture_fd, 0) < 0
+            || lseek(capture_fd, 0, SEEK_SET) < 0)
+            _exit(EXIT_FAILURE);
+
+        MEMZERO(&msg, 1);
+        msg.job = job;
+        msg.status = run_module_file(aug, files[job], &msg.elapsed);
+        fflush(stdout);
+        fflush(stderr);
+
+        len = lseek(capture_fd, 0, SEEK_END);
+        if (len < 0 || REALLOC_N(output, len + 1) < 0)
+            _exit(EXIT_FAILURE);
+        if (len > 0 && pread(capture_fd, output, len, 0) != len)
+            _exit(EXIT_FAILURE);
+        msg.output_len = len;
+
+        if (write_all(res_fd, &msg, sizeof(msg)) < 0
+            || write_all(res_fd, output, msg.output_len) < 0)
+            _exit(EXIT_FAILURE);
+    }
+    /* Skip aug_close; the process is about to go away anyway */
+    _exit(EXIT_SUCCESS);
+}
+
+static int start_worker(struct worker *w, struct augeas *aug, char **files) {
+    int cmd[2], res[2];
+
+    if (pipe(cmd) < 0)
+        return -1;
+    if (pipe(res) < 0) {
+        close(cmd[0]);
+        close(cmd[1]);
+        return -1;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    w->pid = fork();
+    if (w->pid < 0) {
+        close(cmd[0]);
+        close(cmd[1]);
+        close(res[0]);
+        close(res[1]);
+        return -1;
+    }
+    if (w->pid == 0) {
+        close(cmd[1]);
+        close(res[0]);
+        worker_main(aug, files, cmd[0], res[1]);
+    }
+    close(cmd[0]);
+    close(res[1]);
+    w->cmd_fd = cmd[1];
+    w->res_fd = res[0];
+    w->job = -1;
+    return 0;
+}
+
+static void stop_worker(struct worker *w) {
+    int status;
+
+    if (w->pid <= 0)
+        return;
+    close(w->cmd_fd);
+    close(w->res_fd);
+    waitpid(w->pid, &status, 0);
+    w->pid = 0;
+    w->job = -1;
+}
+
+/* Mark RES as failed without a result from a worker, explaining why with
+ * REASON */
+static void fail_result(struct result *res, const char *reason) {
+    FREE(res->output);
+    if (asprintf(&res->output, "%s: %s\n", res->file, reason) < 0)
+        res->output = NULL;
+    res->output_len = res->output ? strlen(res->output) : 0;
+    res->status = -1;
+    res->done = true;
+}
+
+/* Hand the next unstarted file to worker W, or tell it to quit if all
+ * files have been handed out already. If the worker can not be told, the
+ * file is left for another worker */
+static int assign_job(struct worker *w, int *next, int nfiles) {
+    int job = -1;
+
+    if (*next < nfiles)
+        job = (*next)++;
+    if (write_all(w->cmd_fd, &job, sizeof(job)) < 0) {
+        if (job >= 0)
+            *next -= 1;
+        w->job = -1;
+        return -1;
+    }
+    w->job = job;
+    return 0;
+}
+
+/* Run the files in RESULTS in NJOBS worker processes. The workers are
+ * forked from the process that built AUG, so that the modules preloaded
+ * into it are shared with all of them. Results are printed in the order
+ * in which the files were given, as soon as all preceding files have
+ * finished */
+static void run_parallel(struct augeas *aug, struct result *results,
+                         char **files, int nfiles, int njobs) {
+    struct worker *workers = NULL;
+    struct pollfd *fds = NULL;
+    int next = 0, printed = 0, running = 0;
+
+    if (ALLOC_N(workers, njobs) < 0 || ALLOC_N(fds, njobs) < 0) {
+        fprintf(stderr, "Memory exhausted\n");
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    for (int i=0; i < njobs; i++) {
+        if (start_worker(workers + i, aug, files) < 0) {
+            fprintf(stderr, "Failed to start worker: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (assign_job(workers + i, &next, nfiles) < 0)
+            stop_worker(workers + i);
+        else if (workers[i].job >= 0)
+            running += 1;
+    }
+
+    while (running > 0) {
+        for (int i=0; i < njobs; i++) {
+            fds[i].fd = workers[i].job >= 0 ? workers[i].res_fd : -1;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, njobs, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        for (int i=0; i < njobs; i++) {
+            struct worker *w = workers + i;
+            struct result_msg msg;
+            struct result *res;
+
+            if (w->job < 0 || fds[i].revents == 0)
+                continue;
+
+            res = results + w->job;
+            running -= 1;
+            if (read_all(w->res_fd, &msg, sizeof(msg)) < 0
+                || msg.job != w->job
+                || ALLOC_N(res->output, msg.output_len + 1) < 0
+                || read_all(w->res_fd, res->output, msg.output_len) < 0) {
+                /* The worker died, most likely because a test crashed it */
+                fail_result(res, "worker running the tests died");
+                stop_worker(w);
+                if (next < nfiles && start_worker(w, aug, files) < 0) {
+                    fprintf(stderr, "Failed to start worker: %s\n",
+                            strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+            } else {
+                res->status = msg.status;
+                res->elapsed = msg.elapsed;
+                res->output_len = msg.output_len;
+                res->done = true;
+            }
+            if (w->pid > 0) {
+                if (assign_job(w, &next, nfiles) < 0)
+                    stop_worker(w);
+                else if (w->job >= 0)
+                    running += 1;
+            }
+
+            while (printed < nfiles && results[printed].done) {
+                print_result(results + printed);
+                FREE(results[printed].output);
+                printed += 1;
+            }
+        }
+    }
+
+    /* If all workers died, some files were never run */
+    for (; printed < nfiles; printed++) {
+        if (! results[printed].done)
+            fail_result(results + printed, "no worker left to run the tests");
+        print_result(results + printed);
+        FREE(results[printed].output);
+    }
+
+    for (int i=0; i < njobs; i++)
+        stop_worker(workers + i);
+    free(workers);
+    free(fds);
+}
+
 int main(int argc, char **argv) {
     int opt;
     struct augeas *aug;
-    char *loadpath = NULL;
     size_t loadpathlen = 0;
     enum {
         VAL_NO_STDINC = CHAR_MAX + 1,
         VAL_NO_TYPECHECK = VAL_NO_STDINC + 1,
-        VAL_VERSION = VAL_NO_TYPECHECK + 1
+        VAL_VERSION = VAL_NO_TYPECHECK + 1,
+        VAL_TIMING = VAL_VERSION + 1,
+        VAL_WATCH = VAL_TIMING + 1
     };
     struct option options[] = {
         { "help",      0, 0, 'h' },
         { "include",   1, 0, 'I' },
         { "trace",     0, 0, 't' },
+        { "jobs",      1, 0, 'j' },
         { "nostdinc",  0, 0, VAL_NO_STDINC },
         { "notypecheck",  0, 0, VAL_NO_TYPECHECK },
         { "version",  0, 0, VAL_VERSION },
+        { "timing",   0, 0, VAL_TIMING },
+        { "watch",    0, 0, VAL_WATCH },
         { 0, 0, 0, 0}
     };
     int idx;
-    unsigned int flags = AUG_TYPE_CHECK|AUG_NO_MODL_AUTOLOAD;
+    int njobs = 1, nfiles, failed = 0;
+    struct result *results = NULL;
+    char *end;
     progname = argv[0];
 
     setlocale(LC_ALL, "");
-    while ((opt = getopt_long(argc, argv, "hI:t", options, &idx)) != -1) {
+    while ((opt = getopt_long(argc, argv, "hI:tj:", options, &idx)) != -1) {
         switch(opt) {
         case 'I':
             argz_add(&loadpath, &loadpathlen, optarg);
@@ -98,6 +513,17 @@ int main(int argc, char **argv) {
         case 't':
             flags |= AUG_TRACE_MODULE_LOADING;
             break;
+        case 'j':
+            njobs = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || njobs < 0) {
+                fprintf(stderr, "Invalid number of jobs %s\n", optarg);
+                usage();
+            }
+            if (njobs == 0)
+                njobs = sysconf(_SC_NPROCESSORS_ONLN);
+            if (njobs < 1)
+                njobs = 1;
+            break;
         case 'h':
             usage();
             break;
@@ -110,6 +536,13 @@ int main(int argc, char **argv) {
         case VAL_VERSION:
             print_version = true;
             break;
+        case VAL_TIMING:
+            timing = true;
+            flags |= AUG_TIME_TESTS;
+            break;
+        case VAL_WATCH:
+            watch = true;
+            break;
         default:
             usage();
             break;
@@ -122,30 +555,59 @@ int main(int argc, char **argv) {
     }
 
     argz_stringify(loadpath, loadpathlen, PATH_SEP_CHAR);
-    aug = aug_init(NULL, loadpath, flags);
-    if (aug == NULL) {
-        fprintf(stderr, "Memory exhausted\n");
-        return 2;
-    }
 
     if (print_version) {
+        aug = init_aug();
+        if (aug == NULL)
+            return 2;
         print_version_info(aug);
         aug_close(aug);
         return EXIT_SUCCESS;
     }
 
-    if (__aug_load_module_file(aug, argv[optind]) == -1) {
-        fprintf(stderr, "%s\n", aug_error_message(aug));
-        const char *s = aug_error_details(aug);
-        if (s != NULL) {
-            fprintf(stderr, "%s\n", s);
-        }
-        aug_close(aug);
-        exit(EXIT_FAILURE);
+    nfiles = argc - optind;
+    if (ALLOC_N(results, nfiles) < 0) {
+        fprintf(stderr, "Memory exhausted\n");
+        return 2;
     }
+    for (int i=0; i < nfiles; i++)
+        results[i].file = argv[optind + i];
 
+    if (njobs > nfiles)
+        njobs = nfiles;
+    if (watch)
+        njobs = 1;
+
+    aug = init_aug();
+    if (aug == NULL)
+        return 2;
+    if (njobs > 1) {
+        /* Compile the library modules once, before forking, instead of
+         * once in every worker */
+        if (__aug_preload_modules(aug, argv + optind, nfiles) < 0) {
+            fprintf(stderr, "%s\n", aug_error_message(aug));
+            return 2;
+        }
+        run_parallel(aug, results, argv + optind, nfiles, njobs);
+    } else {
+        for (int i=0; i < nfiles; i++) {
+            results[i].status = run_module_file(aug, results[i].file,
+                                                &results[i].elapsed);
+            results[i].done = true;
+            print_result(results + i);
+        }
+        if (watch)
+            watch_files(aug, results, nfiles);
+    }
     aug_close(aug);
+
+    failed = count_failed(results, nfiles);
+    if (nfiles > 1 && failed > 0)
+        fprintf(stderr, "%d of %d modules failed\n", failed, nfiles);
+
+    free(results);
     free(loadpath);
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 /*
@@ -366,46 +366,49 @@ static char *ls_pattern(struct command *cmd, const char *path) {
     return q;
 }
 
-static int child_count(struct command *cmd, const char *path) {
-    char *q = ls_pattern(cmd, path);
-    int cnt;
-
-    if (q == NULL)
-        return 0;
-    cnt = aug_match(cmd->aug, q, NULL);
-    if (HAS_ERR(cmd))
-        cnt = -1;
-    free(q);
-    return cnt;
-}
-
 static void cmd_ls(struct command *cmd) {
-    int cnt = 0;
     char *path = NULL;
-    char **paths = NULL;
+    char *p = NULL;
+    struct pathx *px = NULL, *cx = NULL;
 
     path = ls_pattern(cmd, arg_value(cmd, "path"));
     ERR_BAIL(cmd);
 
-    cnt = aug_match(cmd->aug, path, &paths);
+    /* Parse the pattern for the children of each match only once, and
+     * evaluate it against every match */
+    px = pathx_aug_parse_ctx(cmd->aug, path, true);
     ERR_BAIL(cmd);
-    for (int i=0; i < cnt; i++) {
-        const char *val;
-        const char *basnam = strrchr(paths[i], SEP);
-        int dir = child_count(cmd, paths[i]);
-        aug_get(cmd->aug, paths[i], &val);
+    cx = pathx_aug_parse(cmd->aug, NULL, NULL, "*", true);
+    ERR_BAIL(cmd);
+
+    for (struct tree *t = pathx_first(px); t != NULL; t = pathx_next(px)) {
+        const char *val = t->value;
+        const char *basnam;
+        int dir = 0;
+
+        if (TREE_HIDDEN(t))
+            continue;
+        pathx_rebind(cx, t);
+        for (struct tree *c = pathx_first(cx); c != NULL; c = pathx_next(cx))
+            if (! TREE_HIDDEN(c))
+                dir += 1;
         ERR_BAIL(cmd);
-        basnam = (basnam == NULL) ? paths[i] : basnam + 1;
+
+        p = path_of_tree(t);
+        ERR_NOMEM(p == NULL, cmd->aug);
+        basnam = strrchr(p, SEP);
+        basnam = (basnam == NULL) ? p : basnam + 1;
         if (val == NULL)
             val = "(none)";
         fprintf(cmd->out, "%s%s= %s\n", basnam, dir ? "/ " : " ", val);
-        FREE(paths[i]);
+        FREE(p);
     }
+    ERR_BAIL(cmd);
  error:
     free(path);
-    for (int i=0; i < cnt; i++)
-        FREE(paths[i]);
-    free(paths);
+    free(p);
+    free_pathx(px);
+    free_pathx(cx);
 }
 
 static const struct command_opt_def cmd_ls_opts[] = {
@@ -426,36 +429,41 @@ static void cmd_match(struct command *cmd) {
     int cnt = 0;
     const char *pattern = arg_value(cmd, "path");
     const char *value = arg_value(cmd, "value");
-    char **matches = NULL;
+    char *path = NULL;
+    struct pathx *px = NULL;
     bool filter = (value != NULL) && (strlen(value) > 0);
 
-    cnt = aug_match(cmd->aug, pattern, &matches);
+    if (STREQ(pattern, "/"))
+        pattern = "/*";
+    px = pathx_aug_parse_ctx(cmd->aug, pattern, true);
     ERR_BAIL(cmd);
-    ERR_THROW(cnt < 0, cmd->aug, AUG_ECMDRUN,
-              "  (error matching %s)\n", pattern);
-    if (cnt == 0) {
-        fprintf(cmd->out, "  (no matches)\n");
-        goto done;
-    }
 
-    for (int i=0; i < cnt; i++) {
-        const char *val;
-        aug_get(cmd->aug, matches[i], &val);
-        ERR_BAIL(cmd);
+    /* Print values straight from the matching nodes rather than looking
+     * up the path of each match again */
+    for (struct tree *t = pathx_first(px); t != NULL; t = pathx_next(px)) {
+        const char *val = t->value;
+
+        if (TREE_HIDDEN(t))
+            continue;
+        cnt += 1;
         if (val == NULL)
             val = "(none)";
-        if (filter) {
-            if (STREQ(value, val))
-                fprintf(cmd->out, "%s\n", matches[i]);
-        } else {
-            fprintf(cmd->out, "%s = %s\n", matches[i], val);
-        }
+        if (filter && STRNEQ(value, val))
+            continue;
+        path = path_of_tree(t);
+        ERR_NOMEM(path == NULL, cmd->aug);
+        if (filter)
+            fprintf(cmd->out, "%s\n", path);
+        else
+            fprintf(cmd->out, "%s = %s\n", path, val);
+        FREE(path);
     }
+    ERR_BAIL(cmd);
+    if (cnt == 0)
+        fprintf(cmd->out, "  (no matches)\n");
  error:
- done:
-    for (int i=0; i < cnt; i++)
-        free(matches[i]);
-    free(matches);
+    free(path);
+    free_pathx(px);
 }
 
 static const struct command_opt_def cmd_match_opts[] = {
@@ -21,6 +21,9 @@
  */
 
 #include <config.h>
+
+#define MEM_SUBSYS MEM_INTERP
+
 #include <stdio.h>
 #include <stdarg.h>
 #include <errno.h>
@@ -206,7 +209,7 @@ static struct value *lens_get(struct info *info, struct value **argv) {
     struct value *v;
     const char *text = str->string->str;
 
-    struct tree *tree = lns_get(info, l->lens, text, 0, &err);
+    struct tree *tree = lns_get(info, l->lens, text, 0, 0, NULL, &err);
     if (err == NULL && ! HAS_ERR(info)) {
         v = make_value(V_TREE, ref(info));
         v->origin = make_tree_origin(tree);
@@ -244,7 +247,7 @@ static struct value *lens_put(struct info *info, struct value **argv) {
 
     init_memstream(&ms);
     lns_put(info, ms.stream, l->lens, tree->origin->children,
-            str->string->str, 0, &err);
+            str->string->str, NULL, 0, &err);
     close_memstream(&ms);
 
     if (err == NULL && ! HAS_ERR(info)) {
@@ -278,6 +281,7 @@ static struct value *tree_set_glue(struct info *info, struct value **argv) {
     if (tree->origin->children == NULL) {
         tree->origin->children = make_tree(NULL, NULL, tree->origin, NULL);
         fake = tree->origin->children;
+        tree_children_changed(tree->origin);
     }
 
     result = pathx_parse_glue(info, tree, path, &p);
@@ -292,6 +296,7 @@ static struct value *tree_set_glue(struct info *info, struct value **argv) {
     }
     if (fake != NULL) {
         list_remove(fake, tree->origin->children);
+        tree_children_changed(tree->origin);
         free_tree(fake);
     }
     result = ref(tree);
@@ -319,6 +324,7 @@ static struct value *tree_clear_glue(struct info *info, struct value **argv) {
     if (tree->origin->children == NULL) {
         tree->origin->children = make_tree(NULL, NULL, tree->origin, NULL);
         fake = tree->origin->children;
+        tree_children_changed(tree->origin);
     }
 
     result = pathx_parse_glue(info, tree, path, &p);
@@ -333,6 +339,7 @@ static struct value *tree_clear_glue(struct info *info, struct value **argv) {
     }
     if (fake != NULL) {
         list_remove(fake, tree->origin->children);
+        tree_children_changed(tree->origin);
         free_tree(fake);
     }
     result = ref(tree);
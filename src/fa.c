@@ -30,6 +30,9 @@
  */
 
 #include <config.h>
+
+#define MEM_SUBSYS MEM_FA
+
 #include <limits.h>
 #include <ctype.h>
 #include <stdbool.h>
@@ -38,6 +41,7 @@
 #include "memory.h"
 #include "ref.h"
 #include "hash.h"
+#include "oahash.h"
 #include "fa.h"
 
 #define UCHAR_NUM (UCHAR_MAX+1)
@@ -226,7 +230,7 @@ struct re_str {
 static struct re *parse_regexp(struct re_parse *parse);
 
 /* A map from a set of states to a state. */
-typedef hash_t state_set_hash;
+typedef struct oahash state_set_hash;
 
 static hash_val_t ptr_hash(const void *p);
 
@@ -788,30 +792,17 @@ static hash_val_t ptr_hash(const void *p) {
     return hash;
 }
 
-typedef hash_t state_triple_hash;
+/* A map from a pair of states to a state; the pair is stored in the
+ * table itself */
+typedef struct oahash state_triple_hash;
 
-static hash_val_t pair_hash(const void *key) {
+static size_t pair_hash(const void *key) {
     register struct state *const *pair = key;
-    return pair[0]->hash + pair[1]->hash;
-}
-
-static int pair_cmp(const void *key1, const void *key2) {
-    return memcmp(key1, key2, 2*sizeof(struct state *));
-}
-
-static void state_triple_node_free(hnode_t *node, ATTRIBUTE_UNUSED void *ctx) {
-    free((void *) hnode_getkey(node));
-    free(node);
+    return pair[0]->hash + 31 * pair[1]->hash;
 }
 
 static state_triple_hash *state_triple_init(void) {
-    state_triple_hash *hash;
-
-    hash = hash_create(HASHCOUNT_T_MAX, pair_cmp, pair_hash);
-    if (hash == NULL)
-        return NULL;
-    hash_set_allocator(hash, NULL, state_triple_node_free, NULL);
-    return hash;
+    return oahash_create(2 * sizeof(struct state *), pair_hash, NULL);
 }
 
 ATTRIBUTE_RETURN_CHECK
@@ -819,30 +810,57 @@ static int state_triple_push(state_triple_hash *hash,
                              struct state *s1,
                              struct state *s2,
                              struct state *s3) {
-    struct state **pair;
-    if (ALLOC_N(pair, 2) < 0)
-        return -1;
+    struct state *pair[2];
     pair[0] = s1;
     pair[1] = s2;
-    return hash_alloc_insert(hash, pair, s3);
+    return oahash_insert(hash, pair, s3);
 }
 
 static struct state * state_triple_thd(state_triple_hash *hash,
                                        struct state *s1,
                                        struct state *s2) {
     struct state *pair[2];
-    hnode_t *node;
+    void *s3 = NULL;
     pair[0] = s1;
     pair[1] = s2;
-    node = hash_lookup(hash, pair);
-    return (node == NULL) ? NULL : (struct state *) hnode_get(node);
+    oahash_lookup(hash, pair, &s3);
+    return s3;
 }
 
 static void state_triple_free(state_triple_hash *hash) {
-    if (hash != NULL) {
-        hash_free_nodes(hash);
-        hash_destroy(hash);
+    oahash_free(hash);
+}
+
+/* A map from the states in a state set to their position in it, for sets
+ * that are too big to search linearly */
+typedef struct oahash state_index;
+
+static size_t state_ptr_hash(const void *key) {
+    return ptr_hash(*(struct state *const *) key);
+}
+
+static state_index *state_index_init(const struct state_set *set) {
+    state_index *stindex;
+
+    stindex = oahash_create(sizeof(struct state *), state_ptr_hash, NULL);
+    if (stindex == NULL)
+        return NULL;
+    for (int i=0; i < set->used; i++) {
+        void *pos = (void *) (intptr_t) i;
+        if (oahash_insert(stindex, set->states + i, pos) < 0) {
+            oahash_free(stindex);
+            return NULL;
+        }
     }
+    return stindex;
+}
+
+static int state_index_of(const state_index *stindex,
+                          const struct state *s) {
+    void *pos;
+    if (oahash_lookup(stindex, &s, &pos) == NULL)
+        return -1;
+    return (intptr_t) pos;
 }
 
 /*
@@ -1053,37 +1071,38 @@ static uchar* start_points(struct fa *fa, int *npoints) {
 }
 
 /*
- * Operations on STATE_SET_HASH
+ * Operations on STATE_SET_HASH. The keys in the table are pointers to
+ * state sets, which are owned by the table
  */
-static int state_set_hash_contains(state_set_hash *smap,
-                               struct state_set *set) {
-    return hash_lookup(smap, set) != NULL;
-}
 
 /*
- * Find the set in SMAP that has the same states as SET. If the two are
- * different, i.e. they point to different memory locations, free SET and
- * return the set found in SMAP
+ * Find the set in SMAP that has the same states as *SET and return the
+ * state it maps to, or NULL if there is no such set. If the set in SMAP
+ * is a different one than *SET, i.e. they point to different memory
+ * locations, free *SET and replace it with the set found in SMAP
  */
-static struct state_set *state_set_hash_uniq(state_set_hash *smap,
-                                             struct state_set *set) {
-    hnode_t *node = hash_lookup(smap, set);
-    const struct state_set *orig_set = hnode_getkey(node);
-    if (orig_set != set) {
-        state_set_free(set);
+static struct state *state_set_hash_uniq(state_set_hash *smap,
+                                         struct state_set **set) {
+    void *s = NULL;
+    struct state_set *const *orig_set = oahash_lookup(smap, set, &s);
+
+    if (orig_set != NULL && *orig_set != *set) {
+        state_set_free(*set);
+        *set = *orig_set;
     }
-    return (struct state_set *) orig_set;
+    return s;
 }
 
 static struct state *state_set_hash_get_state(state_set_hash *smap,
                                              struct state_set *set) {
-    hnode_t *node = hash_lookup(smap, set);
-    return (struct state *) hnode_get(node);
+    void *s = NULL;
+    oahash_lookup(smap, &set, &s);
+    return s;
 }
 
-static hash_val_t set_hash(const void *key) {
-    hash_val_t hash = 0;
-    const struct state_set *set = key;
+static size_t set_hash(const void *key) {
+    size_t hash = 0;
+    const struct state_set *set = *(struct state_set *const *) key;
 
     for (int i = 0; i < set->used; i++) {
         hash += set->states[i]->hash;
@@ -1091,45 +1110,42 @@ static hash_val_t set_hash(const void *key) {
     return hash;
 }
 
-static int set_cmp(const void *key1, const void *key2) {
-    const struct state_set *set1 = key1;
-    const struct state_set *set2 = key2;
+static int set_eq(const void *key1, const void *key2) {
+    const struct state_set *set1 = *(struct state_set *const *) key1;
+    const struct state_set *set2 = *(struct state_set *const *) key2;
 
-    return state_set_equal(set1, set2) ? 0 : 1;
-}
-
-static void set_destroy(hnode_t *node, ATTRIBUTE_UNUSED void *ctx) {
-    struct state_set *set = (struct state_set *) hnode_getkey(node);
-    state_set_free(set);
-    free(node);
+    return state_set_equal(set1, set2);
 }
 
-ATTRIBUTE_RETURN_CHECK
-static int state_set_hash_add(state_set_hash **smap,
-                              struct state_set *set, struct fa *fa) {
+/* Add SET to SMAP, mapping it to a new state in FA, and return that state.
+ * SET must not be in SMAP yet */
+static struct state *state_set_hash_add(state_set_hash **smap,
+                                        struct state_set *set,
+                                        struct fa *fa) {
     if (*smap == NULL) {
-        *smap = hash_create(HASHCOUNT_T_MAX, set_cmp, set_hash);
+        *smap = oahash_create(sizeof(set), set_hash, set_eq);
         E(*smap == NULL);
-        hash_set_allocator(*smap, NULL, set_destroy, NULL);
     }
     struct state *s = add_state(fa, 0);
     E(s == NULL);
-    F(hash_alloc_insert(*smap, set, s));
-    return 0;
+    F(oahash_insert(*smap, &set, s));
+    return s;
  error:
-    return -1;
+    return NULL;
 }
 
 static void state_set_hash_free(state_set_hash *smap,
                                 struct state_set *protect) {
-    if (protect != NULL) {
-        hnode_t *node = hash_lookup(smap, protect);
-        hash_delete(smap, node);
-        hnode_getkey(node) = NULL;
-        set_destroy(node, NULL);
+    size_t pos = 0;
+    const void *key;
+    void *s;
+
+    while (oahash_next(smap, &pos, &key, &s)) {
+        struct state_set *set = *(struct state_set *const *) key;
+        if (set != protect)
+            state_set_free(set);
     }
-    hash_free_nodes(smap);
-    hash_destroy(smap);
+    oahash_free(smap);
 }
 
 static int state_set_list_add(struct state_set_list **list,
@@ -1323,7 +1339,7 @@ static int determinize(struct fa *fa, struct state_set *ini) {
     }
 
     F(state_set_list_add(&worklist, ini));
-    F(state_set_hash_add(&newstate, ini, fa));
+    E(state_set_hash_add(&newstate, ini, fa) == NULL);
     // Make the new state the initial state
     swap_initial(fa);
     while (worklist != NULL) {
@@ -1342,13 +1358,13 @@ static int determinize(struct fa *fa, struct state_set *ini) {
                     }
                 }
             }
-            if (!state_set_hash_contains(newstate, pset)) {
+            struct state *q = state_set_hash_uniq(newstate, &pset);
+            if (q == NULL) {
                 F(state_set_list_add(&worklist, pset));
-                F(state_set_hash_add(&newstate, pset, fa));
+                q = state_set_hash_add(&newstate, pset, fa);
+                E(q == NULL);
             }
-            pset = state_set_hash_uniq(newstate, pset);
 
-            struct state *q = state_set_hash_get_state(newstate, pset);
             uchar min = points[n];
             uchar max = UCHAR_MAX;
             if (n+1 < npoints)
@@ -1444,6 +1460,7 @@ static void state_list_free(struct state_list *sl) {
 
 static int minimize_hopcroft(struct fa *fa) {
     struct state_set *states = NULL;
+    state_index *stindex = NULL;
     uchar *sigma = NULL;
     struct state_set **reverse = NULL;
     bitset *reverse_nonempty = NULL;
@@ -1484,6 +1501,8 @@ static int minimize_hopcroft(struct fa *fa) {
         F(state_set_push(states, s));
     }
     nstates = states->used;
+    stindex = state_index_init(states);
+    E(stindex == NULL);
 
     sigma = start_points(fa, &nsigma);
     E(sigma == NULL);
@@ -1544,7 +1563,7 @@ static int minimize_hopcroft(struct fa *fa) {
             uchar y = sigma[x];
             struct state *p = step(qq, y);
             assert(p != NULL);
-            int pn = state_set_index(states, p);
+            int pn = state_index_of(stindex, p);
             assert(pn >= 0);
             F(state_set_push(reverse[INDEX(pn, x)], qq));
             bitset_set(reverse_nonempty, INDEX(pn, x));
@@ -1556,7 +1575,7 @@ static int minimize_hopcroft(struct fa *fa) {
         for (int x = 0; x < nsigma; x++)
             for (int q = 0; q < partition[j]->used; q++) {
                 struct state *qq = partition[j]->states[q];
-                int qn = state_set_index(states, qq);
+                int qn = state_index_of(stindex, qq);
                 if (bitset_get(reverse_nonempty, INDEX(qn, x))) {
                     active2[INDEX(qn, x)] =
                         state_list_add(active[INDEX(j, x)], qq);
@@ -1591,11 +1610,11 @@ static int minimize_hopcroft(struct fa *fa) {
         /* find states that need to be split off their blocks */
         struct state_list *sh = active[INDEX(p,x)];
         for (struct state_list_node *m = sh->first; m != NULL; m = m->next) {
-            int q = state_set_index(states, m->state);
+            int q = state_index_of(stindex, m->state);
             struct state_set *rev = reverse[INDEX(q, x)];
             for (int r =0; r < rev->used; r++) {
                 struct state *rs = rev->states[r];
-                int s = state_set_index(states, rs);
+                int s = state_index_of(stindex, rs);
                 if (! bitset_get(split2, s)) {
                     bitset_set(split2, s);
                     F(state_set_push(split, rs));
@@ -1618,7 +1637,7 @@ static int minimize_hopcroft(struct fa *fa) {
                 for (int s = 0; s < sp->used; s++) {
                     state_set_remove(b1, sp->states[s]);
                     F(state_set_push(b2, sp->states[s]));
-                    int snum = state_set_index(states, sp->states[s]);
+                    int snum = state_index_of(stindex, sp->states[s]);
                     block[snum] = k;
                     for (int c = 0; c < nsigma; c++) {
                         struct state_list_node *sn = active2[INDEX(snum, c)];
@@ -1653,7 +1672,7 @@ static int minimize_hopcroft(struct fa *fa) {
                 k++;
             }
             for (int s = 0; s < sp->used; s++) {
-                int snum = state_set_index(states, sp->states[s]);
+                int snum = state_index_of(stindex, sp->states[s]);
                 bitset_clr(split2, snum);
             }
             bitset_clr(refine2, j);
@@ -1675,7 +1694,7 @@ static int minimize_hopcroft(struct fa *fa) {
         struct state_set *partn = partition[n];
         for (int q=0; q < partn->used; q++) {
             struct state *qs = partn->states[q];
-            int qnum = state_set_index(states, qs);
+            int qnum = state_index_of(stindex, qs);
             if (qs == fa->initial)
                 s->live = 1;     /* Abuse live to flag the new initial state */
             nsnum[n] = qnum;     /* select representative */
@@ -1688,7 +1707,7 @@ static int minimize_hopcroft(struct fa *fa) {
         struct state *s = newstates->states[n];
         s->accept = states->states[nsnum[n]]->accept;
         for_each_trans(t, states->states[nsnum[n]]) {
-            int toind = state_set_index(states, t->to);
+            int toind = state_index_of(stindex, t->to);
             struct state *nto = newstates->states[nsind[toind]];
             F(add_new_trans(s, nto, t->min, t->max));
         }
@@ -1714,6 +1733,7 @@ static int minimize_hopcroft(struct fa *fa) {
     free(nsind);
     free(nsnum);
     state_set_free(states);
+    oahash_free(stindex);
     free(sigma);
     bitset_free(reverse_nonempty);
     free(block);
@@ -1892,7 +1912,7 @@ int fa_is_basic(struct fa *fa, unsigned int basic) {
     return 0;
 }
 
-static struct fa *fa_clone(struct fa *fa) {
+struct fa *fa_clone(struct fa *fa) {
     struct fa *result = NULL;
     struct state_set *set = state_set_init(-1, S_DATA|S_SORTED);
     int r;
@@ -1934,6 +1954,15 @@ static struct fa *fa_clone(struct fa *fa) {
     return NULL;
 }
 
+void fa_set_allocator(void *(*calloc_fn)(size_t nmemb, size_t size),
+                      void *(*realloc_fn)(void *ptr, size_t size)) {
+    mem_set_allocator(calloc_fn, realloc_fn);
+}
+
+int fa_alloc_stats(size_t *count, size_t *bytes) {
+    return mem_stats(MEM_FA, count, bytes);
+}
+
 static int case_expand(struct fa *fa);
 
 /* Compute FA1|FA2 and set FA1 to that automaton. FA2 is freed */
@@ -159,6 +159,23 @@ int fa_equals(struct fa *fa1, struct fa *fa2);
 /* Free all memory used by FA */
 void fa_free(struct fa *fa);
 
+/* Return a copy of FA that accepts the same language and has the same
+ * states and transitions, or NULL if allocation fails. This is much
+ * cheaper than compiling the same regular expression again.
+ */
+struct fa *fa_clone(struct fa *fa);
+
+/* Use CALLOC_FN and REALLOC_FN instead of calloc(3) and realloc(3) for
+ * the memory libfa allocates for automata. Passing NULL restores the C
+ * library's function. Memory is still released with free(3) */
+void fa_set_allocator(void *(*calloc_fn)(size_t nmemb, size_t size),
+                      void *(*realloc_fn)(void *ptr, size_t size));
+
+/* Set *COUNT to the number of allocations libfa has made for automata,
+ * and *BYTES to the number of bytes they asked for. Return 0 on success,
+ * and -1 if libfa was built without allocation counters */
+int fa_alloc_stats(size_t *count, size_t *bytes);
+
 /* Print FA to OUT as a graphviz dot file */
 void fa_dot(FILE *out, struct fa *fa);
 
@@ -22,6 +22,8 @@
 
 #include <config.h>
 
+#define MEM_SUBSYS MEM_GET
+
 #include <regex.h>
 #include <stdarg.h>
 
@@ -37,21 +39,24 @@
 static const char *const short_iteration =
     "Iterated lens matched less than it should";
 
-struct seq {
-    struct seq *next;
-    const char *name;
-    int value;
-};
-
 struct state {
     struct info      *info;
     struct span      *span;
     const char       *text;
-    struct seq       *seqs;
+    /* How many entries each seq has numbered so far, indexed by the
+     * seq_slot of the seq and counter lenses; allocated on first use */
+    unsigned int     *seqs;
     char             *key;
     char             *value;     /* GET_STORE leaves a value here */
     struct lns_error *error;
     int               enable_span;
+    /* Where tokens are copied to when loading with AUG_SHARE_TEXT; NULL
+     * if every token gets its own allocation */
+    struct tree_text *shared;
+    /* Where rec_process keeps its parse in M_GET, and where it takes the
+     * parse from instead of running the Earley parser in M_PARSE; NULL if
+     * the parse is neither kept nor known */
+    struct lns_ast   *ast;
     /* We use the registers from a regular expression match to keep track
      * of the substring we are currently looking at. REGS are the registers
      * from the last regexp match; NREG is the number of the register
@@ -107,6 +112,25 @@ struct ast {
     uint                end;
 };
 
+/* The AST from rec_process, flattened so that it can be kept after
+ * lns_get is done. EVENTS are the nodes of the AST in preorder; SIZE of
+ * an event is the number of events for the descendants of its node, 0 for
+ * terminals */
+struct ast_event {
+    struct lens        *lens;
+    uint                start;
+    uint                end;
+    uint                size;
+};
+
+struct lns_ast {
+    struct lens        *lens;
+    char               *text;
+    uint                text_len;
+    uint                nevents;
+    struct ast_event   *events;
+};
+
 struct rec_state {
     enum mode_t          mode;
     struct state        *state;
@@ -230,6 +254,45 @@ static void ast_pop(struct rec_state *rec_state) {
     return;
 }
 
+static uint ast_count(const struct ast *ast) {
+    uint n = ast->nchildren;
+    for (int i = 0; i < ast->nchildren; i++)
+        n += ast_count(ast->children[i]);
+    return n;
+}
+
+static void ast_flatten(const struct ast *ast, struct lns_ast *la) {
+    for (int i = 0; i < ast->nchildren; i++) {
+        const struct ast *child = ast->children[i];
+        struct ast_event *ev = la->events + la->nevents;
+
+        la->nevents += 1;
+        ev->lens = child->lens;
+        ev->start = child->start;
+        ev->end = child->end;
+        ast_flatten(child, la);
+        ev->size = la->nevents - (ev - la->events) - 1;
+    }
+}
+
+/* Keep the AST with root AST in LA */
+static int ast_keep(struct lns_ast *la, const struct ast *ast) {
+    if (ALLOC_N(la->events, ast_count(ast)) < 0)
+        return -1;
+    la->nevents = 0;
+    ast_flatten(ast, la);
+    return 0;
+}
+
+void free_lns_ast(struct lns_ast *ast) {
+    if (ast == NULL)
+        return;
+    unref(ast->lens, lens);
+    free(ast->text);
+    free(ast->events);
+    free(ast);
+}
+
 static void print_ast(const struct ast *ast, int lvl) {
     int i;
     char *lns;
@@ -391,9 +454,21 @@ static void get_expected_error(struct state *state, struct lens *l) {
 
 static char *token(struct state *state) {
     ensure0(REG_MATCHED(state), state->info);
+    if (state->shared != NULL) {
+        char *tok = tree_text_add(state->shared, REG_POS(state),
+                                  REG_SIZE(state));
+        if (tok != NULL)
+            return tok;
+    }
     return strndup(REG_POS(state), REG_SIZE(state));
 }
 
+/* Free a token that was never put into a tree */
+static void free_token(struct state *state, char *tok) {
+    if (! tree_text_has(state->shared, tok))
+        free(tok);
+}
+
 static char *token_range(const char *text, uint start, uint end) {
     return strndup(text + start, end - start);
 }
@@ -474,39 +549,24 @@ static struct tree *get_lens(struct lens *lens, struct state *state);
 static struct skel *parse_lens(struct lens *lens, struct state *state,
                                struct dict **dict);
 
-static void free_seqs(struct seq *seqs) {
-    /* Do not free seq->name; it's not owned by the seq, but by some lens */
-    list_free(seqs);
-}
-
-static struct seq *find_seq(const char *name, struct state *state) {
-    ensure0(name != NULL, state->info);
-    struct seq *seq;
-
-    for (seq=state->seqs;
-         seq != NULL && STRNEQ(seq->name, name);
-         seq = seq->next);
-
-    if (seq == NULL) {
-        if (ALLOC(seq) < 0)
+static unsigned int *find_seq(struct lens *lens, struct state *state) {
+    if (state->seqs == NULL) {
+        const struct augeas *aug = state->info->error->aug;
+        if (ALLOC_N(state->seqs, seq_table_size(aug->seqs)) < 0)
             return NULL;
-        seq->name = name;
-        seq->value = 1;
-        list_append(state->seqs, seq);
     }
-
-    return seq;
+    return state->seqs + lens->seq_slot;
 }
 
 static struct tree *get_seq(struct lens *lens, struct state *state) {
     ensure0(lens->tag == L_SEQ, state->info);
-    struct seq *seq = find_seq(lens->string->str, state);
+    unsigned int *seq = find_seq(lens, state);
     int r;
 
-    r = asprintf((char **) &(state->key), "%d", seq->value);
+    ERR_NOMEM(seq == NULL, state->info);
+    *seq += 1;
+    r = asprintf((char **) &(state->key), "%u", *seq);
     ERR_NOMEM(r < 0, state->info);
-
-    seq->value += 1;
  error:
     return NULL;
 }
@@ -518,8 +578,11 @@ static struct skel *parse_seq(struct lens *lens, struct state *state) {
 
 static struct tree *get_counter(struct lens *lens, struct state *state) {
     ensure0(lens->tag == L_COUNTER, state->info);
-    struct seq *seq = find_seq(lens->string->str, state);
-    seq->value = 1;
+    unsigned int *seq = find_seq(lens, state);
+
+    ERR_NOMEM(seq == NULL, state->info);
+    *seq = 0;
+ error:
     return NULL;
 }
 
@@ -911,6 +974,7 @@ static struct tree *get_subtree(struct lens *lens, struct state *state) {
 
     tree = make_tree(state->key, state->value, NULL, children);
     ERR_NOMEM(tree == NULL, state->info);
+    tree_share_text(tree, state->shared);
     tree->span = move(state->span);
 
     if (tree->span != NULL) {
@@ -940,26 +1004,34 @@ static struct skel *parse_subtree(struct lens *lens, struct state *state,
     return make_skel(lens);
 }
 
-/* Check if left and right strings matches according to the square lens
- * definition.
+/* Check if the left key of the square lens LENS, the text between LSTART
+ * and LEND, matches the right key between RSTART and REND. The keys are
+ * compared in place; report a parse error if they do not match.
  *
- * Returns 1 if strings matches, 0 otherwise
+ * Returns 1 if the keys match, 0 otherwise
  */
-static int square_match(struct lens *lens, char *left, char *right) {
-    int cmp = 0;
-    struct lens *concat = NULL;
-
-    // if one of the argument is NULL, returns no match
-    if (left == NULL || right == NULL || lens == NULL)
-        return cmp;
-
-    concat = lens->child;
-    /* If either right or left lens is nocase, then ignore case */
-    if (child_first(concat)->ctype->nocase ||
-            child_last(concat)->ctype->nocase) {
-        cmp = STRCASEEQ(left, right);
-    } else {
-        cmp = STREQ(left, right);
+static int square_match(struct lens *lens, struct state *state,
+                        uint lstart, uint lend, uint rstart, uint rend) {
+    const char *left = state->text + lstart;
+    const char *right = state->text + rstart;
+    size_t len = lend - lstart;
+    int cmp;
+
+    if (rend - rstart != len)
+        cmp = 0;
+    else if (lens->square_nocase)
+        cmp = strncasecmp(left, right, len) == 0;
+    else
+        cmp = memcmp(left, right, len) == 0;
+
+    if (! cmp) {
+        char *lsqr = token_range(state->text, lstart, lend);
+        char *rsqr = token_range(state->text, rstart, rend);
+        get_error(state, lens, "%s \"%s\" %s \"%s\"",
+            "Parse error: mismatched in square lens, expecting", lsqr,
+            "but got", rsqr);
+        FREE(lsqr);
+        FREE(rsqr);
     }
     return cmp;
 }
@@ -971,11 +1043,10 @@ static int square_match(struct lens *lens, char *left, char *right) {
 static struct tree *get_square(struct lens *lens, struct state *state) {
     ensure0(lens->tag == L_SQUARE, state->info);
 
-    struct lens *concat = lens->child;
     struct tree *tree = NULL;
     uint end = REG_END(state);
     uint start = REG_START(state);
-    char *rsqr = NULL, *lsqr = NULL;
+    uint rreg;
     int r;
 
     SAVE_REGS(state);
@@ -984,32 +1055,15 @@ static struct tree *get_square(struct lens *lens, struct state *state) {
 
     tree = get_lens(lens->child, state);
 
-    /* retrieve left component */
-    state->nreg = 1;
-    start = REG_START(state);
-    end = REG_END(state);
-    lsqr = token_range(state->text, start, end);
-
-    /* retrieve right component */
-    /* compute nreg for the last children */
-    for (int i = 0; i < concat->nchildren - 1; i++)
-        state->nreg += 1 + regexp_nsub(concat->children[i]->ctype);
-
-    start = REG_START(state);
-    end = REG_END(state);
-    rsqr = token_range(state->text, start, end);
-
-    if (!square_match(lens, lsqr, rsqr)) {
-        get_error(state, lens, "%s \"%s\" %s \"%s\"",
-            "Parse error: mismatched in square lens, expecting", lsqr,
-            "but got", rsqr);
+    /* The match of the child has the boundaries of both keys already */
+    rreg = lens_square_reg(lens);
+    if (!square_match(lens, state,
+                      state->regs->start[1], state->regs->end[1],
+                      state->regs->start[rreg], state->regs->end[rreg]))
         goto error;
-    }
 
  done:
     RESTORE_REGS(state);
-    FREE(lsqr);
-    FREE(rsqr);
     return tree;
 
  error:
@@ -1154,8 +1208,10 @@ static void visit_terminal(struct lens *lens, size_t start, size_t end,
         get_terminal(top, lens, state);
     else
         parse_terminal(top, lens, state);
-    child = ast_append(rec_state, lens, start, end);
-    ERR_NOMEM(child == NULL, state->info);
+    if (rec_state->ast != NULL) {
+        child = ast_append(rec_state, lens, start, end);
+        ERR_NOMEM(child == NULL, state->info);
+    }
  error:
     RESTORE_REGS(state);
 }
@@ -1320,6 +1376,7 @@ static void visit_exit(struct lens *lens,
         if (rec_state->mode == M_GET) {
             tree = make_tree(top->key, top->value, NULL, top->tree);
             ERR_NOMEM(tree == NULL, lens->info);
+            tree_share_text(tree, state->shared);
             tree->span = state->span;
             /* Restore the parse state from before entering this subtree */
             top = pop_frame(rec_state);
@@ -1370,24 +1427,13 @@ static void visit_exit(struct lens *lens,
     } else if (lens->tag == L_SQUARE) {
         if (rec_state->mode == M_GET) {
             struct ast *square, *concat, *right, *left;
-            char *rsqr, *lsqr;
-            int ret;
 
             square = rec_state->ast;
             concat = child_first(square);
             right = child_first(concat);
             left = child_last(concat);
-            lsqr = token_range(state->text, left->start, left->end);
-            rsqr = token_range(state->text, right->start, right->end);
-            ret = square_match(lens, lsqr, rsqr);
-            if (! ret) {
-                get_error(state, lens, "%s \"%s\" %s \"%s\"",
-                        "Parse error: mismatched in square lens, expecting", lsqr,
-                        "but got", rsqr);
-            }
-            FREE(lsqr);
-            FREE(rsqr);
-            if (! ret)
+            if (! square_match(lens, state, left->start, left->end,
+                               right->start, right->end))
                 goto error;
         }
         rec_state->combine(rec_state, lens, 1);
@@ -1397,7 +1443,8 @@ static void visit_exit(struct lens *lens,
         top_frame(rec_state)->lens = lens;
         ERR_BAIL(state->info);
     }
-    ast_pop(rec_state);
+    if (rec_state->ast != NULL)
+        ast_pop(rec_state);
  error:
     free_tree(tree);
     return;
@@ -1414,6 +1461,25 @@ static void visit_error(struct lens *lens, void *data, size_t pos,
     rec_state->state->error->pos = rec_state->start + pos;
 }
 
+/* Call the visitor functions for the N events in EVENTS in the same order
+ * as jmt_visit did when the events were recorded */
+static void ast_replay(const struct ast_event *events, uint n,
+                       struct rec_state *rec_state) {
+    for (uint i = 0; i < n; i += 1 + events[i].size) {
+        const struct ast_event *ev = events + i;
+
+        if (rec_state->state->error != NULL)
+            return;
+        if (ev->lens->recursive) {
+            visit_enter(ev->lens, ev->start, ev->end, rec_state);
+            ast_replay(ev + 1, ev->size, rec_state);
+            visit_exit(ev->lens, ev->start, ev->end, rec_state);
+        } else {
+            visit_terminal(ev->lens, ev->start, ev->end, rec_state);
+        }
+    }
+}
+
 static struct frame *rec_process(enum mode_t mode, struct lens *lens,
                                  struct state *state) {
     uint end = REG_END(state);
@@ -1424,14 +1490,19 @@ static struct frame *rec_process(enum mode_t mode, struct lens *lens,
     struct rec_state rec_state;
     int i;
     struct frame *f = NULL;
+    struct jmt *jmt = lens->jmt;
 
     MEMZERO(&rec_state, 1);
     MEMZERO(&visitor, 1);
     SAVE_REGS(state);
 
-    if (lens->jmt == NULL) {
-        lens->jmt = jmt_build(lens);
+    if (jmt == NULL) {
+        jmt = jmt_build(lens);
         ERR_BAIL(lens->info);
+        /* Frozen lenses are not written to; their parser is built when
+         * they are frozen, and only used for this parse otherwise */
+        if (! ref_pinned(lens))
+            lens->jmt = jmt;
     }
 
     rec_state.mode  = mode;
@@ -1439,22 +1510,32 @@ static struct frame *rec_process(enum mode_t mode, struct lens *lens,
     rec_state.fused = 0;
     rec_state.lvl   = 0;
     rec_state.start = start;
-    rec_state.ast = make_ast(lens);
     rec_state.combine = (mode == M_GET) ? get_combine : parse_combine;
-    ERR_NOMEM(rec_state.ast == NULL, state->info);
+    /* Only get needs the AST, to check square lenses and to keep it */
+    if (mode == M_GET) {
+        rec_state.ast = make_ast(lens);
+        ERR_NOMEM(rec_state.ast == NULL, state->info);
+    }
 
-    visitor.parse = jmt_parse(lens->jmt, state->text + start, end - start);
-    ERR_BAIL(lens->info);
-    visitor.terminal = visit_terminal;
-    visitor.enter = visit_enter;
-    visitor.exit = visit_exit;
-    visitor.error = visit_error;
-    visitor.data = &rec_state;
-    r = jmt_visit(&visitor, &len);
-    ERR_BAIL(lens->info);
-    if (r != 1) {
-        get_error(state, lens, "Syntax error");
-        state->error->pos = start + len;
+    if (mode == M_PARSE && state->ast != NULL) {
+        /* lns_get already parsed this text */
+        ast_replay(state->ast->events, state->ast->nevents, &rec_state);
+        ERR_BAIL(lens->info);
+    } else {
+        visitor.parse = jmt_parse(jmt, state->text + start,
+                                  end - start);
+        ERR_BAIL(lens->info);
+        visitor.terminal = visit_terminal;
+        visitor.enter = visit_enter;
+        visitor.exit = visit_exit;
+        visitor.error = visit_error;
+        visitor.data = &rec_state;
+        r = jmt_visit(&visitor, &len);
+        ERR_BAIL(lens->info);
+        if (r != 1) {
+            get_error(state, lens, "Syntax error");
+            state->error->pos = start + len;
+        }
     }
     if (rec_state.fused == 0) {
         get_error(state, lens,
@@ -1466,23 +1547,33 @@ static struct frame *rec_process(enum mode_t mode, struct lens *lens,
         goto error;
     }
 
-    rec_state.ast = ast_root(rec_state.ast);
-    ensure(rec_state.ast->parent == NULL, state->info);
+    if (rec_state.ast != NULL) {
+        rec_state.ast = ast_root(rec_state.ast);
+        ensure(rec_state.ast->parent == NULL, state->info);
+    }
+    if (mode == M_GET && state->ast != NULL && state->error == NULL) {
+        r = ast_keep(state->ast, rec_state.ast);
+        ERR_NOMEM(r < 0, state->info);
+    }
  done:
     if (debugging("cf.get.ast"))
         print_ast(ast_root(rec_state.ast), 0);
     RESTORE_REGS(state);
     jmt_free_parse(visitor.parse);
+    if (jmt != lens->jmt)
+        jmt_free(jmt);
     free_ast(ast_root(rec_state.ast));
     return rec_state.frames;
  error:
 
     for(i = 0; i < rec_state.fused; i++) {
         f = nth_frame(&rec_state, i);
-        FREE(f->key);
+        free_token(state, f->key);
+        f->key = NULL;
         free_span(f->span);
         if (mode == M_GET) {
-            FREE(f->value);
+            free_token(state, f->value);
+            f->value = NULL;
             free_tree(f->tree);
         } else if (mode == M_PARSE) {
             free_skel(f->skel);
@@ -1602,11 +1693,13 @@ static int init_regs(struct state *state, struct lens *lens, uint size) {
 }
 
 struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
-                     int enable_span, struct lns_error **err) {
+                     int enable_span, int share_text, struct lns_ast **ast,
+                     struct lns_error **err) {
     struct state state;
     struct tree *tree = NULL;
     uint size = strlen(text);
     int partial, r;
+    unsigned long long start = metrics_clock();
 
     MEMZERO(&state, 1);
     r = ALLOC(state.info);
@@ -1619,6 +1712,22 @@ struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
 
     state.enable_span = enable_span;
 
+    if (share_text) {
+        /* Tokens do not overlap, so this only runs out of room when the
+         * lens produces many empty tokens; the tokens that do not fit are
+         * allocated individually */
+        state.shared = make_tree_text(size + size / 2 + 1);
+        ERR_NOMEM(state.shared == NULL, info);
+    }
+
+    if (ast != NULL) {
+        *ast = NULL;
+        if (lens->recursive) {
+            r = ALLOC(state.ast);
+            ERR_NOMEM(r < 0, info);
+        }
+    }
+
     /* We are probably being overly cautious here: if the lens can't process
      * all of TEXT, we should really fail somewhere in one of the sublenses.
      * But to be safe, we check that we can process everything anyway, then
@@ -1633,14 +1742,14 @@ struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
             tree = get_lens(lens, &state);
     }
 
-    free_seqs(state.seqs);
+    free(state.seqs);
     if (state.key != NULL) {
         get_error(&state, lens, "get left unused key %s", state.key);
-        free(state.key);
+        free_token(&state, state.key);
     }
     if (state.value != NULL) {
         get_error(&state, lens, "get left unused value %s", state.value);
-        free(state.value);
+        free_token(&state, state.value);
     }
     if (partial && state.error == NULL) {
         get_error(&state, lens, "Get did not match entire input");
@@ -1649,6 +1758,21 @@ struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
  error:
     free_regs(&state);
     FREE(state.info);
+    /* The nodes that point into the shared text hold their own reference */
+    tree_text_release(state.shared);
+
+    /* Keep the parse only if it is complete; put checks that it is used
+     * with the same TEXT */
+    if (state.ast != NULL && state.error == NULL
+        && state.ast->events != NULL
+        && ALLOC_N(state.ast->text, size + 1) == 0) {
+        memcpy(state.ast->text, text, size);
+        state.ast->text_len = size;
+        state.ast->lens = ref(lens);
+        *ast = state.ast;
+    } else {
+        free_lns_ast(state.ast);
+    }
 
     if (err != NULL) {
         *err = state.error;
@@ -1659,6 +1783,7 @@ struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
         }
         free_lns_error(state.error);
     }
+    METRICS_STOP(info->error->aug, get, start);
     return tree;
 }
 
@@ -1714,12 +1839,14 @@ static struct skel *parse_lens(struct lens *lens, struct state *state,
     return skel;
 }
 
-struct skel *lns_parse(struct lens *lens, const char *text, struct dict **dict,
+struct skel *lns_parse(struct lens *lens, const char *text,
+                       struct lns_ast *ast, struct dict **dict,
                        struct lns_error **err) {
     struct state state;
     struct skel *skel = NULL;
     uint size = strlen(text);
     int partial, r;
+    unsigned long long start = metrics_clock();
 
     MEMZERO(&state, 1);
     r = ALLOC(state.info);
@@ -1728,7 +1855,9 @@ struct skel *lns_parse(struct lens *lens, const char *text, struct dict **dict,
     state.info->error = lens->info->error;
     state.text = text;
 
-    state.text = text;
+    if (ast != NULL && ast->lens == lens && ast->text_len == size
+        && memcmp(ast->text, text, size) == 0)
+        state.ast = ast;
 
     partial = init_regs(&state, lens, size);
     if (! partial) {
@@ -1738,7 +1867,7 @@ struct skel *lns_parse(struct lens *lens, const char *text, struct dict **dict,
         else
             skel = parse_lens(lens, &state, dict);
 
-        free_seqs(state.seqs);
+        free(state.seqs);
         if (state.error != NULL) {
             free_skel(skel);
             skel = NULL;
@@ -1766,6 +1895,7 @@ struct skel *lns_parse(struct lens *lens, const char *text, struct dict **dict,
     } else {
         free_lns_error(state.error);
     }
+    METRICS_STOP(lens->info->error->aug, parse, start);
     return skel;
 }
 
@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <locale.h>
+#include <time.h>
 
 #include "internal.h"
 #include "memory.h"
@@ -516,6 +517,14 @@ int regexp_c_locale(char **u, size_t *len) {
 }
 #endif
 
+unsigned long long metrics_clock(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 #if ENABLE_DEBUG
 bool debugging(const char *category) {
     const char *debug = getenv("AUGEAS_DEBUG");
@@ -103,6 +103,10 @@
  * Enable or disable node indexes */
 #define AUGEAS_SPAN_OPTION AUGEAS_META_TREE "/span"
 
+/* Define: AUGEAS_META_METRICS
+ * Timers for the phases of processing, see aug_metrics */
+#define AUGEAS_META_METRICS AUGEAS_META_TREE "/metrics"
+
 /* Define: AUGEAS_LENS_ENV
  * Name of env var that contains list of paths to search for additional
    spec files */
@@ -365,8 +369,17 @@ struct augeas {
                                      glibc argz vector */
     struct pathx_symtab *symtab;
     struct error        *error;
+    struct regexp_table *regexps; /* Regexp literals shared between modules */
+    struct seq_table    *seqs;    /* Slots for seq and counter names */
+    struct frozen       *frozen;  /* Everything pinned because of
+                                     AUG_FREEZE_MODULES */
     uint                api_entries;  /* Number of entries through a public
                                        * API, 0 when called from outside */
+    uint                sessions;     /* Nesting of aug_session_begin */
+    struct hash_t      *asts;         /* Parses kept by lns_get for
+                                       * AUG_KEEP_PARSE, by tree path */
+    struct aug_metrics  metrics;      /* Timers reported by aug_metrics */
+    uint                module_depth; /* Nesting of load_module_file */
 #if HAVE_USELOCALE
     /* On systems that have a uselocale call, we switch to the C locale
      * on entry into API functions, and back to the old user locale
@@ -386,10 +399,54 @@ static inline struct error *err_of_aug(const struct augeas *aug) {
 /* Used by augparse for loading tests */
 int __aug_load_module_file(struct augeas *aug, const char *filename);
 
+/* Used by augparse --watch: drop modules whose source changed, and check
+ * whether the module in FILENAME is still loaded */
+int __aug_refresh_modules(struct augeas *aug);
+int __aug_has_module_file(struct augeas *aug, const char *filename);
+
+/* Used by augparse --jobs: compile the modules that several of FILES use
+ * before forking the workers that load FILES */
+int __aug_preload_modules(struct augeas *aug, char **files, int nfiles);
+
+/* Used by augmatch: evaluate EXPR relative to the context and call VISIT
+ * for each match, in document order, with LEVEL 0 and PREFIX the path of
+ * the match relative to the context. Unless EXACT, VISIT is then called
+ * for every visible node below the match, with LEVEL its depth below the
+ * match. LABEL, INDEX and VALUE are what aug_ns_label and aug_ns_value
+ * report for the node. Matches that are not below the context are
+ * skipped. Return the number of matches visited, or -1 on error */
+typedef void (*__aug_walk_fn)(void *data, const char *prefix, int level,
+                              const char *label, int index,
+                              const char *value);
+int __aug_walk_matches(struct augeas *aug, const char *expr, bool exact,
+                       __aug_walk_fn visit, void *data);
+
 /* Called at beginning and end of every _public_ API function */
 void api_entry(const struct augeas *aug);
 void api_exit(const struct augeas *aug);
 
+/* The current time of a monotonic clock in nanoseconds, for the timers in
+ * struct aug_metrics */
+unsigned long long metrics_clock(void);
+
+/* Add one run of NS nanoseconds to TIMER, a field of struct aug_metrics,
+ * in AUG; AUG may be NULL, in which case nothing is recorded */
+#define METRICS_ADD(aug, timer, ns)                                     \
+    do {                                                                \
+        const struct augeas *aug_ = (aug);                              \
+        if (aug_ != NULL) {                                             \
+            unsigned long long ns_ = (ns);                              \
+            struct aug_timer *timer_ =                                  \
+                &((struct augeas *) aug_)->metrics.timer;               \
+            timer_->count += 1;                                         \
+            timer_->nsec += ns_;                                        \
+        }                                                               \
+    } while (0)
+
+/* Add one run of TIMER that began at START, a value of metrics_clock */
+#define METRICS_STOP(aug, timer, start)                                 \
+    METRICS_ADD(aug, timer, metrics_clock() - (start))
+
 /* Struct: tree
  * An entry in the global config tree. The data structure allows associating
  * values with interior nodes, but the API currently marks that as an error.
@@ -410,7 +467,14 @@ void api_exit(const struct augeas *aug);
  * underneath /files for the toplevel node corresponding to a file by
  * TREE_FREPLACE and is used by AUG_SOURCE to find the file to which a node
  * belongs.
+ *
+ * The LABEL and VALUE of a node loaded with AUG_SHARE_TEXT may point into
+ * TEXT, a buffer shared by all the nodes of a file, rather than being
+ * allocated on their own. Such strings must never be freed or changed in
+ * place; TREE_FREE_STR and TREE_OWN_VALUE take care of that.
  */
+struct tree_text;
+
 struct tree {
     struct tree *next;
     struct tree *parent;     /* Points to self for root */
@@ -418,12 +482,20 @@ struct tree {
     struct tree *children;   /* List of children through NEXT */
     char        *value;
     struct span *span;
+    struct tree *last;       /* Last child, NULL if not known */
+    unsigned int nlast;      /* Number of children with the same label as
+                                LAST, 0 if not known */
+    struct tree_text *text;  /* Buffer LABEL or VALUE point into, or
+                                NULL if they own their strings */
 
     /* Flags */
     bool         dirty;
     bool         file;
     bool         added;      /* only used by ns_add and tree_rm to dedupe
                                 nodesets */
+    bool         lazy;       /* a file under /files that aug_load with
+                                AUG_LAZY_LOAD registered, but whose
+                                contents have not been loaded yet */
 };
 
 /* The opaque structure used to represent path expressions. API's
@@ -451,6 +523,20 @@ struct tree  *make_tree_origin(struct tree *root);
 /* Make a new tree node and append it to parent's children */
 struct tree *tree_append(struct tree *parent, char *label, char *value);
 
+/* Append the single node CHILD to PARENT's children. Appending is O(1)
+ * as long as PARENT's children are only ever changed by appending */
+void tree_append_child(struct tree *parent, struct tree *child);
+
+/* Return the last child of PARENT, or NULL if it has no children. If
+ * COUNT is not NULL, set it to the number of children of PARENT with
+ * the same label as the last child. Both are remembered in PARENT */
+struct tree *tree_last_child(struct tree *parent, unsigned int *count);
+
+/* Forget what we remember about the children of TREE; needs to be called
+ * whenever its list of children or their labels are changed other than
+ * through TREE_APPEND_CHILD */
+void tree_children_changed(struct tree *tree);
+
 int tree_rm(struct pathx *p);
 int tree_unlink(struct augeas *aug, struct tree *tree);
 struct tree *tree_set(struct pathx *p, const char *value);
@@ -473,6 +559,38 @@ struct tree *tree_child_cr(struct tree *tree, const char *label);
 /* Create a path in the tree; nodes along the path are looked up with
  * tree_child_cr */
 struct tree *tree_path_cr(struct tree *tree, int n, ...);
+/* Load the contents of TREE if it is a file that has not been loaded yet
+ * because of AUG_LAZY_LOAD. This must be done before looking at the
+ * children of TREE */
+void tree_load_lazy(const struct augeas *aug, struct tree *tree);
+/* Like tree_load_lazy, but also load all such files underneath TREE; use
+ * this before working with the whole subtree of TREE */
+void tree_load_lazy_all(const struct augeas *aug, struct tree *tree);
+/* A TREE_TEXT is an immutable buffer holding the text of many labels and
+ * values, each terminated by a NUL, that tree nodes point into instead of
+ * allocating every string separately. It is reference counted, and every
+ * node that points into it holds a reference */
+
+/* Make a buffer with room for SIZE bytes of strings and their NULs; the
+ * caller owns the one reference to it */
+struct tree_text *make_tree_text(size_t size);
+/* Drop the caller's reference to TEXT */
+void tree_text_release(struct tree_text *text);
+/* Copy the LEN bytes at S into TEXT and return the NUL-terminated copy,
+ * or NULL if TEXT has no room left for it */
+char *tree_text_add(struct tree_text *text, const char *s, size_t len);
+/* Return true if S points into TEXT */
+bool tree_text_has(const struct tree_text *text, const char *s);
+/* Make TREE hold a reference to TEXT if its label or value point into it */
+void tree_share_text(struct tree *tree, struct tree_text *text);
+/* Free S, the old label or value of TREE, unless it points into TREE's
+ * shared text */
+void tree_free_str(struct tree *tree, char *s);
+/* Replace the value of TREE with its own copy if it points into TREE's
+ * shared text, so that it can be changed in place or handed to another
+ * node. Return -1 if allocation fails, 0 otherwise */
+int tree_own_value(struct tree *tree);
+
 /* Store VALUE directly as the value of TREE and set VALUE to NULL.
  * Update dirty flags */
 void tree_store_value(struct tree *tree, char **value);
@@ -589,6 +707,16 @@ struct pathx *pathx_aug_parse(const struct augeas *aug,
                               struct tree *root_ctx,
                               const char *path, bool need_nodeset);
 
+/* Parse a PATH that was passed in through the public API. Relative paths
+ * are rooted at the node in AUGEAS_CONTEXT, but that node is only looked
+ * up when PATH actually contains a relative path.
+ *
+ * Return the resulting path expression, or NULL on error. If an error
+ * occurs, the error struct in AUG contains details.
+ */
+struct pathx *pathx_aug_parse_ctx(const struct augeas *aug,
+                                  const char *path, bool need_nodeset);
+
 /* Parse the string PATH into a path expression PX that will be evaluated
  * against the tree ORIGIN.
  *
@@ -606,12 +734,24 @@ int pathx_parse(const struct tree *origin,
                 struct pathx **px);
 /* Return the error struct that was passed into pathx_parse */
 struct error *err_of_pathx(struct pathx *px);
+/* Return the augeas instance for PX, or NULL if it has none */
+const struct augeas *aug_of_pathx(struct pathx *px);
 struct tree *pathx_first(struct pathx *path);
 struct tree *pathx_next(struct pathx *path);
 /* Return -1 if evaluating PATH runs into trouble, otherwise return the
  * number of nodes matching PATH and set MATCH to the first matching
  * node */
 int pathx_find_one(struct pathx *path, struct tree **match);
+/* Return true if PATH contains a relative location path outside of any
+ * predicate, so that its value depends on the root context */
+bool pathx_uses_root_ctx(struct pathx *path);
+/* Change the root context of PATH; only valid before PATH is evaluated */
+void pathx_set_root_ctx(struct pathx *path, struct tree *root_ctx);
+/* Evaluate PATH against ORIGIN from now on, without parsing it again. The
+ * results of evaluating PATH so far, including nodes returned by
+ * PATH_FIRST and PATH_NEXT, are discarded. PATH must not have run into
+ * an error */
+void pathx_rebind(struct pathx *path, struct tree *origin);
 int pathx_expand_tree(struct pathx *path, struct tree **tree);
 void free_pathx(struct pathx *path);
 
@@ -22,6 +22,8 @@
 
 #include <config.h>
 
+#define MEM_SUBSYS MEM_JMT
+
 #include "jmt.h"
 #include "internal.h"
 #include "memory.h"
@@ -81,7 +83,8 @@ static int array_add(struct array *arr, ind_t *ind) {
         ind_t expand = arr->size;
         if (expand < 8)
             expand = 8;
-        r = mem_realloc_n(&(arr->data), arr->elem_size, arr->size + expand);
+        r = mem_realloc_n(&(arr->data), arr->elem_size, arr->size + expand,
+                          MEM_SUBSYS);
         if (r < 0)
             return -1;
         memset((char *) arr->data + arr->elem_size*arr->size, 0,
@@ -135,7 +138,7 @@ static int array_join(struct array *dst, struct array *src) {
         return -1;
 
     r = mem_realloc_n(&(dst->data), dst->elem_size,
-                      dst->used + src->used);
+                      dst->used + src->used, MEM_SUBSYS);
     if (r < 0)
         return -1;
 
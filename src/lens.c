@@ -21,12 +21,16 @@
  */
 
 #include <config.h>
+
+#define MEM_SUBSYS MEM_INTERP
+
 #include <stddef.h>
 
 #include "lens.h"
 #include "memory.h"
 #include "errcode.h"
 #include "internal.h"
+#include "hash.h"
 
 /* This enum must be kept in sync with type_offs and ntypes */
 enum lens_type {
@@ -143,8 +147,30 @@ static struct value *str_to_fa(struct info *info, const char *pattern,
     goto done;
 }
 
-static struct value *regexp_to_fa(struct regexp *regexp, struct fa **fa) {
-    return str_to_fa(regexp->info, regexp->pattern->str, fa, regexp->nocase);
+/* Like STR_TO_FA, but for REGEXP; the automaton is only constructed once
+ * and kept in REGEXP->FA, and *FA is a copy of it. Frozen regexps are not
+ * written to, and *FA is constructed afresh for them every time. Errors
+ * are reported against INFO, the place where REGEXP is used, since REGEXP
+ * may be shared between several places */
+static struct value *regexp_to_fa(struct info *info, struct regexp *regexp,
+                                  struct fa **fa) {
+    struct value *exn;
+
+    *fa = NULL;
+    if (regexp->fa == NULL) {
+        if (ref_pinned(regexp))
+            return str_to_fa(info, regexp->pattern->str, fa,
+                             regexp->nocase);
+        exn = str_to_fa(info, regexp->pattern->str, &regexp->fa,
+                        regexp->nocase);
+        if (exn != NULL)
+            return exn;
+    }
+    *fa = fa_clone(regexp->fa);
+    ERR_NOMEM(*fa == NULL, info);
+    return NULL;
+ error:
+    return info->error->exn;
 }
 
 static struct lens *make_lens(enum lens_tag tag, struct info *info) {
@@ -498,6 +524,7 @@ struct value * lns_make_square(struct info *info, struct lens *l1,
         ltype(sqr, t) = ref(ltype(cnt2->lens, t));
 
     square_precise_type(info, &(sqr->ctype), l1->ctype, l2->ctype);
+    sqr->square_nocase = l1->ctype->nocase || l3->ctype->nocase;
 
     sqr->recursive = cnt2->lens->recursive;
     sqr->rec_internal = cnt2->lens->rec_internal;
@@ -576,7 +603,7 @@ typecheck_prim(enum lens_tag tag, struct info *info,
         if (exn != NULL)
             goto error;
 
-        exn = regexp_to_fa(regexp, &fa_key);
+        exn = regexp_to_fa(info, regexp, &fa_key);
         if (exn != NULL)
             goto error;
 
@@ -618,6 +645,69 @@ typecheck_prim(enum lens_tag tag, struct info *info,
     return exn;
 }
 
+/*
+ * Slots for seq and counter names
+ */
+struct seq_table {
+    hash_t *slots;    /* Keyed by name, the value is the slot plus 1 */
+};
+
+struct seq_table *make_seq_table(void) {
+    struct seq_table *table;
+
+    if (ALLOC(table) < 0)
+        return NULL;
+    table->slots = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
+    if (table->slots == NULL) {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+void free_seq_table(struct seq_table *table) {
+    hscan_t scan;
+    hnode_t *node;
+
+    if (table == NULL)
+        return;
+    hash_scan_begin(&scan, table->slots);
+    while ((node = hash_scan_next(&scan)) != NULL)
+        free((char *) hnode_getkey(node));
+    hash_free_nodes(table->slots);
+    hash_destroy(table->slots);
+    free(table);
+}
+
+unsigned int seq_table_size(const struct seq_table *table) {
+    return hash_count(table->slots);
+}
+
+/* Set *SLOT to the slot for NAME in TABLE, adding NAME if it is not there
+ * yet. Return -1 if allocation fails, 0 otherwise */
+static int seq_table_slot(struct seq_table *table, const char *name,
+                          unsigned int *slot) {
+    hnode_t *node = hash_lookup(table->slots, name);
+    char *key = NULL;
+    uintptr_t next;
+
+    if (node != NULL) {
+        *slot = (uintptr_t) hnode_get(node) - 1;
+        return 0;
+    }
+
+    next = hash_count(table->slots) + 1;
+    key = strdup(name);
+    if (key == NULL)
+        return -1;
+    if (hash_alloc_insert(table->slots, key, (void *) next) < 0) {
+        free(key);
+        return -1;
+    }
+    *slot = next - 1;
+    return 0;
+}
+
 struct value *lns_make_prim(enum lens_tag tag, struct info *info,
                             struct regexp *regexp, struct string *string) {
     struct lens *lens = NULL;
@@ -637,6 +727,11 @@ struct value *lns_make_prim(enum lens_tag tag, struct info *info,
     lens->value = (tag == L_STORE || tag == L_VALUE);
     lens->consumes_value = (tag == L_STORE || tag == L_VALUE);
     lens->atype = regexp_make_empty(info);
+    if (tag == L_SEQ || tag == L_COUNTER) {
+        if (seq_table_slot(info->error->aug->seqs, string->str,
+                           &lens->seq_slot) < 0)
+            goto error;
+    }
     /* Set the ctype */
     if (tag == L_DEL || tag == L_STORE || tag == L_KEY) {
         lens->ctype = ref(regexp);
@@ -693,11 +788,11 @@ static struct value *disjoint_check(struct info *info, bool is_get,
     if (r1 == NULL || r2 == NULL)
         return NULL;
 
-    exn = regexp_to_fa(r1, &fa1);
+    exn = regexp_to_fa(info, r1, &fa1);
     if (exn != NULL)
         goto done;
 
-    exn = regexp_to_fa(r2, &fa2);
+    exn = regexp_to_fa(info, r2, &fa2);
     if (exn != NULL)
         goto done;
 
@@ -827,11 +922,11 @@ ambig_concat_check(struct info *info, const char *msg,
     if (r1 == NULL || r2 == NULL)
         return NULL;
 
-    result = regexp_to_fa(r1, &fa1);
+    result = regexp_to_fa(info, r1, &fa1);
     if (result != NULL)
         goto done;
 
-    result = regexp_to_fa(r2, &fa2);
+    result = regexp_to_fa(info, r2, &fa2);
     if (result != NULL)
         goto done;
 
@@ -890,11 +985,11 @@ static struct value *typecheck_square(struct info *info, struct lens *l1,
     if (r1 == NULL || r2 == NULL)
         return NULL;
 
-    exn = regexp_to_fa(r1, &fa1);
+    exn = regexp_to_fa(info, r1, &fa1);
     if (exn != NULL)
         goto done;
 
-    exn = regexp_to_fa(r2, &fa2);
+    exn = regexp_to_fa(info, r2, &fa2);
     if (exn != NULL)
         goto done;
 
@@ -941,7 +1036,7 @@ ambig_iter_check(struct info *info, const char *msg,
     if (r == NULL)
         return NULL;
 
-    result = regexp_to_fa(r, &fa);
+    result = regexp_to_fa(info, r, &fa);
     if (result != NULL)
         goto done;
 
@@ -1028,6 +1123,7 @@ void free_lens(struct lens *lens) {
         for (int i=0; i < lens->nchildren; i++)
             unref(lens->children[i], lens);
         free(lens->children);
+        free(lens->concat_regs);
         break;
     case L_REC:
         if (!lens->rec_internal) {
@@ -1050,7 +1146,7 @@ void free_lens(struct lens *lens) {
 }
 
 void lens_release(struct lens *lens) {
-    if (lens == NULL)
+    if (lens == NULL || ref_pinned(lens))
         return;
 
     for (int t=0; t < ntypes; t++)
@@ -1078,6 +1174,275 @@ void lens_release(struct lens *lens) {
     lens->jmt = NULL;
 }
 
+const unsigned int *lens_concat_regs(struct lens *lens) {
+    unsigned int *regs = NULL;
+    unsigned int reg = 1;
+
+    if (lens->concat_regs != NULL)
+        return lens->concat_regs;
+
+    if (ALLOC_N(regs, lens->nchildren) < 0)
+        return NULL;
+    for (int i=0; i < lens->nchildren; i++) {
+        int nsub = regexp_nsub(lens->children[i]->atype);
+        if (nsub < 0) {
+            free(regs);
+            return NULL;
+        }
+        regs[i] = reg;
+        reg += 1 + nsub;
+    }
+    lens->concat_regs = regs;
+    return regs;
+}
+
+unsigned int lens_square_reg(struct lens *lens) {
+    if (lens->square_reg == 0) {
+        struct lens *concat = lens->child;
+        unsigned int reg = 1;
+
+        for (int i = 0; i < concat->nchildren - 1; i++)
+            reg += 1 + regexp_nsub(concat->children[i]->ctype);
+        lens->square_reg = reg;
+    }
+    return lens->square_reg;
+}
+
+/*
+ * Freezing
+ */
+enum frozen_tag {
+    FROZEN_STRING, FROZEN_INFO, FROZEN_REGEXP, FROZEN_LENS, FROZEN_VALUE
+};
+
+struct frozen {
+    size_t size;
+    size_t used;
+    struct frozen_obj {
+        enum frozen_tag  tag;
+        void            *obj;
+    } *objs;
+};
+
+static int frozen_add(struct frozen **frozen, enum frozen_tag tag,
+                      void *obj) {
+    struct frozen *f = *frozen;
+
+    if (f == NULL) {
+        if (ALLOC(f) < 0)
+            return -1;
+        *frozen = f;
+    }
+    if (f->used == f->size) {
+        size_t size = (f->size == 0) ? 256 : 2 * f->size;
+        if (REALLOC_N(f->objs, size) < 0)
+            return -1;
+        f->size = size;
+    }
+    f->objs[f->used].tag = tag;
+    f->objs[f->used].obj = obj;
+    f->used += 1;
+    return 0;
+}
+
+/* The reference count of any of the structs we freeze, so that REF_PINNED
+ * and REF_PIN can work on it without knowing the struct */
+struct refcount {
+    ref_t ref;
+};
+
+/* Record and pin OBJ, a struct of the kind TAG says. Return 1 if OBJ is
+ * NULL or pinned already, in which case everything reachable from it is
+ * pinned, too; 0 if it was pinned now and the caller still needs to
+ * freeze what it points to; and -1 if we ran out of memory */
+static int frozen_pin(struct frozen **frozen, enum frozen_tag tag,
+                      void *obj) {
+    struct refcount *rc;
+
+    if (obj == NULL)
+        return 1;
+    switch (tag) {
+    case FROZEN_STRING:
+        rc = (struct refcount *) &((struct string *) obj)->ref;
+        break;
+    case FROZEN_INFO:
+        rc = (struct refcount *) &((struct info *) obj)->ref;
+        break;
+    case FROZEN_REGEXP:
+        rc = (struct refcount *) &((struct regexp *) obj)->ref;
+        break;
+    case FROZEN_LENS:
+        rc = (struct refcount *) &((struct lens *) obj)->ref;
+        break;
+    case FROZEN_VALUE:
+        rc = (struct refcount *) &((struct value *) obj)->ref;
+        break;
+    default:
+        assert(0);
+        return -1;
+    }
+    if (ref_pinned(rc))
+        return 1;
+    if (frozen_add(frozen, tag, obj) < 0)
+        return -1;
+    ref_pin(rc);
+    return 0;
+}
+
+static int freeze_string(struct frozen **frozen, struct string *string) {
+    int r = frozen_pin(frozen, FROZEN_STRING, string);
+    return r < 0 ? -1 : 0;
+}
+
+static int freeze_info(struct frozen **frozen, struct info *info) {
+    int r = frozen_pin(frozen, FROZEN_INFO, info);
+    if (r != 0)
+        return r < 0 ? -1 : 0;
+    return freeze_string(frozen, info->filename);
+}
+
+static int freeze_regexp(struct frozen **frozen, struct regexp *regexp) {
+    int r = frozen_pin(frozen, FROZEN_REGEXP, regexp);
+    if (r != 0)
+        return r < 0 ? -1 : 0;
+    if (regexp_compile(regexp) < 0)
+        return -1;
+    if (freeze_info(frozen, regexp->info) < 0)
+        return -1;
+    return freeze_string(frozen, regexp->pattern);
+}
+
+static int freeze_lens(struct frozen **frozen, struct lens *lens) {
+    int r = frozen_pin(frozen, FROZEN_LENS, lens);
+    if (r != 0)
+        return r < 0 ? -1 : 0;
+
+    if (freeze_info(frozen, lens->info) < 0)
+        return -1;
+    for (int t=0; t < ntypes; t++)
+        if (freeze_regexp(frozen, ltype(lens, t)) < 0)
+            return -1;
+
+    switch (lens->tag) {
+    case L_DEL:
+        if (freeze_string(frozen, lens->string) < 0)
+            return -1;
+        return freeze_regexp(frozen, lens->regexp);
+    case L_STORE:
+    case L_KEY:
+        return freeze_regexp(frozen, lens->regexp);
+    case L_LABEL:
+    case L_SEQ:
+    case L_COUNTER:
+    case L_VALUE:
+        return freeze_string(frozen, lens->string);
+    case L_SQUARE:
+        if (freeze_lens(frozen, lens->child) < 0)
+            return -1;
+        /* Inside recursive lenses, which have no ctype, squares are
+         * checked without it */
+        if (lens->ctype != NULL)
+            lens_square_reg(lens);
+        return 0;
+    case L_SUBTREE:
+    case L_STAR:
+    case L_MAYBE:
+        return freeze_lens(frozen, lens->child);
+    case L_CONCAT:
+    case L_UNION:
+        for (int i=0; i < lens->nchildren; i++)
+            if (freeze_lens(frozen, lens->children[i]) < 0)
+                return -1;
+        if (lens->tag == L_CONCAT && lens_concat_regs(lens) == NULL)
+            return -1;
+        return 0;
+    case L_REC:
+        if (freeze_lens(frozen, lens->body) < 0)
+            return -1;
+        if (freeze_lens(frozen, lens->alias) < 0)
+            return -1;
+        /* Only the lens used from the outside is ever parsed with */
+        if (! lens->rec_internal && lens->jmt == NULL) {
+            lens->jmt = jmt_build(lens);
+            if (lens->jmt == NULL)
+                return -1;
+        }
+        return 0;
+    default:
+        BUG_LENS_TAG(lens);
+        return -1;
+    }
+}
+
+int freeze_value(struct frozen **frozen, struct value *v) {
+    int r;
+
+    if (v == NULL || ref_pinned(v))
+        return 0;
+    if (v->tag != V_STRING && v->tag != V_REGEXP && v->tag != V_LENS)
+        return 0;
+
+    r = frozen_pin(frozen, FROZEN_VALUE, v);
+    if (r != 0)
+        return r < 0 ? -1 : 0;
+    if (freeze_info(frozen, v->info) < 0)
+        return -1;
+    switch (v->tag) {
+    case V_STRING:
+        return freeze_string(frozen, v->string);
+    case V_REGEXP:
+        return freeze_regexp(frozen, v->regexp);
+    case V_LENS:
+        return freeze_lens(frozen, v->lens);
+    default:
+        assert(0);
+        return -1;
+    }
+}
+
+/* Frozen structs refer to each other freely, and some may already be gone
+ * when we get to another one; free each of them without looking at what
+ * it points to */
+void free_frozen(struct frozen *frozen) {
+    if (frozen == NULL)
+        return;
+
+    for (size_t i=0; i < frozen->used; i++) {
+        void *obj = frozen->objs[i].obj;
+        switch (frozen->objs[i].tag) {
+        case FROZEN_STRING:
+            free(((struct string *) obj)->str);
+            break;
+        case FROZEN_REGEXP: {
+            struct regexp *regexp = obj;
+            if (regexp->re != NULL) {
+                regfree(regexp->re);
+                free(regexp->re);
+            }
+            fa_free(regexp->fa);
+            break;
+        }
+        case FROZEN_LENS: {
+            struct lens *lens = obj;
+            if (lens->tag == L_CONCAT || lens->tag == L_UNION) {
+                free(lens->children);
+                free(lens->concat_regs);
+            }
+            jmt_free(lens->jmt);
+            break;
+        }
+        case FROZEN_INFO:
+        case FROZEN_VALUE:
+            break;
+        default:
+            assert(0);
+        }
+        free(obj);
+    }
+    free(frozen->objs);
+    free(frozen);
+}
+
 /*
  * Encoding of tree levels
  */
@@ -87,17 +87,30 @@ struct lens {
     /* Whether we are inside a recursive lens or outside */
     unsigned int              rec_internal : 1;
     unsigned int              ctype_nullable : 1;
+    /* L_SQUARE: whether the left and right keys are compared ignoring
+     * case, because either of them is nocase */
+    unsigned int              square_nocase : 1;
+    /* L_SQUARE: the register that holds the match for the right key when
+     * matching the ctype of CHILD; see lens_square_reg */
+    unsigned int              square_reg;
     union {
         /* Primitive lenses */
         struct {                   /* L_DEL uses both */
             struct regexp *regexp; /* L_STORE, L_KEY */
             struct string *string; /* L_VALUE, L_LABEL, L_SEQ, L_COUNTER */
+            /* L_SEQ, L_COUNTER: the slot for STRING in the handle's
+             * seq_table, shared by all seq and counter lenses with the
+             * same name */
+            unsigned int seq_slot;
         };
         /* Combinators */
         struct lens *child;         /* L_SUBTREE, L_STAR, L_MAYBE, L_SQUARE */
         struct {                    /* L_UNION, L_CONCAT */
             unsigned int nchildren;
             struct lens **children;
+            /* L_CONCAT: the register that holds the match for each child
+             * when matching ATYPE; see lens_concat_regs */
+            unsigned int *concat_regs;
         };
         struct {
             struct lens *body;      /* L_REC */
@@ -144,6 +157,18 @@ struct value *lns_make_square(struct info *, struct lens *, struct lens *,
                               struct lens *lens, int check);
 
 
+/* A table assigning each name used by a seq or counter lens a small
+ * integer slot, so that get can keep the current value of each sequence
+ * in an array instead of looking it up by name. There is one table per
+ * handle, and lns_make_prim adds names to it as it builds lenses */
+struct seq_table;
+
+struct seq_table *make_seq_table(void);
+void free_seq_table(struct seq_table *table);
+
+/* The number of slots handed out from TABLE so far */
+unsigned int seq_table_size(const struct seq_table *table);
+
 /* Pretty-print a lens */
 char *format_lens(struct lens *l);
 
@@ -185,21 +210,39 @@ void free_skel(struct skel *skel);
 void free_dict(struct dict *dict);
 void free_lns_error(struct lns_error *err);
 
+/* The parse of a text with a recursive lens that lns_get can keep, so
+ * that lns_parse for the same text and lens does not need to run the
+ * Earley parser again */
+struct lns_ast;
+void free_lns_ast(struct lns_ast *ast);
+
 /* Parse text TEXT with LENS. INFO indicates where TEXT was read from.
  *
  * If ERR is non-NULL, *ERR is set to NULL on success, and to an error
  * message on failure; the constructed tree is always returned. If ERR is
  * NULL, return the tree on success, and NULL on failure.
  *
+ * If AST is non-NULL and LENS is recursive, *AST is set to the parse of
+ * TEXT on success, and to NULL otherwise.
+ *
  * ENABLE_SPAN indicates whether span information should be collected or not
+ *
+ * If SHARE_TEXT is true, the labels and values of the tree are copied
+ * into one buffer shared by all its nodes, rather than allocated one by
+ * one; see struct tree_text
  */
 struct tree *lns_get(struct info *info, struct lens *lens, const char *text,
-                     int enable_span, struct lns_error **err);
+                     int enable_span, int share_text, struct lns_ast **ast,
+                     struct lns_error **err);
+/* Build the skeleton and dictionary for TEXT. AST, which may be NULL, is
+ * used instead of parsing TEXT again if lns_get kept it for the same LENS
+ * and TEXT */
 struct skel *lns_parse(struct lens *lens, const char *text,
-                       struct dict **dict, struct lns_error **err);
+                       struct lns_ast *ast, struct dict **dict,
+                       struct lns_error **err);
 
 /* Write tree TREE that was initially read from TEXT (but might have been
- * modified) into file OUT using LENS.
+ * modified) into file OUT using LENS. AST is passed to lns_parse.
  *
  * If ERR is non-NULL, *ERR is set to NULL on success, and to an error
  * message on failure.
@@ -208,13 +251,55 @@ struct skel *lns_parse(struct lens *lens, const char *text,
  * to update spans or not.
  */
 void lns_put(struct info *info, FILE *out, struct lens *lens, struct tree *tree,
-             const char *text, int enable_span, struct lns_error **err);
+             const char *text, struct lns_ast *ast, int enable_span,
+             struct lns_error **err);
+
+/* Like LNS_PUT, but compare the output against TEXT while it is being
+ * produced, and only start writing to OUT at the first difference.
+ *
+ * Return 0 if the output is identical to TEXT, in which case nothing has
+ * been written to OUT, and 1 if it differs from TEXT.
+ */
+int lns_put_changed(struct info *info, FILE *out, struct lens *lens,
+                    struct tree *tree, const char *text,
+                    struct lns_ast *ast, int enable_span,
+                    struct lns_error **err);
 
 /* Free up temporary data structures, most importantly compiled
-   regular expressions */
+   regular expressions. Does nothing for frozen lenses */
 void lens_release(struct lens *lens);
 void free_lens(struct lens *lens);
 
+/* Return the register in a match against the atype of the L_CONCAT LENS
+ * that holds the match for each of its children, or NULL if they can not
+ * be computed. The registers are computed once and kept in LENS */
+const unsigned int *lens_concat_regs(struct lens *lens);
+
+/* Return the register for the right key of the L_SQUARE LENS after
+ * matching the ctype of its child; the left key is always in register 1.
+ * The register is computed once and kept in LENS */
+unsigned int lens_square_reg(struct lens *lens);
+
+/* Freezing makes a value and everything reachable from it (lenses,
+ * regexps, strings and infos) immortal with REF_PIN, so that using them
+ * causes no reference count traffic, and keeps LENS_RELEASE from freeing
+ * what has been compiled. Everything that gets pinned is recorded in
+ * *FROZEN, which is allocated on first use, and freed all at once by
+ * FREE_FROZEN, no matter who still refers to it.
+ *
+ * Whatever get and put would otherwise compute lazily and store in a
+ * lens or regexp (compiled regexps, registers of concat and square
+ * lenses, the parser of recursive lenses) is computed while freezing, so
+ * that frozen structs are never written to afterwards. Automata for
+ * frozen regexps are not cached at all.
+ *
+ * Only values holding a string, regexp or lens are frozen; others are
+ * left alone. Return -1 on failure, 0 otherwise.
+ */
+struct frozen;
+int freeze_value(struct frozen **frozen, struct value *v);
+void free_frozen(struct frozen *frozen);
+
 /*
  * Encoding of tree levels into strings
  */
@@ -42,12 +42,65 @@
 # define xalloc_oversized(n, s) \
     ((size_t) (sizeof (ptrdiff_t) <= sizeof (size_t) ? -1 : -2) / (s) < (n))
 
+static void *(*mem_calloc)(size_t nmemb, size_t size) = calloc;
+static void *(*mem_realloc)(void *ptr, size_t size) = realloc;
+
+static const char *const mem_subsys_names[] = {
+    "other", "tree", "pathx", "get", "put", "fa", "jmt", "interpreter"
+};
+
+#if ENABLE_ALLOC_STATS
+static struct {
+    size_t count;
+    size_t bytes;
+} mem_counters[MEM_NSUBSYS];
+#endif
+
+/* The counters are shared by all threads in the process, even those that
+ * each use their own handle, and so must be changed atomically */
+#if ENABLE_ALLOC_STATS
+# define mem_count(subsys, nbytes)                                      \
+    do {                                                                \
+        __atomic_fetch_add(&mem_counters[subsys].count, 1,              \
+                           __ATOMIC_RELAXED);                           \
+        __atomic_fetch_add(&mem_counters[subsys].bytes, (nbytes),       \
+                           __ATOMIC_RELAXED);                           \
+    } while (0)
+#else
+# define mem_count(subsys, nbytes) do { } while (0)
+#endif
+
+void mem_set_allocator(void *(*calloc_fn)(size_t nmemb, size_t size),
+                       void *(*realloc_fn)(void *ptr, size_t size)) {
+    mem_calloc = (calloc_fn == NULL) ? calloc : calloc_fn;
+    mem_realloc = (realloc_fn == NULL) ? realloc : realloc_fn;
+}
+
+const char *mem_subsys_name(enum mem_subsys subsys) {
+    if ((unsigned int) subsys >= MEM_NSUBSYS)
+        return NULL;
+    return mem_subsys_names[subsys];
+}
+
+int mem_stats(enum mem_subsys subsys, size_t *count, size_t *bytes) {
+#if ENABLE_ALLOC_STATS
+    *count = __atomic_load_n(&mem_counters[subsys].count, __ATOMIC_RELAXED);
+    *bytes = __atomic_load_n(&mem_counters[subsys].bytes, __ATOMIC_RELAXED);
+    return 0;
+#else
+    *count = 0;
+    *bytes = 0;
+    return -1;
+#endif
+}
+
 
 /**
  * mem_alloc_n:
  * @ptrptr: pointer to pointer for address of allocated memory
  * @size: number of bytes to allocate
  * @count: number of elements to allocate
+ * @subsys: the subsystem to count the allocation against
  *
  * Allocate an array of memory 'count' elements long,
  * each with 'size' bytes. Return the address of the
@@ -56,14 +109,16 @@
  *
  * Returns -1 on failure to allocate, zero on success
  */
-int mem_alloc_n(void *ptrptr, size_t size, size_t count)
+int mem_alloc_n(void *ptrptr, size_t size, size_t count,
+                enum mem_subsys subsys)
 {
     if (AUGEAS_UNLIKELY(size == 0 || count == 0)) {
         *(void **)ptrptr = NULL;
         return 0;
     }
 
-    *(void**)ptrptr = calloc(count, size);
+    mem_count(subsys, size * count);
+    *(void**)ptrptr = mem_calloc(count, size);
     if (AUGEAS_UNLIKELY(*(void**)ptrptr == NULL))
         return -1;
     return 0;
@@ -74,6 +129,7 @@ int mem_alloc_n(void *ptrptr, size_t size, size_t count)
  * @ptrptr: pointer to pointer for address of allocated memory
  * @size: number of bytes to allocate
  * @count: number of elements in array
+ * @subsys: the subsystem to count the allocation against
  *
  * Resize the block of memory in 'ptrptr' to be an array of
  * 'count' elements, each 'size' bytes in length. Update 'ptrptr'
@@ -83,7 +139,8 @@ int mem_alloc_n(void *ptrptr, size_t size, size_t count)
  *
  * Returns -1 on failure to allocate, zero on success
  */
-int mem_realloc_n(void *ptrptr, size_t size, size_t count)
+int mem_realloc_n(void *ptrptr, size_t size, size_t count,
+                  enum mem_subsys subsys)
 {
     void *tmp;
     if (AUGEAS_UNLIKELY(size == 0 || count == 0)) {
@@ -95,7 +152,8 @@ int mem_realloc_n(void *ptrptr, size_t size, size_t count)
         errno = ENOMEM;
         return -1;
     }
-    tmp = realloc(*(void**)ptrptr, size * count);
+    mem_count(subsys, size * count);
+    tmp = mem_realloc(*(void**)ptrptr, size * count);
     if (AUGEAS_UNLIKELY(!tmp))
         return -1;
     *(void**)ptrptr = tmp;
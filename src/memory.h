@@ -24,10 +24,19 @@
 #define MEMORY_H_
 
 #include "internal.h"
+#include "memstat.h"
 
 /* Don't call these directly - use the macros below */
-int mem_alloc_n(void *ptrptr, size_t size, size_t count) ATTRIBUTE_RETURN_CHECK;
-int mem_realloc_n(void *ptrptr, size_t size, size_t count) ATTRIBUTE_RETURN_CHECK;
+int mem_alloc_n(void *ptrptr, size_t size, size_t count,
+                enum mem_subsys subsys) ATTRIBUTE_RETURN_CHECK;
+int mem_realloc_n(void *ptrptr, size_t size, size_t count,
+                  enum mem_subsys subsys) ATTRIBUTE_RETURN_CHECK;
+
+/* Use CALLOC_FN and REALLOC_FN instead of calloc(3) and realloc(3) for
+ * all allocations made through the macros below. Passing NULL restores
+ * the C library's function. Memory is still released with free(3) */
+void mem_set_allocator(void *(*calloc_fn)(size_t nmemb, size_t size),
+                       void *(*realloc_fn)(void *ptr, size_t size));
 
 
 /**
@@ -40,7 +49,7 @@ int mem_realloc_n(void *ptrptr, size_t size, size_t count) ATTRIBUTE_RETURN_CHEC
  *
  * Returns -1 on failure, 0 on success
  */
-#define ALLOC(ptr) mem_alloc_n(&(ptr), sizeof(*(ptr)), 1)
+#define ALLOC(ptr) mem_alloc_n(&(ptr), sizeof(*(ptr)), 1, MEM_SUBSYS)
 
 /**
  * ALLOC_N:
@@ -53,7 +62,8 @@ int mem_realloc_n(void *ptrptr, size_t size, size_t count) ATTRIBUTE_RETURN_CHEC
  *
  * Returns -1 on failure, 0 on success
  */
-#define ALLOC_N(ptr, count) mem_alloc_n(&(ptr), sizeof(*(ptr)), (count))
+#define ALLOC_N(ptr, count)                                     \
+    mem_alloc_n(&(ptr), sizeof(*(ptr)), (count), MEM_SUBSYS)
 
 /**
  * REALLOC_N:
@@ -66,7 +76,8 @@ int mem_realloc_n(void *ptrptr, size_t size, size_t count) ATTRIBUTE_RETURN_CHEC
  *
  * Returns -1 on failure, 0 on success
  */
-#define REALLOC_N(ptr, count) mem_realloc_n(&(ptr), sizeof(*(ptr)), (count))
+#define REALLOC_N(ptr, count)                                   \
+    mem_realloc_n(&(ptr), sizeof(*(ptr)), (count), MEM_SUBSYS)
 
 /**
  * FREE:
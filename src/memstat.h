@@ -0,0 +1,65 @@
+/*
+ * memstat.h: counting allocations by subsystem
+ *
+ * Copyright (C) 2026 The Augeas authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef MEMSTAT_H_
+#define MEMSTAT_H_
+
+#include <stddef.h>
+
+/* The parts of Augeas that allocations are counted against. A source file
+ * says which one it belongs to by defining MEM_SUBSYS before including
+ * this header, or any header that includes it */
+enum mem_subsys {
+    MEM_OTHER,
+    MEM_TREE,
+    MEM_PATHX,
+    MEM_GET,
+    MEM_PUT,
+    MEM_FA,
+    MEM_JMT,
+    MEM_INTERP,
+    MEM_NSUBSYS
+};
+
+#ifndef MEM_SUBSYS
+# define MEM_SUBSYS MEM_OTHER
+#endif
+
+/* Return the name of SUBSYS, or NULL if there is no such subsystem */
+const char *mem_subsys_name(enum mem_subsys subsys);
+
+/* Set *COUNT to the number of allocations made for SUBSYS, and *BYTES to
+ * the number of bytes they asked for; reallocations count as a new
+ * allocation of their new size. The counters are only kept when
+ * ENABLE_ALLOC_STATS is set; otherwise, both are always 0 and this
+ * returns -1 */
+int mem_stats(enum mem_subsys subsys, size_t *count, size_t *bytes);
+
+#endif
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
@@ -0,0 +1,219 @@
+/*
+ * oahash.c: hash tables with open addressing
+ *
+ * Copyright (C) 2026 The Augeas authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#define MEM_SUBSYS MEM_FA
+
+#include <stdint.h>
+#include <string.h>
+
+#include "oahash.h"
+#include "memory.h"
+
+/* Each slot holds the hash of its key, with 0 marking an empty slot, the
+ * value, and then the key itself */
+struct slot {
+    size_t  hash;
+    void   *value;
+    char    key[];
+};
+
+struct oahash {
+    size_t         key_size;
+    size_t         slot_size;
+    size_t         nslots;      /* Always a power of 2 */
+    unsigned int   shift;       /* 64 - log2(nslots) */
+    size_t         count;
+    oahash_hash_fn hash;
+    oahash_eq_fn   eq;
+    char          *slots;
+    char          *tmp;         /* Room for two slots used while inserting */
+};
+
+static const unsigned int initial_bits = 4;
+
+#define SLOT(table, buf, i) \
+    ((struct slot *) ((buf) + (i) * (table)->slot_size))
+
+/* Spread the bits of HASH before using its top bits as the index of the
+ * slot where the key belongs; the hashes libfa computes are sums of
+ * pointer hashes and not very random in their low bits */
+static size_t home(const struct oahash *table, size_t hash) {
+    return (size_t) (((uint64_t) hash * UINT64_C(0x9E3779B97F4A7C15))
+                     >> table->shift);
+}
+
+/* How far the entry in slot I is from where it belongs */
+static size_t distance(const struct oahash *table, size_t i,
+                       const struct slot *s) {
+    return (i - home(table, s->hash)) & (table->nslots - 1);
+}
+
+static size_t key_hash(const struct oahash *table, const void *key) {
+    size_t hash = table->hash(key);
+    return (hash == 0) ? 1 : hash;
+}
+
+static int key_eq(const struct oahash *table,
+                  const void *key1, const void *key2) {
+    if (table->eq == NULL)
+        return memcmp(key1, key2, table->key_size) == 0;
+    return table->eq(key1, key2);
+}
+
+struct oahash *oahash_create(size_t key_size, oahash_hash_fn hash,
+                             oahash_eq_fn eq) {
+    struct oahash *table = NULL;
+    size_t align = sizeof(void *);
+
+    if (ALLOC(table) < 0)
+        goto error;
+    table->key_size = key_size;
+    table->slot_size = (sizeof(struct slot) + key_size + align - 1)
+        & ~(align - 1);
+    table->nslots = 1 << initial_bits;
+    table->shift = 64 - initial_bits;
+    table->hash = hash;
+    table->eq = eq;
+    if (ALLOC_N(table->slots, table->nslots * table->slot_size) < 0)
+        goto error;
+    if (ALLOC_N(table->tmp, 2 * table->slot_size) < 0)
+        goto error;
+    return table;
+ error:
+    oahash_free(table);
+    return NULL;
+}
+
+void oahash_free(struct oahash *table) {
+    if (table == NULL)
+        return;
+    free(table->slots);
+    free(table->tmp);
+    free(table);
+}
+
+size_t oahash_count(const struct oahash *table) {
+    return table->count;
+}
+
+const void *oahash_lookup(const struct oahash *table, const void *key,
+                          void **value) {
+    size_t hash = key_hash(table, key);
+    size_t mask = table->nslots - 1;
+    size_t i = home(table, hash);
+
+    for (size_t d = 0;; d++, i = (i + 1) & mask) {
+        struct slot *s = SLOT(table, table->slots, i);
+        if (s->hash == 0 || distance(table, i, s) < d)
+            return NULL;
+        if (s->hash == hash && key_eq(table, s->key, key)) {
+            if (value != NULL)
+                *value = s->value;
+            return s->key;
+        }
+    }
+}
+
+/* Put the entry in CAND into SLOTS, moving entries that are closer to
+ * where they belong than CAND out of its way. Overwrites CAND */
+static void place(struct oahash *table, char *slots, struct slot *cand) {
+    size_t mask = table->nslots - 1;
+    size_t i = home(table, cand->hash);
+    struct slot *swap = SLOT(table, table->tmp, 1);
+
+    for (size_t d = 0;; d++, i = (i + 1) & mask) {
+        struct slot *s = SLOT(table, slots, i);
+        if (s->hash == 0) {
+            memcpy(s, cand, table->slot_size);
+            return;
+        }
+        size_t ds = distance(table, i, s);
+        if (ds < d) {
+            memcpy(swap, s, table->slot_size);
+            memcpy(s, cand, table->slot_size);
+            memcpy(cand, swap, table->slot_size);
+            d = ds;
+        }
+    }
+}
+
+static int grow(struct oahash *table) {
+    char *old = table->slots;
+    size_t old_nslots = table->nslots;
+    char *slots = NULL;
+
+    if (ALLOC_N(slots, 2 * old_nslots * table->slot_size) < 0)
+        return -1;
+    table->slots = slots;
+    table->nslots = 2 * old_nslots;
+    table->shift -= 1;
+
+    struct slot *cand = SLOT(table, table->tmp, 0);
+    for (size_t i = 0; i < old_nslots; i++) {
+        struct slot *s = SLOT(table, old, i);
+        if (s->hash != 0) {
+            memcpy(cand, s, table->slot_size);
+            place(table, slots, cand);
+        }
+    }
+    free(old);
+    return 0;
+}
+
+int oahash_insert(struct oahash *table, const void *key, void *value) {
+    /* Keep the table at most 3/4 full */
+    if (4 * (table->count + 1) > 3 * table->nslots) {
+        if (grow(table) < 0)
+            return -1;
+    }
+
+    struct slot *cand = SLOT(table, table->tmp, 0);
+    cand->hash = key_hash(table, key);
+    cand->value = value;
+    memcpy(cand->key, key, table->key_size);
+    place(table, table->slots, cand);
+    table->count += 1;
+    return 0;
+}
+
+int oahash_next(const struct oahash *table, size_t *pos,
+                const void **key, void **value) {
+    while (*pos < table->nslots) {
+        struct slot *s = SLOT(table, table->slots, *pos);
+        *pos += 1;
+        if (s->hash != 0) {
+            *key = s->key;
+            *value = s->value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
@@ -0,0 +1,78 @@
+/*
+ * oahash.h: hash tables with open addressing
+ *
+ * Copyright (C) 2026 The Augeas authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef OAHASH_H_
+#define OAHASH_H_
+
+#include <stddef.h>
+
+/* A hash table mapping keys of a fixed size to pointers. Keys are copied
+ * into the table itself, and collisions are resolved by linear probing
+ * with Robin Hood hashing, so that neither inserting nor looking up an
+ * entry allocates memory or follows pointers other than through the
+ * caller's hash and comparison functions. Entries can not be removed.
+ *
+ * Unlike the tables in hash.h, this is meant for the large, short-lived
+ * tables built while constructing automata.
+ */
+struct oahash;
+
+/* Hash the key at KEY */
+typedef size_t (*oahash_hash_fn)(const void *key);
+
+/* Return nonzero if the keys at KEY1 and KEY2 are equal */
+typedef int (*oahash_eq_fn)(const void *key1, const void *key2);
+
+/* Make a table for keys that are KEY_SIZE bytes long. If EQ is NULL, keys
+ * are compared with memcmp. Return NULL if allocation fails */
+struct oahash *oahash_create(size_t key_size, oahash_hash_fn hash,
+                             oahash_eq_fn eq);
+
+void oahash_free(struct oahash *table);
+
+/* The number of entries in TABLE */
+size_t oahash_count(const struct oahash *table);
+
+/* Look up KEY in TABLE. If it is there, return a pointer to the copy of
+ * the key stored in TABLE and, if VALUE is not NULL, set *VALUE to its
+ * value. Return NULL if KEY is not in TABLE */
+const void *oahash_lookup(const struct oahash *table, const void *key,
+                          void **value);
+
+/* Add KEY with VALUE to TABLE. KEY must not be in TABLE yet. Return -1 if
+ * allocation fails, 0 otherwise */
+int oahash_insert(struct oahash *table, const void *key, void *value);
+
+/* Iterate over all entries in TABLE: start with *POS set to 0. If there
+ * is another entry, set *KEY and *VALUE to it and return 1, otherwise
+ * return 0. TABLE must not be changed during the iteration */
+int oahash_next(const struct oahash *table, size_t *pos,
+                const void **key, void **value);
+
+#endif
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
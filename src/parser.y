@@ -2,6 +2,8 @@
 
 #include <config.h>
 
+#define MEM_SUBSYS MEM_INTERP
+
 #include "internal.h"
 #include "syntax.h"
 #include "list.h"
@@ -50,6 +52,7 @@ typedef struct info YYLTYPE;
 struct state {
   struct info *info;
   unsigned int comment_depth;
+  struct regexp_table *regexps;  /* Share identical regexp literals */
 };
 
 }
@@ -120,6 +123,7 @@ int augl_lex_destroy (yyscan_t yyscanner );
 int augl_get_lineno (yyscan_t yyscanner );
 int augl_get_column  (yyscan_t yyscanner);
 struct info *augl_get_info(yyscan_t yyscanner);
+struct state *augl_get_extra(yyscan_t yyscanner);
 char *augl_get_text (yyscan_t yyscanner );
 
 static void augl_error(struct info *locp, struct term **term,
@@ -147,8 +151,9 @@ static void augl_error(struct info *locp, struct term **term,
  static struct term *make_ident(char *qname, struct info *locp);
  static struct term *make_unit_term(struct info *locp);
  static struct term *make_string_term(char *value, struct info *locp);
- static struct term *make_regexp_term(char *pattern,
-                                      int nocase, struct info *locp);
+ static struct term *make_regexp_term(char *pattern, int nocase,
+                                      struct regexp_table *regexps,
+                                      struct info *locp);
  static struct term *make_rep(struct term *exp, enum quant_tag quant,
                              struct info *locp);
 
@@ -259,7 +264,8 @@ aexp: qid
     | DQUOTED
       { $$ = make_string_term($1, &@1); }
     | REGEXP
-      { $$ = make_regexp_term($1.pattern, $1.nocase, &@1); }
+      { $$ = make_regexp_term($1.pattern, $1.nocase,
+                              augl_get_extra(scanner)->regexps, &@1); }
     | '(' exp ')'
       { $$ = $2; }
     | '[' exp ']'
@@ -367,6 +373,7 @@ int augl_parse_file(struct augeas *aug, const char *name,
   MEMZERO(&state, 1);
   state.info = &info;
   state.comment_depth = 0;
+  state.regexps = aug->regexps;
 
   if (augl_init_lexer(&state, &scanner) < 0) {
     augl_error(&info, term, NULL, "file not found");
@@ -550,10 +557,14 @@ static struct term *make_string_term(char *value, struct info *locp) {
 }
 
 static struct term *make_regexp_term(char *pattern, int nocase,
+                                     struct regexp_table *regexps,
                                      struct info *locp) {
   struct term *term = make_term_locp(A_VALUE, locp);
   term->value = make_value(V_REGEXP, ref(term->info));
-  term->value->regexp = make_regexp(term->info, pattern, nocase);
+  if (regexps != NULL)
+    term->value->regexp = regexp_intern(regexps, pattern, nocase);
+  else
+    term->value->regexp = make_regexp(term->info, pattern, nocase);
   return term;
 }
 
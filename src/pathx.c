@@ -21,6 +21,9 @@
  */
 
 #include <config.h>
+
+#define MEM_SUBSYS MEM_PATHX
+
 #include <internal.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -142,13 +145,17 @@ struct step {
     struct pred *predicates;
 };
 
+struct state;
+
 /* Initialise the root nodeset with the first step */
 static struct tree *step_root(struct step *step, struct tree *ctx,
                               struct tree *root_ctx);
 /* Iteration over the nodes on a step, ignoring the predicates */
-static struct tree *step_first(struct step *step, struct tree *ctx);
+static struct tree *step_first(struct step *step, struct tree *ctx,
+                               struct state *state);
 static struct tree *step_next(struct step *step, struct tree *ctx,
-                              struct tree *node);
+                              struct tree *node, struct state *state);
+static void load_lazy(struct tree *tree, struct state *state);
 
 struct pathx_symtab {
     struct pathx_symtab *next;
@@ -237,6 +244,9 @@ struct state {
     uint            ctx_len;
 
     struct tree *root_ctx; /* Root context for relative paths */
+    bool         uses_root_ctx; /* The expression has a relative path
+                                 * that is not inside a predicate */
+    unsigned int pred_depth;    /* Nesting of predicates during parsing */
 
     /* A table of all values. The table is dynamically reallocated, i.e.
      * pointers to struct value should not be used across calls that
@@ -248,6 +258,11 @@ struct state {
     struct value  *value_pool;
     value_ind_t    value_pool_used;
     value_ind_t    value_pool_size;
+    /* The number of values in value_pool that belong to the expression
+     * itself, like literals and the results of constant folding; all
+     * other values are results of evaluating the expression and are
+     * released by pathx_rebind */
+    value_ind_t    value_pool_parsed;
     /* Stack of values (as indices into value_pool), with bottom of
        stack in values[0] */
     value_ind_t   *values;
@@ -1237,7 +1252,9 @@ static bool position_pred(struct pred *pred) {
    POSITION_PRED.
 
    This method hand-optimizes the important case of a path expression like
-   'service[42]'
+   'service[42]'. When the last child with that label is known, as it is
+   when a tree is built up with 'service[N+1]', asking for it or for the
+   one after it is answered without looking at any siblings.
 */
 static struct tree *position_filter(struct nodeset *ns,
                                     struct step *step,
@@ -1245,11 +1262,27 @@ static struct tree *position_filter(struct nodeset *ns,
     int value_ind = step->predicates->exprs[0]->value_ind;
     int number = state->value_pool[value_ind].number;
 
+    if (ns->used == 1 && step->axis == CHILD && step->name != NULL
+        && *step->name != '\0' && number > 0) {
+        unsigned int count;
+        struct tree *last;
+
+        load_lazy(ns->nodes[0], state);
+        last = tree_last_child(ns->nodes[0], &count);
+        if (last != NULL && last->label != NULL
+            && STREQ(step->name, last->label)) {
+            if (number > count)
+                return NULL;
+            if (number == count)
+                return last;
+        }
+    }
+
     int pos = 1;
     for (int i=0; i < ns->used; i++) {
-        for (struct tree *node = step_first(step, ns->nodes[i]);
+        for (struct tree *node = step_first(step, ns->nodes[i], state);
              node != NULL;
-             node = step_next(step, ns->nodes[i], node), pos++) {
+             node = step_next(step, ns->nodes[i], node, state), pos++) {
             if (pos == number)
                 return node;
         }
@@ -1314,9 +1347,10 @@ static void ns_from_locpath(struct locpath *lp, uint *maxns,
             }
         } else {
             for (int i=0; i < work->used; i++) {
-                for (struct tree *node = step_first(step, work->nodes[i]);
+                for (struct tree *node = step_first(step, work->nodes[i],
+                                                    state);
                      node != NULL;
-                     node = step_next(step, work->nodes[i], node)) {
+                     node = step_next(step, work->nodes[i], node, state)) {
                     ns_add(next, node, state);
                 }
             }
@@ -1423,6 +1457,9 @@ static void eval_expr(struct expr *expr, struct state *state) {
             value_ind_t vind = state->values_used - 1;
             expr->tag = E_VALUE;
             expr->value_ind = state->values[vind];
+            /* The folded value is now part of the expression and must
+             * survive pathx_rebind */
+            state->value_pool_parsed = state->value_pool_used;
         }
         break;
     default:
@@ -1834,7 +1871,9 @@ static struct pred *parse_predicates(struct state *state) {
     int nexpr = 0;
 
     while (match(state, L_BRACK)) {
+        state->pred_depth += 1;
         parse_expr(state);
+        state->pred_depth -= 1;
         nexpr += 1;
         RET0_ON_ERROR;
 
@@ -2019,6 +2058,8 @@ static void parse_location_path(struct state *state) {
         }
     } else {
         locpath = parse_relative_location_path(state);
+        if (state->pred_depth == 0)
+            state->uses_root_ctx = true;
     }
 
     if (ALLOC(expr) < 0)
@@ -2526,6 +2567,7 @@ int pathx_parse(const struct tree *tree,
                 struct tree *root_ctx,
                 struct pathx **pathx) {
     struct state *state = NULL;
+    unsigned long long start = metrics_clock();
 
     *pathx = NULL;
 
@@ -2581,9 +2623,11 @@ int pathx_parse(const struct tree *tree,
         STATE_ERROR(state, PATHX_ETYPE);
         goto done;
     }
+    state->value_pool_parsed = state->value_pool_used;
 
  done:
     store_error(*pathx);
+    METRICS_STOP(err == NULL ? NULL : err->aug, pathx_parse, start);
     return state->errcode;
  oom:
     free_pathx(*pathx);
@@ -2605,6 +2649,13 @@ static bool step_matches(struct step *step, struct tree *tree) {
     }
 }
 
+/* Files that a lazy aug_load registered are loaded when a step first
+ * looks at their children */
+static void load_lazy(struct tree *tree, struct state *state) {
+    if (tree->lazy && state->error != NULL)
+        tree_load_lazy(state->error->aug, tree);
+}
+
 static struct tree *tree_prev(struct tree *pos) {
     struct tree *node = NULL;
     if (pos != pos->parent->children) {
@@ -2646,7 +2697,8 @@ static struct tree *step_root(struct step *step, struct tree *ctx,
     return node;
 }
 
-static struct tree *step_first(struct step *step, struct tree *ctx) {
+static struct tree *step_first(struct step *step, struct tree *ctx,
+                               struct state *state) {
     struct tree *node = NULL;
     switch (step->axis) {
     case SELF:
@@ -2655,6 +2707,7 @@ static struct tree *step_first(struct step *step, struct tree *ctx) {
         break;
     case CHILD:
     case DESCENDANT:
+        load_lazy(ctx, state);
         node = ctx->children;
         break;
     case PARENT:
@@ -2679,11 +2732,11 @@ static struct tree *step_first(struct step *step, struct tree *ctx) {
         return NULL;
     if (step_matches(step, node))
         return node;
-    return step_next(step, ctx, node);
+    return step_next(step, ctx, node, state);
 }
 
 static struct tree *step_next(struct step *step, struct tree *ctx,
-                              struct tree *node) {
+                              struct tree *node, struct state *state) {
     while (node != NULL) {
         switch (step->axis) {
         case SELF:
@@ -2694,6 +2747,7 @@ static struct tree *step_next(struct step *step, struct tree *ctx,
             break;
         case DESCENDANT:
         case DESCENDANT_OR_SELF:
+            load_lazy(node, state);
             if (node->children != NULL) {
                 node = node->children;
             } else {
@@ -2732,10 +2786,13 @@ static struct tree *step_next(struct step *step, struct tree *ctx,
 
 static struct value *pathx_eval(struct pathx *pathx) {
     struct state *state = pathx->state;
+    unsigned long long start = metrics_clock();
+
     state->ctx = pathx->origin;
     state->ctx_pos = 1;
     state->ctx_len = 1;
     eval_expr(state->exprs[0], state);
+    METRICS_STOP(aug_of_pathx(pathx), pathx_eval, start);
     if (HAS_ERROR(state))
         return NULL;
 
@@ -2862,7 +2919,7 @@ int pathx_expand_tree(struct pathx *path, struct tree **tree) {
             first_child = t;
         if (t == NULL || t->label == NULL)
             goto error;
-        list_append(parent->children, t);
+        tree_append_child(parent, t);
         parent = t;
     }
 
@@ -2875,6 +2932,7 @@ int pathx_expand_tree(struct pathx *path, struct tree **tree) {
  error:
     if (first_child != NULL) {
         list_remove(first_child, first_child->parent->children);
+        tree_children_changed(first_child->parent);
         free_tree(first_child);
     }
     *tree = NULL;
@@ -2882,6 +2940,28 @@ int pathx_expand_tree(struct pathx *path, struct tree **tree) {
     return -1;
 }
 
+bool pathx_uses_root_ctx(struct pathx *pathx) {
+    return pathx->state->uses_root_ctx;
+}
+
+void pathx_set_root_ctx(struct pathx *pathx, struct tree *root_ctx) {
+    pathx->state->root_ctx = root_ctx;
+}
+
+void pathx_rebind(struct pathx *pathx, struct tree *origin) {
+    struct state *state = pathx->state;
+
+    for (value_ind_t i = state->value_pool_parsed;
+         i < state->value_pool_used; i++)
+        release_value(state->value_pool + i);
+    state->value_pool_used = state->value_pool_parsed;
+    state->values_used = 0;
+
+    pathx->origin = origin;
+    pathx->nodeset = NULL;
+    pathx->node = 0;
+}
+
 int pathx_find_one(struct pathx *path, struct tree **tree) {
     *tree = pathx_first(path);
     if (HAS_ERROR(path->state))
@@ -2893,6 +2973,11 @@ struct error *err_of_pathx(struct pathx *px) {
     return px->state->error;
 }
 
+const struct augeas *aug_of_pathx(struct pathx *px) {
+    struct error *err = px->state->error;
+    return (err == NULL) ? NULL : err->aug;
+}
+
 const char *pathx_error(struct pathx *path, const char **txt, int *pos) {
     int errcode = PATHX_ENOMEM;
 
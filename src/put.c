@@ -22,6 +22,8 @@
 
 #include <config.h>
 
+#define MEM_SUBSYS MEM_PUT
+
 #include <stdarg.h>
 #include "regexp.h"
 #include "memory.h"
@@ -52,6 +54,20 @@ struct split {
     char         *enc;
     size_t        start;
     size_t        end;
+    /* Where the encoding of each tree in ENC ends; shared by the split
+     * made by MAKE_SPLIT and all the splits refined from it, and owned
+     * by the former, like ENC */
+    struct split_nodes *nodes;
+};
+
+/* The tree NODES[i].TREE is encoded in ENC up to, and including, the
+ * ENC_SLASH at position NODES[i].SLASH */
+struct split_nodes {
+    size_t        count;
+    struct {
+        size_t       slash;
+        struct tree *tree;
+    }             node[];
 };
 
 struct state {
@@ -61,16 +77,36 @@ struct state {
     const char       *override;
     struct dict      *dict;
     struct skel      *skel;
-    char             *path;   /* Position in the tree, for errors */
+    /* The subtree being put, whose path is reported in errors; NULL at
+     * the top of the file. The path itself is only computed when there
+     * is an error, since it takes time linear in the number of siblings */
+    struct tree      *path;
     size_t            pos;
     bool              with_span;
     struct info      *info;
     struct lns_error *error;
+    /* Registers for matching the atype of a concat in SPLIT_CONCAT,
+     * reused for the whole put */
+    struct re_registers *regs;
+    /* While COMPARE is not NULL, output is compared against it instead of
+     * being written to OUT. COMPARE_POS is the length of the prefix of
+     * COMPARE that the output has matched so far, and OUT_START is the
+     * position of OUT when we started */
+    const char       *compare;
+    size_t            compare_pos;
+    long              out_start;
 };
 
 static void create_lens(struct lens *lens, struct state *state);
 static void put_lens(struct lens *lens, struct state *state);
 
+/* The path of the position STATE is at in the tree, for error messages */
+static char *state_path(struct state *state) {
+    if (state->path == NULL)
+        return strdup("/");
+    return path_of_tree(state->path);
+}
+
 static void put_error(struct state *state, struct lens *lens,
                       const char *format, ...)
 {
@@ -84,11 +120,7 @@ static void put_error(struct state *state, struct lens *lens,
         return;
     state->error->lens = ref(lens);
     state->error->pos  = -1;
-    if (strlen(state->path) == 0) {
-        state->error->path = strdup("");
-    } else {
-        state->error->path = strdup(state->path);
-    }
+    state->error->path = state_path(state);
 
     va_start(ap, format);
     r = vasprintf(&state->error->message, format, ap);
@@ -122,9 +154,11 @@ static void regexp_match_error(struct state *state, struct lens *lens,
                              4);
 
     if (count == -1) {
+        char *path = state_path(state);
         put_error(state, lens,
                   "Failed to match tree under %s\n\n%s\n  with pattern\n   %s\n",
-                  state->path, text, pat);
+                  path, text, pat);
+        free(path);
     } else if (count == -2) {
         put_error(state, lens,
                   "Internal error matching\n    %s\n  with tree\n   %s\n",
@@ -142,6 +176,7 @@ static void free_split(struct split *split) {
         return;
 
     free(split->enc);
+    free(split->nodes);
     free(split);
 }
 
@@ -149,6 +184,7 @@ static void free_split(struct split *split) {
  */
 static struct split *make_split(struct tree *tree) {
     struct split *split;
+    size_t count = 0;
 
     if (ALLOC(split) < 0)
         return NULL;
@@ -156,14 +192,24 @@ static struct split *make_split(struct tree *tree) {
     split->tree = tree;
     list_for_each(t, tree) {
         split->end += enclen(t->label, t->value);
+        count += 1;
     }
 
     if (ALLOC_N(split->enc, split->end + 1) < 0)
         goto error;
+    if (mem_alloc_n(&split->nodes, sizeof(*split->nodes)
+                    + count * sizeof(split->nodes->node[0]), 1,
+                    MEM_SUBSYS) < 0)
+        goto error;
+    split->nodes->count = count;
 
     char *enc = split->enc;
+    size_t i = 0;
     list_for_each(t, tree) {
         enc = encpcpy(enc, t->label, t->value);
+        split->nodes->node[i].slash = enc - split->enc - 1;
+        split->nodes->node[i].tree = t;
+        i += 1;
     }
     return split;
  error:
@@ -171,15 +217,33 @@ static struct split *make_split(struct tree *tree) {
     return NULL;
 }
 
+/* Return the first tree in NODES whose encoding does not end before POS,
+ * or NULL if there is none */
+static struct tree *split_node_at(const struct split_nodes *nodes,
+                                  size_t pos) {
+    size_t lo = 0, hi = nodes->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (nodes->node[mid].slash < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < nodes->count ? nodes->node[lo].tree : NULL;
+}
+
 static struct split *split_append(struct split **split, struct split *tail,
                                   struct tree *tree, struct tree *follow,
-                                  char *enc, size_t start, size_t end) {
+                                  const struct split *outer,
+                                  size_t start, size_t end) {
     struct split *sp;
     if (ALLOC(sp) < 0)
         return NULL;
     sp->tree = tree;
     sp->follow = follow;
-    sp->enc = enc;
+    sp->enc = outer->enc;
+    sp->nodes = outer->nodes;
     sp->start = start;
     sp->end = end;
     list_tail_cons(*split, tail, sp);
@@ -208,26 +272,29 @@ static struct split *split_concat(struct state *state, struct lens *lens) {
 
     int count = 0;
     struct split *outer = state->split;
-    struct re_registers regs;
+    struct re_registers *regs = state->regs;
     struct split *split = NULL, *tail = NULL;
     struct regexp *atype = lens->atype;
+    const unsigned int *creg;
 
     /* Fast path for leaf nodes, which will always lead to an empty split */
     // FIXME: This doesn't match the empty encoding
     if (outer->tree == NULL && strlen(outer->enc) == 0
         && regexp_is_empty_pattern(atype)) {
         for (int i=0; i < lens->nchildren; i++) {
-            tail = split_append(&split, tail, NULL, NULL,
-                                outer->enc, 0, 0);
+            tail = split_append(&split, tail, NULL, NULL, outer, 0, 0);
             if (tail == NULL)
                 goto error;
         }
         return split;
     }
 
-    MEMZERO(&regs, 1);
+    creg = lens_concat_regs(lens);
+    if (creg == NULL)
+        goto error;
+
     count = regexp_match(atype, outer->enc, outer->end,
-                         outer->start, &regs);
+                         outer->start, regs);
     if (count >= 0 && count != outer->end - outer->start)
         count = -1;
     if (count < 0) {
@@ -236,29 +303,23 @@ static struct split *split_concat(struct state *state, struct lens *lens) {
     }
 
     struct tree *cur = outer->tree;
-    int reg = 1;
     for (int i=0; i < lens->nchildren; i++) {
-        assert(reg < regs.num_regs);
-        assert(regs.start[reg] != -1);
+        unsigned int reg = creg[i];
+        assert(reg < regs->num_regs);
+        assert(regs->start[reg] != -1);
         struct tree *follow = cur;
-        for (int j = regs.start[reg]; j < regs.end[reg]; j++) {
-            if (outer->enc[j] == ENC_SLASH_CH)
-                follow = follow->next;
-        }
+        if (regs->end[reg] > regs->start[reg])
+            follow = split_node_at(outer->nodes, regs->end[reg]);
         tail = split_append(&split, tail, cur, follow,
-                            outer->enc, regs.start[reg], regs.end[reg]);
+                            outer, regs->start[reg], regs->end[reg]);
+        if (tail == NULL)
+            goto error;
         cur = follow;
-        reg += 1 + regexp_nsub(lens->children[i]->atype);
     }
-    assert(reg < regs.num_regs);
- done:
-    free(regs.start);
-    free(regs.end);
     return split;
  error:
-    free_split(split);
-    split = NULL;
-    goto done;
+    list_free(split);
+    return NULL;
 }
 
 static struct split *split_iter(struct state *state, struct lens *lens) {
@@ -282,12 +343,10 @@ static struct split *split_iter(struct state *state, struct lens *lens) {
         }
 
         struct tree *follow = cur;
-        for (int j = pos; j < pos + count; j++) {
-            if (outer->enc[j] == ENC_SLASH_CH)
-                follow = follow->next;
-        }
+        if (count > 0)
+            follow = split_node_at(outer->nodes, pos + count);
         tail = split_append(&split, tail, cur, follow,
-                            outer->enc, pos, pos + count);
+                            outer, pos, pos + count);
         cur = follow;
         pos += count;
     }
@@ -394,20 +453,44 @@ static int skel_instance_of(struct lens *lens, struct skel *skel) {
 
 enum span_kind { S_NONE, S_LABEL, S_VALUE };
 
+/* The position in the output; use this instead of FTELL(STATE->OUT) */
+static long out_tell(struct state *state) {
+    if (state->compare != NULL)
+        return state->out_start + state->compare_pos;
+    return ftell(state->out);
+}
+
+/* The output has stopped matching STATE->COMPARE; write what has been
+ * matched so far to STATE->OUT and write everything else there directly
+ * from now on */
+static void out_diverge(struct state *state) {
+    fwrite(state->compare, 1, state->compare_pos, state->out);
+    state->compare = NULL;
+}
+
 static void emit(struct state *state, const char *text, enum span_kind kind) {
     struct span* span = state->tree->span;
 
     if (span != NULL) {
-        long start = ftell(state->out);
+        long start = out_tell(state);
         if (kind == S_LABEL) {
             span->label_start = start;
         } else if (kind == S_VALUE) {
             span->value_start = start;
         }
     }
-    fprintf(state->out, "%s", text);
+    if (state->compare != NULL) {
+        size_t len = strlen(text);
+        if (STREQLEN(state->compare + state->compare_pos, text, len)) {
+            state->compare_pos += len;
+        } else {
+            out_diverge(state);
+        }
+    }
+    if (state->compare == NULL)
+        fputs(text, state->out);
     if (span != NULL) {
-        long end = ftell(state->out);
+        long end = out_tell(state);
         if (kind == S_LABEL) {
             span->label_end = end;
         } else if (kind == S_VALUE) {
@@ -423,13 +506,12 @@ static void put_subtree(struct lens *lens, struct state *state) {
     assert(lens->tag == L_SUBTREE);
     struct state oldstate = *state;
     struct split oldsplit = *state->split;
-    char *       oldpath = state->path;
 
     struct tree *tree = state->split->tree;
     struct split *split = NULL;
 
     state->tree = tree;
-    state->path = path_of_tree(tree);
+    state->path = tree;
 
     split = make_split(tree->children);
     set_split(state, split);
@@ -439,7 +521,7 @@ static void put_subtree(struct lens *lens, struct state *state) {
         if (tree->span == NULL) {
             tree->span = make_span(state->info);
         }
-        tree->span->span_start = ftell(state->out);
+        tree->span->span_start = out_tell(state);
     }
     if (state->skel == NULL || ! skel_instance_of(lens->child, state->skel)) {
         create_lens(lens->child, state);
@@ -448,16 +530,15 @@ static void put_subtree(struct lens *lens, struct state *state) {
     }
     assert(state->error != NULL || state->split->next == NULL);
     if (tree->span != NULL) {
-        tree->span->span_end = ftell(state->out);
+        tree->span->span_end = out_tell(state);
     }
 
     oldstate.error = state->error;
-    oldstate.path = state->path;
+    oldstate.compare = state->compare;
+    oldstate.compare_pos = state->compare_pos;
     *state = oldstate;
     *state->split= oldsplit;
     free_split(split);
-    free(state->path);
-    state->path = oldpath;
 }
 
 static void put_del(ATTRIBUTE_UNUSED struct lens *lens, struct state *state) {
@@ -843,19 +924,30 @@ static void create_lens(struct lens *lens, struct state *state) {
     }
 }
 
-void lns_put(struct info *info, FILE *out, struct lens *lens, struct tree *tree,
-             const char *text, int enable_span, struct lns_error **err) {
+static int put_tree(struct info *info, FILE *out, struct lens *lens,
+                    struct tree *tree, const char *text, struct lns_ast *ast,
+                    int enable_span, bool compare, struct lns_error **err) {
     struct state state;
+    struct re_registers regs;
     struct lns_error *err1;
+    int changed = 1;
+    unsigned long long start;
 
     if (err != NULL)
         *err = NULL;
-    if (tree == NULL)
-        return;
 
     MEMZERO(&state, 1);
-    state.path = strdup("/");
-    state.skel = lns_parse(lens, text, &state.dict, &err1);
+    MEMZERO(&regs, 1);
+    state.out = out;
+    state.regs = &regs;
+    if (compare) {
+        state.compare = text;
+        state.out_start = ftell(out);
+    }
+    if (tree == NULL)
+        goto done;
+
+    state.skel = lns_parse(lens, text, ast, &state.dict, &err1);
 
     if (err1 != NULL) {
         if (err != NULL)
@@ -864,7 +956,6 @@ void lns_put(struct info *info, FILE *out, struct lens *lens, struct tree *tree,
             free_lns_error(err1);
         goto error;
     }
-    state.out = out;
     state.split = make_split(tree);
     state.with_span = enable_span;
     state.tree = tree;
@@ -873,11 +964,13 @@ void lns_put(struct info *info, FILE *out, struct lens *lens, struct tree *tree,
         if (tree->span == NULL) {
             tree->span = make_span(info);
         }
-        tree->span->span_start = ftell(out);
+        tree->span->span_start = out_tell(&state);
     }
+    start = metrics_clock();
     put_lens(lens, &state);
+    METRICS_STOP(info->error->aug, put, start);
     if (state.with_span) {
-        tree->span->span_end = ftell(out);
+        tree->span->span_end = out_tell(&state);
     }
     if (err != NULL) {
         *err = state.error;
@@ -885,11 +978,31 @@ void lns_put(struct info *info, FILE *out, struct lens *lens, struct tree *tree,
         free_lns_error(state.error);
     }
 
+ done:
+    /* The output might be a proper prefix of TEXT */
+    if (state.compare != NULL && text[state.compare_pos] != '\0')
+        out_diverge(&state);
+    changed = (state.compare == NULL);
  error:
-    free(state.path);
     free_split(state.split);
     free_skel(state.skel);
     free_dict(state.dict);
+    free(regs.start);
+    free(regs.end);
+    return changed;
+}
+
+void lns_put(struct info *info, FILE *out, struct lens *lens, struct tree *tree,
+             const char *text, struct lns_ast *ast, int enable_span,
+             struct lns_error **err) {
+    put_tree(info, out, lens, tree, text, ast, enable_span, false, err);
+}
+
+int lns_put_changed(struct info *info, FILE *out, struct lens *lens,
+                    struct tree *tree, const char *text,
+                    struct lns_ast *ast, int enable_span,
+                    struct lns_error **err) {
+    return put_tree(info, out, lens, tree, text, ast, enable_span, true, err);
 }
 
 /*
@@ -23,11 +23,12 @@
 #include <config.h>
 
 #include "ref.h"
+#include "memory.h"
 #include <stdlib.h>
 
-int ref_make_ref(void *ptrptr, size_t size, size_t ref_ofs) {
-    *(void**) ptrptr = calloc(1, size);
-    if (*(void **)ptrptr == NULL) {
+int ref_make_ref(void *ptrptr, size_t size, size_t ref_ofs,
+                 enum mem_subsys subsys) {
+    if (mem_alloc_n(ptrptr, size, 1, subsys) < 0) {
         return -1;
     } else {
         void *ptr = *(void **)ptrptr;
@@ -25,6 +25,7 @@
 
 #include <limits.h>
 #include <stddef.h>
+#include "memstat.h"
 
 /* Reference counting for pointers to structs with a REF field of type ref_t
  *
@@ -35,27 +36,49 @@
  * owned by wherever the function stored it, and not the caller anymore; in
  * the second case, the caller and whereever the reference was stored both
  * own the reference.
+ *
+ * A struct whose REF is REF_MAX is pinned: REF and UNREF leave it alone,
+ * and it is never freed through them. Since they then only read REF,
+ * pinned structs can be shared between threads without any writes to
+ * their cache lines.
+ *
+ * By default, REF and UNREF are not threadsafe; when configured with
+ * --enable-atomic-ref, the reference count is changed with atomic
+ * operations so that structs can be shared between threads.
  */
-// FIXME: This is not threadsafe; incr/decr ref needs to be protected
 
 #define REF_MAX UINT_MAX
 
 typedef unsigned int ref_t;
 
-int ref_make_ref(void *ptrptr, size_t size, size_t ref_ofs);
+int ref_make_ref(void *ptrptr, size_t size, size_t ref_ofs,
+                 enum mem_subsys subsys);
 
-#define make_ref(var)                                           \
-    ref_make_ref(&(var), sizeof(*(var)), offsetof(typeof(*(var)), ref))
+#define make_ref(var)                                                   \
+    ref_make_ref(&(var), sizeof(*(var)), offsetof(typeof(*(var)), ref), \
+                 MEM_SUBSYS)
 
 #define make_ref_err(var) if (make_ref(var) < 0) goto error
 
-#define ref(s) (((s) == NULL || (s)->ref == REF_MAX) ? (s) : ((s)->ref++, (s)))
+#if ENABLE_ATOMIC_REF
+# define ref_load(s)  __atomic_load_n(&(s)->ref, __ATOMIC_RELAXED)
+# define ref_incr(s)  __atomic_add_fetch(&(s)->ref, 1, __ATOMIC_RELAXED)
+# define ref_decr(s)  __atomic_sub_fetch(&(s)->ref, 1, __ATOMIC_ACQ_REL)
+# define ref_store(s, v) __atomic_store_n(&(s)->ref, (v), __ATOMIC_RELEASE)
+#else
+# define ref_load(s)  ((s)->ref)
+# define ref_incr(s)  (++(s)->ref)
+# define ref_decr(s)  (--(s)->ref)
+# define ref_store(s, v) ((s)->ref = (v))
+#endif
+
+#define ref(s) (((s) == NULL || ref_load(s) == REF_MAX) ? (s) : (ref_incr(s), (s)))
 
 #define unref(s, t)                                                     \
     do {                                                                \
-        if ((s) != NULL && (s)->ref != REF_MAX) {                       \
-            assert((s)->ref > 0);                                       \
-            if (--(s)->ref == 0) {                                      \
+        if ((s) != NULL && ref_load(s) != REF_MAX) {                    \
+            assert(ref_load(s) > 0);                                    \
+            if (ref_decr(s) == 0) {                                     \
                 /*memset(s, 255, sizeof(*s));*/                         \
                 free_##t(s);                                            \
             }                                                           \
@@ -64,7 +87,10 @@ int ref_make_ref(void *ptrptr, size_t size, size_t ref_ofs);
     } while(0)
 
 /* Make VAR uncollectable and pin it in memory for eternity */
-#define ref_pin(var)   (var)->ref = REF_MAX
+#define ref_pin(var)   ref_store(var, REF_MAX)
+
+/* Whether VAR has been pinned with REF_PIN */
+#define ref_pinned(var) (ref_load(var) == REF_MAX)
 
 #endif
 
@@ -21,12 +21,16 @@
  */
 
 #include <config.h>
+
+#define MEM_SUBSYS MEM_INTERP
+
 #include <regex.h>
 
 #include "internal.h"
 #include "syntax.h"
 #include "memory.h"
 #include "errcode.h"
+#include "hash.h"
 
 static const struct string empty_pattern_string = {
     .ref = REF_MAX, .str = (char *) "()"
@@ -208,19 +212,101 @@ struct regexp *make_regexp_from_glob(struct info *info, const char *glob) {
     return make_regexp(info, pat, 0);
 }
 
+static void regexp_table_remove(struct regexp *regexp);
+
 void free_regexp(struct regexp *regexp) {
     if (regexp == NULL)
         return;
     assert(regexp->ref == 0);
+    regexp_table_remove(regexp);
     unref(regexp->info, info);
     unref(regexp->pattern, string);
     if (regexp->re != NULL) {
         regfree(regexp->re);
         free(regexp->re);
     }
+    fa_free(regexp->fa);
     free(regexp);
 }
 
+/*
+ * Sharing regexp literals
+ */
+struct regexp_table {
+    struct info *info;         /* Shared by all regexps in the table */
+    hash_t *rx[2];             /* Indexed by nocase, keyed by pattern */
+};
+
+struct regexp_table *make_regexp_table(struct info *info) {
+    struct regexp_table *table;
+
+    if (ALLOC(table) < 0)
+        return NULL;
+    table->info = ref(info);
+    for (int i=0; i < 2; i++) {
+        table->rx[i] = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
+        if (table->rx[i] == NULL) {
+            free_regexp_table(table);
+            return NULL;
+        }
+    }
+    return table;
+}
+
+void free_regexp_table(struct regexp_table *table) {
+    if (table == NULL)
+        return;
+    for (int i=0; i < 2; i++) {
+        hscan_t scan;
+        hnode_t *node;
+
+        if (table->rx[i] == NULL)
+            continue;
+        hash_scan_begin(&scan, table->rx[i]);
+        /* Regexps that are still in use, for example by frozen lenses,
+         * outlive the table */
+        while ((node = hash_scan_next(&scan)) != NULL) {
+            struct regexp *r = hnode_get(node);
+            r->table = NULL;
+        }
+        hash_free_nodes(table->rx[i]);
+        hash_destroy(table->rx[i]);
+    }
+    unref(table->info, info);
+    free(table);
+}
+
+static void regexp_table_remove(struct regexp *regexp) {
+    hash_t *rx;
+    hnode_t *node;
+
+    if (regexp->table == NULL)
+        return;
+    rx = regexp->table->rx[regexp->nocase];
+    node = hash_lookup(rx, regexp->pattern->str);
+    if (node != NULL && hnode_get(node) == regexp)
+        hash_delete_free(rx, node);
+    regexp->table = NULL;
+}
+
+struct regexp *regexp_intern(struct regexp_table *table, char *pat,
+                             int nocase) {
+    hash_t *rx = table->rx[nocase != 0];
+    hnode_t *node = hash_lookup(rx, pat);
+    struct regexp *r;
+
+    if (node != NULL) {
+        free(pat);
+        return ref((struct regexp *) hnode_get(node));
+    }
+
+    r = make_regexp(table->info, pat, nocase);
+    /* If we can't add R to the table, it simply won't be shared */
+    if (r != NULL && hash_alloc_insert(rx, r->pattern->str, r) == 0)
+        r->table = table;
+    return r;
+}
+
 int regexp_is_empty_pattern(struct regexp *r) {
     for (char *s = r->pattern->str; *s; s++) {
         if (*s != '(' && *s != ')')
@@ -417,19 +503,28 @@ regexp_concat_n(struct info *info, int n, struct regexp **r) {
     return NULL;
 }
 
+/* Return the automaton for R; it is kept in R->FA, except for frozen
+ * regexps, which are never written to */
 static struct fa *regexp_to_fa(struct regexp *r) {
     const char *p = r->pattern->str;
     int ret;
     struct fa *fa = NULL;
 
-    ret = fa_compile(p, strlen(p), &fa);
-    ERR_NOMEM(ret == REG_ESPACE, r->info);
-    BUG_ON(ret != REG_NOERROR, r->info, NULL);
+    if (r->fa == NULL) {
+        ret = fa_compile(p, strlen(p), &fa);
+        ERR_NOMEM(ret == REG_ESPACE, r->info);
+        BUG_ON(ret != REG_NOERROR, r->info, NULL);
 
-    if (r->nocase) {
-        ret = fa_nocase(fa);
-        ERR_NOMEM(ret < 0, r->info);
+        if (r->nocase) {
+            ret = fa_nocase(fa);
+            ERR_NOMEM(ret < 0, r->info);
+        }
+        if (ref_pinned(r))
+            return fa;
+        r->fa = fa;
     }
+    fa = fa_clone(r->fa);
+    ERR_NOMEM(fa == NULL, r->info);
     return fa;
 
  error:
@@ -545,6 +640,10 @@ static int regexp_compile_internal(struct regexp *r, const char **c) {
 
     *c = NULL;
 
+    /* Compiling again would leak what the first compilation allocated */
+    if (r->re != NULL && r->re->buffer != NULL)
+        return 0;
+
     if (r->re == NULL) {
         if (ALLOC(r->re) < 0)
             return -1;
@@ -594,10 +693,16 @@ int regexp_nsub(struct regexp *r) {
 }
 
 void regexp_release(struct regexp *regexp) {
-    if (regexp != NULL && regexp->re != NULL) {
+    if (regexp == NULL || ref_pinned(regexp))
+        return;
+    if (regexp->re != NULL) {
         regfree(regexp->re);
         FREE(regexp->re);
     }
+    if (regexp->fa != NULL) {
+        fa_free(regexp->fa);
+        regexp->fa = NULL;
+    }
 }
 
 /*
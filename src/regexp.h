@@ -31,9 +31,18 @@ struct regexp {
     struct info              *info;
     struct string            *pattern;
     struct re_pattern_buffer *re;
+    struct fa                *fa;  /* Automaton for PATTERN, built lazily */
+    struct regexp_table      *table; /* The table this regexp is shared in */
     unsigned int              nocase : 1;
 };
 
+/* A table of regexps, keyed by pattern and case sensitivity, used to
+ * share one struct regexp among all the identical regexp literals in
+ * the modules loaded into a handle. The table does not hold a reference
+ * to its regexps; a regexp removes itself from the table when it is
+ * freed, i.e. when the last module using it is gone */
+struct regexp_table;
+
 void print_regexp(FILE *out, struct regexp *regexp);
 
 /* Make a regexp with pattern PAT, which is not copied. Ownership
@@ -47,6 +56,22 @@ struct regexp *make_regexp(struct info *info, char *pat, int nocase);
 struct regexp *make_regexp_unescape(struct info *info, const char *pat,
                                     int nocase);
 
+/* Make a regexp table. INFO is used for all the regexps in the table,
+ * since they do not belong to any one place in the modules; users of a
+ * shared regexp need to keep track of where they use it themselves. A
+ * reference to INFO is taken.
+ */
+struct regexp_table *make_regexp_table(struct info *info);
+void free_regexp_table(struct regexp_table *table);
+
+/* Return the regexp for pattern PAT from TABLE, adding a new one if
+ * TABLE does not have it yet. PAT is used for the new regexp, or freed
+ * if TABLE already has an entry for it. The returned regexp has its
+ * reference count incremented.
+ */
+struct regexp *regexp_intern(struct regexp_table *table, char *pat,
+                             int nocase);
+
 /* Return 1 if R is an empty pattern, i.e. one consisting of nothing but
    '(' and ')' characters, 0 otherwise */
 int regexp_is_empty_pattern(struct regexp *r);
@@ -114,7 +139,7 @@ regexp_maybe(struct info *info, struct regexp *r);
 struct regexp *regexp_make_empty(struct info *);
 
 /* Free up temporary data structures, most importantly compiled
-   regular expressions */
+   regular expressions and automata. Does nothing for pinned regexps */
 void regexp_release(struct regexp *regexp);
 
 /* Produce a printable representation of R. The result will in general not
@@ -22,6 +22,8 @@
 
 #include <config.h>
 
+#define MEM_SUBSYS MEM_INTERP
+
 #include <assert.h>
 #include <stdarg.h>
 #include <limits.h>
@@ -71,6 +73,7 @@ static const char *const type_names[] = {
 static const char anon_ident[] = "_";
 
 static void print_value(FILE *out, struct value *v);
+static void free_binding(struct binding *binding);
 
 /* The evaluation context with all loaded modules and the bindings for the
  * module we are working on in LOCAL
@@ -79,6 +82,8 @@ struct ctx {
     const char     *name;     /* The module we are working on */
     struct augeas  *aug;
     struct binding *local;
+    char           *deps;     /* argz vector of the modules NAME uses */
+    size_t          deps_len;
 };
 
 static int init_fatal_exn(struct error *error) {
@@ -189,6 +194,7 @@ void free_term(struct term *term) {
         break;
     case A_IDENT:
         unref(term->ident, string);
+        unref(term->global, binding);
         break;
     case A_BRACKET:
         unref(term->brexp, term);
@@ -230,6 +236,8 @@ void free_module(struct module *module) {
         return;
     assert(module->ref == 0);
     free(module->name);
+    free(module->filename);
+    free(module->deps);
     unref(module->next, module);
     unref(module->bindings, binding);
     unref(module->autoload, transform);
@@ -531,6 +539,23 @@ struct lens *lens_lookup(struct augeas *aug, const char *qname) {
     return bnd->value->lens;
 }
 
+/* Remember that the module in CTX uses the module that defines the
+ * qualified NAME */
+static void ctx_add_dep(struct ctx *ctx, const char *name) {
+    char *modname = modname_of_qname(name);
+    const char *dep = NULL;
+
+    if (modname == NULL || STRCASEEQ(modname, ctx->name))
+        goto done;
+    while ((dep = argz_next(ctx->deps, ctx->deps_len, dep)) != NULL) {
+        if (STRCASEEQ(dep, modname))
+            goto done;
+    }
+    argz_add(&ctx->deps, &ctx->deps_len, modname);
+ done:
+    free(modname);
+}
+
 static struct binding *ctx_lookup_bnd(struct info *info,
                                       struct ctx *ctx, const char *name) {
     struct binding *b = NULL;
@@ -546,8 +571,11 @@ static struct binding *ctx_lookup_bnd(struct info *info,
     if (ctx->aug != NULL) {
         int r;
         r = lookup_internal(ctx->aug, ctx->name, name, &b);
-        if (r == 0)
+        if (r == 0) {
+            if (b != NULL)
+                ctx_add_dep(ctx, name);
             return b;
+        }
         char *modname = modname_of_qname(name);
         syntax_error(info, "Could not load module %s for %s",
                      modname, name);
@@ -557,16 +585,47 @@ static struct binding *ctx_lookup_bnd(struct info *info,
     return NULL;
 }
 
-static struct value *ctx_lookup(struct info *info,
-                                struct ctx *ctx, struct string *ident) {
-    struct binding *b = ctx_lookup_bnd(info, ctx, ident->str);
-    return b == NULL ? NULL : b->value;
+/* Resolve the A_IDENT TERM during typechecking, and remember where its
+ * binding lives so that evaluation does not have to search for it by name
+ * again. Return the binding, or NULL if TERM->IDENT is undefined */
+static struct binding *ctx_resolve(struct term *term, struct ctx *ctx) {
+    const char *name = term->ident->str;
+    int nlen = strlen(ctx->name);
+    unsigned int slot = 1;
+
+    assert(term->tag == A_IDENT);
+
+    if (STREQLEN(ctx->name, name, nlen) && name[nlen] == '.')
+        name += nlen + 1;
+
+    list_for_each(b, ctx->local) {
+        if (STREQ(b->ident->str, name)) {
+            term->local_slot = slot;
+            return b;
+        }
+        slot += 1;
+    }
+
+    unref(term->global, binding);
+    term->global = ref(ctx_lookup_bnd(term->info, ctx, term->ident->str));
+    return term->global;
 }
 
-static struct type *ctx_lookup_type(struct info *info,
-                                    struct ctx *ctx, struct string *ident) {
-    struct binding *b = ctx_lookup_bnd(info, ctx, ident->str);
-    return b == NULL ? NULL : b->type;
+/* Look up the value of the A_IDENT TERM in CTX, using the location found
+ * by CTX_RESOLVE */
+static struct value *ctx_lookup(struct term *term, struct ctx *ctx) {
+    struct binding *b;
+
+    if (term->local_slot > 0) {
+        b = ctx->local;
+        for (unsigned int i = 1; i < term->local_slot; i++)
+            b = b->next;
+    } else if (term->global != NULL) {
+        b = term->global;
+    } else {
+        b = ctx_lookup_bnd(term->info, ctx, term->ident->str);
+    }
+    return b == NULL ? NULL : b->value;
 }
 
 /* Takes ownership as needed */
@@ -1236,13 +1295,13 @@ static int check_exp(struct term *term, struct ctx *ctx) {
         break;
     case A_IDENT:
         {
-            struct type *t = ctx_lookup_type(term->info, ctx, term->ident);
-            if (t == NULL) {
+            struct binding *b = ctx_resolve(term, ctx);
+            if (b == NULL) {
                 syntax_error(term->info, "Undefined variable %s",
                              term->ident->str);
                 result = 0;
             } else {
-                term->type = ref(t);
+                term->type = ref(b->type);
             }
         }
         break;
@@ -1330,7 +1389,10 @@ static int check_decl(struct term *term, struct ctx *ctx) {
     return 1;
 }
 
-static int typecheck(struct term *term, struct augeas *aug) {
+/* Typecheck the module TERM. On success, the names of the modules TERM
+ * uses are passed back in the argz vector DEPS */
+static int typecheck(struct term *term, struct augeas *aug,
+                     char **deps, size_t *deps_len) {
     int ok = 1;
     struct ctx ctx;
     char *fname;
@@ -1355,13 +1417,19 @@ static int typecheck(struct term *term, struct augeas *aug) {
     }
     free(fname);
 
+    MEMZERO(&ctx, 1);
     ctx.aug = aug;
-    ctx.local = NULL;
     ctx.name = term->mname;
     list_for_each(dcl, term->decls) {
         ok &= check_decl(dcl, &ctx);
     }
     unref(ctx.local, binding);
+    if (ok) {
+        *deps = ctx.deps;
+        *deps_len = ctx.deps_len;
+    } else {
+        free(ctx.deps);
+    }
     return ok;
 }
 
@@ -1447,6 +1515,15 @@ static struct value *compile_minus(struct term *exp, struct ctx *ctx) {
     return v;
 }
 
+/* Wrap the value V, which has type TYPE, in an A_VALUE term. Takes
+ * ownership of V */
+static struct term *make_value_term(struct value *v, struct type *type) {
+    struct term *term = make_term(A_VALUE, ref(v->info));
+    term->value = v;
+    term->type = ref(type);
+    return term;
+}
+
 static struct value *compile_compose(struct term *exp, struct ctx *ctx) {
     struct info *info = exp->info;
     struct value *v;
@@ -1457,7 +1534,20 @@ static struct value *compile_compose(struct term *exp, struct ctx *ctx) {
         // computation. Should we write function compostion as
         // concatenation instead of using a separate syntax ?
 
-        /* Build lambda x: exp->right (exp->left x) as a closure */
+        /* Build lambda x: exp->right (exp->left x) as a closure. The
+         * functions are evaluated here, since the variables in
+         * exp->left and exp->right were resolved against CTX, not the
+         * environment of the closure */
+        struct value *lv = compile_exp(info, exp->left, ctx);
+        if (EXN(lv))
+            return lv;
+        struct value *rv = compile_exp(info, exp->right, ctx);
+        if (EXN(rv)) {
+            unref(lv, value);
+            return rv;
+        }
+        struct term *left = make_value_term(lv, exp->left->type);
+        struct term *right = make_value_term(rv, exp->right->type);
         char *var = strdup("@0");
         struct term *func = make_param(var, ref(exp->left->type->dom),
                                        ref(info));
@@ -1466,9 +1556,11 @@ static struct value *compile_compose(struct term *exp, struct ctx *ctx) {
         struct term *ident = make_term(A_IDENT, ref(info));
         ident->ident = ref(func->param->name);
         ident->type = ref(func->param->type);
-        struct term *app = make_app_term(ref(exp->left), ident, ref(info));
+        /* The parameter is the innermost binding when the body runs */
+        ident->local_slot = 1;
+        struct term *app = make_app_term(left, ident, ref(info));
         app->type = ref(app->left->type->img);
-        app = make_app_term(ref(exp->right), app, ref(info));
+        app = make_app_term(right, app, ref(info));
         app->type = ref(app->right->type->img);
 
         build_func(func, app);
@@ -1574,6 +1666,7 @@ static struct value *apply(struct term *app, struct ctx *ctx) {
 
     assert(f->tag == V_CLOS);
 
+    MEMZERO(&lctx, 1);
     lctx.aug = ctx->aug;
     lctx.local = ref(f->bindings);
     lctx.name = ctx->name;
@@ -1590,6 +1683,7 @@ static struct value *apply(struct term *app, struct ctx *ctx) {
 
  done:
     unref(lctx.local, binding);
+    free(lctx.deps);
     unref(arg, value);
     unref(f, value);
     return result;
@@ -1676,7 +1770,7 @@ static struct value *compile_exp(struct info *info,
         }
         break;
     case A_IDENT:
-        v = ref(ctx_lookup(exp->info, ctx, exp->ident));
+        v = ref(ctx_lookup(exp, ctx));
         break;
     case A_BRACKET:
         v = compile_bracket(exp, ctx);
@@ -1696,6 +1790,7 @@ static struct value *compile_exp(struct info *info,
 }
 
 static int compile_test(struct term *term, struct ctx *ctx) {
+    unsigned long long start = metrics_clock();
     struct value *actual = compile_exp(term->info, term->test, ctx);
     struct value *expect = NULL;
     int ret = 1;
@@ -1744,6 +1839,11 @@ static int compile_test(struct term *term, struct ctx *ctx) {
         }
     }
  done:
+    if (ctx->aug->flags & AUG_TIME_TESTS) {
+        print_info(stdout, term->info);
+        printf(" test %s (%.3f ms)\n", ret ? "passed" : "failed",
+               (metrics_clock() - start) / 1e6);
+    }
     reset_error(term->info->error);
     unref(actual, value);
     unref(expect, value);
@@ -1788,8 +1888,8 @@ static struct module *compile(struct term *term, struct augeas *aug) {
     struct transform *autoload = NULL;
     assert(term->tag == A_MODULE);
 
+    MEMZERO(&ctx, 1);
     ctx.aug = aug;
-    ctx.local = NULL;
     ctx.name = term->mname;
     list_for_each(dcl, term->decls) {
         if (!compile_decl(dcl, &ctx))
@@ -1810,9 +1910,11 @@ static struct module *compile(struct term *term, struct augeas *aug) {
     struct module *module = module_create(term->mname);
     module->bindings = ctx.local;
     module->autoload = ref(autoload);
+    free(ctx.deps);
     return module;
  error:
     unref(ctx.local, binding);
+    free(ctx.deps);
     return NULL;
 }
 
@@ -1895,7 +1997,7 @@ int define_native_intl(const char *file, int line,
     params = NULL;
     body = NULL;
 
-    ctx.aug = NULL;
+    MEMZERO(&ctx, 1);
     ctx.local = ref(module->bindings);
     ctx.name = module->name;
     if (! check_exp(func, &ctx)) {
@@ -1968,11 +2070,45 @@ static char *module_filename(struct augeas *aug, const char *modname) {
     return filename;
 }
 
+/* Compute a 64 bit FNV-1a hash of the contents of FILENAME. Return 0 if
+ * the file can not be read */
+static uint64_t file_digest(const char *filename) {
+    char *text = xread_file(filename);
+    uint64_t digest = 14695981039346656037ULL;
+
+    if (text == NULL)
+        return 0;
+    for (const unsigned char *p = (unsigned char *) text; *p != '\0'; p++) {
+        digest ^= *p;
+        digest *= 1099511628211ULL;
+    }
+    free(text);
+    return digest;
+}
+
+/* Remember where MODULE came from, so that INTERPRETER_REFRESH can tell
+ * when it needs to be recompiled */
+static void module_set_source(struct module *module, const char *filename,
+                              char *deps, size_t deps_len) {
+    module->filename = canonicalize_file_name(filename);
+    if (module->filename == NULL)
+        module->filename = strdup(filename);
+    module->digest = file_digest(filename);
+    module->deps = deps;
+    module->deps_len = deps_len;
+}
+
 int load_module_file(struct augeas *aug, const char *filename,
                      const char *name) {
     struct term *term = NULL;
+    char *deps = NULL;
+    size_t deps_len = 0;
     int result = -1;
+    /* Modules that this one uses are loaded while compiling it; only the
+       outermost call adds its time, so that it is not counted twice */
+    unsigned long long start = metrics_clock();
 
+    aug->module_depth += 1;
     if (aug->flags & AUG_TRACE_MODULE_LOADING)
         printf("Module %s", filename);
     augl_parse_file(aug, filename, &term);
@@ -1980,7 +2116,7 @@ int load_module_file(struct augeas *aug, const char *filename,
         printf(HAS_ERR(aug) ? " failed\n" : " loaded\n");
     ERR_BAIL(aug);
 
-    if (! typecheck(term, aug))
+    if (! typecheck(term, aug, &deps, &deps_len))
         goto error;
 
     struct module *module = compile(term, aug);
@@ -1992,11 +2128,18 @@ int load_module_file(struct augeas *aug, const char *filename,
         module = module_create(name);
     }
     if (module != NULL) {
+        module_set_source(module, filename, deps, deps_len);
+        deps = NULL;
         list_append(aug->modules, module);
         list_for_each(bnd, module->bindings) {
             if (bnd->value->tag == V_LENS) {
                 lens_release(bnd->value->lens);
             }
+            if (aug->flags & AUG_FREEZE_MODULES) {
+                int r = freeze_value(&aug->frozen, bnd->value);
+                ERR_BAIL(aug);
+                ERR_NOMEM(r < 0, aug);
+            }
         }
     }
     ERR_THROW(bad_module, aug, AUG_ESYNTAX, "Failed to load %s", filename);
@@ -2006,9 +2149,93 @@ int load_module_file(struct augeas *aug, const char *filename,
     // FIXME: This leads to a bad free of a string used in a del lens
     // To reproduce run lenses/tests/test_yum.aug
     unref(term, term);
+    free(deps);
+    aug->module_depth -= 1;
+    METRICS_ADD(aug, module_load,
+                aug->module_depth == 0 ? metrics_clock() - start : 0);
     return result;
 }
 
+bool interpreter_has_file(struct augeas *aug, const char *filename) {
+    char *canon = canonicalize_file_name(filename);
+    bool found = false;
+
+    list_for_each(module, aug->modules) {
+        if (module->filename != NULL
+            && STREQ(module->filename, canon != NULL ? canon : filename)) {
+            found = true;
+            break;
+        }
+    }
+    free(canon);
+    return found;
+}
+
+static bool argz_contains_case(const char *argz, size_t argz_len,
+                               const char *str) {
+    const char *e = NULL;
+    while ((e = argz_next(argz, argz_len, e)) != NULL) {
+        if (STRCASEEQ(e, str))
+            return true;
+    }
+    return false;
+}
+
+int interpreter_refresh(struct augeas *aug) {
+    char *stale = NULL;
+    size_t stale_len = 0;
+    bool changed;
+    int result = 0;
+    int r;
+
+    list_for_each(module, aug->modules) {
+        if (module->filename == NULL)
+            continue;
+        if (file_digest(module->filename) != module->digest) {
+            r = argz_add(&stale, &stale_len, module->name);
+            ERR_NOMEM(r != 0, aug);
+        }
+    }
+
+    /* Anything that uses a stale module is stale, too */
+    do {
+        changed = false;
+        list_for_each(module, aug->modules) {
+            const char *dep = NULL;
+            if (argz_contains_case(stale, stale_len, module->name))
+                continue;
+            while ((dep = argz_next(module->deps, module->deps_len,
+                                    dep)) != NULL) {
+                if (argz_contains_case(stale, stale_len, dep)) {
+                    r = argz_add(&stale, &stale_len, module->name);
+                    ERR_NOMEM(r != 0, aug);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    } while (changed);
+
+    struct module *module = aug->modules;
+    while (module != NULL) {
+        struct module *next = module->next;
+        if (module->filename != NULL
+            && argz_contains_case(stale, stale_len, module->name)) {
+            if (aug->flags & AUG_TRACE_MODULE_LOADING)
+                printf("Module %s changed\n", module->filename);
+            list_remove(module, aug->modules);
+            unref(module, module);
+            result += 1;
+        }
+        module = next;
+    }
+    free(stale);
+    return result;
+ error:
+    free(stale);
+    return -1;
+}
+
 static int load_module(struct augeas *aug, const char *name) {
     char *filename = NULL;
 
@@ -2029,6 +2256,192 @@ static int load_module(struct augeas *aug, const char *name) {
     return -1;
 }
 
+/* Add the names of the modules that TERM, and the terms after it, use
+ * through qualified names like Util.eol to the argz vector DEPS */
+static int term_deps(struct term *term, char **deps, size_t *deps_len) {
+    int r = 0;
+
+    list_for_each(t, term) {
+        switch(t->tag) {
+        case A_MODULE:
+            r = term_deps(t->decls, deps, deps_len);
+            break;
+        case A_BIND:
+            r = term_deps(t->exp, deps, deps_len);
+            break;
+        case A_COMPOSE:
+        case A_UNION:
+        case A_MINUS:
+        case A_CONCAT:
+        case A_APP:
+        case A_LET:
+            r = term_deps(t->left, deps, deps_len);
+            if (r == 0)
+                r = term_deps(t->right, deps, deps_len);
+            break;
+        case A_IDENT: {
+            char *modname = modname_of_qname(t->ident->str);
+            if (modname != NULL
+                && !argz_contains_case(*deps, *deps_len, modname))
+                r = argz_add(deps, deps_len, modname);
+            free(modname);
+            break;
+        }
+        case A_BRACKET:
+            r = term_deps(t->brexp, deps, deps_len);
+            break;
+        case A_FUNC:
+            r = term_deps(t->body, deps, deps_len);
+            break;
+        case A_REP:
+            r = term_deps(t->rexp, deps, deps_len);
+            break;
+        case A_TEST:
+            r = term_deps(t->test, deps, deps_len);
+            if (r == 0)
+                r = term_deps(t->result, deps, deps_len);
+            break;
+        default:
+            break;
+        }
+        if (r != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Parse FILENAME and add the modules it uses to DEPS without loading
+ * them. A file that does not parse uses nothing; the error is left for
+ * whoever loads it for real */
+static int file_deps(struct augeas *aug, const char *filename,
+                     char **deps, size_t *deps_len) {
+    struct term *term = NULL;
+    int r = 0;
+
+    augl_parse_file(aug, filename, &term);
+    if (HAS_ERR(aug))
+        reset_error(aug->error);
+    else
+        r = term_deps(term, deps, deps_len);
+    unref(term, term);
+    return r;
+}
+
+/* A module that interpreter_preload might load */
+struct preload {
+    char   *name;
+    char   *filename;   /* canonical name of its file, or NULL */
+    char   *deps;       /* argz vector of the modules it uses */
+    size_t  deps_len;
+    int     users;      /* number of files that need it */
+    int     last;       /* the last file counted in USERS, plus 1 */
+};
+
+static bool argz_contains(const char *argz, size_t argz_len,
+                          const char *str) {
+    const char *e = NULL;
+    while ((e = argz_next(argz, argz_len, e)) != NULL) {
+        if (STREQ(e, str))
+            return true;
+    }
+    return false;
+}
+
+int interpreter_preload(struct augeas *aug, char **files, int nfiles) {
+    struct preload *mods = NULL;
+    int nmods = 0, loaded = 0, result = -1;
+    char *given = NULL, *todo = NULL;
+    size_t given_len = 0, todo_len = 0;
+    int r;
+
+    for (int i=0; i < nfiles; i++) {
+        char *canon = canonicalize_file_name(files[i]);
+        r = argz_add(&given, &given_len, canon != NULL ? canon : files[i]);
+        free(canon);
+        ERR_NOMEM(r != 0, aug);
+    }
+
+    /* Count for each module how many of FILES use it, directly or
+     * through other modules */
+    for (int i=0; i < nfiles; i++) {
+        r = file_deps(aug, files[i], &todo, &todo_len);
+        ERR_NOMEM(r < 0, aug);
+        while (todo_len > 0) {
+            struct preload *m = NULL;
+            char *name = strdup(todo);
+
+            ERR_NOMEM(name == NULL, aug);
+            argz_delete(&todo, &todo_len, todo);
+            if (module_find(aug->modules, name) != NULL) {
+                free(name);
+                continue;
+            }
+            for (int j=0; j < nmods; j++) {
+                if (STRCASEEQ(mods[j].name, name)) {
+                    m = mods + j;
+                    break;
+                }
+            }
+            if (m == NULL) {
+                char *filename = module_filename(aug, name);
+                if (REALLOC_N(mods, nmods + 1) < 0) {
+                    free(filename);
+                    free(name);
+                    ERR_NOMEM(true, aug);
+                }
+                m = mods + nmods;
+                nmods += 1;
+                MEMZERO(m, 1);
+                m->name = name;
+                if (filename != NULL) {
+                    m->filename = canonicalize_file_name(filename);
+                    r = file_deps(aug, filename, &m->deps, &m->deps_len);
+                    free(filename);
+                    ERR_NOMEM(r < 0, aug);
+                }
+            } else {
+                free(name);
+            }
+            if (m->last != i + 1) {
+                m->last = i + 1;
+                m->users += 1;
+                r = argz_append(&todo, &todo_len, m->deps, m->deps_len);
+                ERR_NOMEM(r != 0, aug);
+            }
+        }
+    }
+
+    /* Load what more than one file needs. If that fails, leave the
+     * module to the files that use it so they report the error */
+    for (int j=0; j < nmods; j++) {
+        struct module *last;
+
+        if (mods[j].users < 2 || mods[j].filename == NULL
+            || argz_contains(given, given_len, mods[j].filename))
+            continue;
+        for (last = aug->modules; last->next != NULL; last = last->next);
+        if (load_module(aug, mods[j].name) < 0) {
+            unref(last->next, module);
+            last->next = NULL;
+            reset_error(aug->error);
+        } else {
+            loaded += 1;
+        }
+    }
+
+    result = loaded;
+ error:
+    for (int j=0; j < nmods; j++) {
+        free(mods[j].name);
+        free(mods[j].filename);
+        free(mods[j].deps);
+    }
+    free(mods);
+    free(given);
+    free(todo);
+    return result;
+}
+
 int interpreter_init(struct augeas *aug) {
     int r;
 
@@ -2036,6 +2449,18 @@ int interpreter_init(struct augeas *aug) {
     if (r < 0)
         return -1;
 
+    aug->regexps = make_regexp_table(aug->error->info);
+    if (aug->regexps == NULL) {
+        report_error(aug->error, AUG_ENOMEM, NULL);
+        return -1;
+    }
+
+    aug->seqs = make_seq_table();
+    if (aug->seqs == NULL) {
+        report_error(aug->error, AUG_ENOMEM, NULL);
+        return -1;
+    }
+
     aug->modules = builtin_init(aug->error);
     if (aug->flags & AUG_NO_MODL_AUTOLOAD)
         return 0;
@@ -88,7 +88,16 @@ struct term {
         };
         struct value    *value;         /* A_VALUE */
         struct term     *brexp;         /* A_BRACKET */
-        struct string   *ident;         /* A_IDENT */
+        struct {                        /* A_IDENT */
+            struct string  *ident;
+            /* Filled in by the typechecker: if IDENT is bound in the
+             * current module or by an enclosing function, LOCAL_SLOT is
+             * one more than the position of its binding in the local
+             * environment. Otherwise, GLOBAL is the binding in another
+             * module that IDENT refers to */
+            unsigned int    local_slot;
+            struct binding *global;
+        };
         struct {                        /* A_REP */
             enum quant_tag quant;
             struct term  *rexp;
@@ -217,6 +226,10 @@ struct module {
     struct transform  *autoload;
     char              *name;
     struct binding    *bindings;
+    char              *filename; /* The file the module was loaded from */
+    uint64_t           digest;   /* Hash of the contents of FILENAME */
+    char              *deps;     /* argz vector of the names of the */
+    size_t             deps_len; /* modules this module refers to */
 };
 
 struct type *make_arrow_type(struct type *dom, struct type *img);
@@ -283,6 +296,27 @@ struct module *builtin_init(struct error *);
 
 int load_module_file(struct augeas *aug, const char *filename, const char *name);
 
+/* Drop all modules whose source file has changed since they were loaded,
+ * and all modules that use them, directly or indirectly, from
+ * AUG->MODULES. They will be recompiled the next time they are needed.
+ *
+ * Return the number of modules dropped, or -1 on error
+ */
+int interpreter_refresh(struct augeas *aug);
+
+/* Return true if a module loaded from FILENAME is in AUG->MODULES */
+bool interpreter_has_file(struct augeas *aug, const char *filename);
+
+/* Load the modules that more than one of the NFILES module files in FILES
+ * use, directly or indirectly, so that they are compiled only once when
+ * the files are loaded later with copies of AUG. Modules that fail to
+ * load are left out, without an error, so that loading the files reports
+ * it.
+ *
+ * Return the number of modules loaded, or -1 on error
+ */
+int interpreter_preload(struct augeas *aug, char **files, int nfiles);
+
 /* The name of the builtin function that checks recursive lenses */
 #define LNS_CHECK_REC_NAME "lns_check_rec"
 
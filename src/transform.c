@@ -29,6 +29,15 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#if HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#if HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 #include <selinux/selinux.h>
 #include <stdbool.h>
 
@@ -38,6 +47,7 @@
 #include "syntax.h"
 #include "transform.h"
 #include "errcode.h"
+#include "hash.h"
 
 static const int fnm_flags = FNM_PATHNAME;
 static const int glob_flags = GLOB_NOSORT;
@@ -106,44 +116,108 @@ static bool is_incl(struct tree *f) {
     return streqv(f->label, "incl") && f->value != NULL;
 }
 
-static bool is_regular_file(const char *path) {
-    int r;
-    struct stat st;
+/* Directories only need to be searched, not read, to serve as the base
+ * for the *at system calls */
+#ifdef O_PATH
+# define DIR_OPEN_FLAGS (O_PATH|O_DIRECTORY|O_CLOEXEC)
+#else
+# define DIR_OPEN_FLAGS (O_RDONLY|O_DIRECTORY|O_CLOEXEC)
+#endif
+
+/* The directory holding the files we are currently working on. We keep
+ * it open so that the system calls for files in it only make the kernel
+ * look up their last component, rather than resolving the whole path
+ * from the root every time, and so that a series of operations on one
+ * file all happen in the same directory even if some directory above it
+ * is renamed or replaced in the meantime.
+ *
+ * DIR is the path of the directory, and FD is -1 if opening it failed,
+ * with ERRNUM the reason for the failure. */
+struct dir_cache {
+    char *dir;
+    int   fd;
+    int   errnum;
+};
 
-    r = stat(path, &st);
-    if (r < 0)
-        return false;
-    return S_ISREG(st.st_mode);
+#define DIR_CACHE_INIT { .dir = NULL, .fd = -1, .errnum = 0 }
+
+static void dir_cache_close(struct dir_cache *dc) {
+    if (dc->fd >= 0)
+        close(dc->fd);
+    FREE(dc->dir);
+    dc->fd = -1;
+    dc->errnum = 0;
 }
 
-static char *mtime_as_string(struct augeas *aug, const char *fname) {
-    int r;
-    struct stat st;
-    char *result = NULL;
+/* Look up the directory containing PATH, opening it unless it is the one
+ * DC already has open. Set *DIRFD to a descriptor for the directory and
+ * *BASE to the last component of PATH.
+ *
+ * Return 0 on success, and -1 with errno set if the directory can not be
+ * opened */
+static int dir_open(struct dir_cache *dc, const char *path,
+                    int *dirfd, const char **base) {
+    const char *slash = strrchr(path, SEP);
+    size_t len;
 
-    if (fname == NULL) {
-        result = strdup("0");
-        ERR_NOMEM(result == NULL, aug);
-        goto done;
+    if (slash == NULL) {
+        *dirfd = AT_FDCWD;
+        *base = path;
+        return 0;
     }
+    *base = slash + 1;
+    len = (slash == path) ? 1 : slash - path;
 
-    r = stat(fname, &st);
-    if (r < 0) {
-        /* If we fail to stat, silently ignore the error
-         * and report an impossible mtime */
-        result = strdup("0");
-        ERR_NOMEM(result == NULL, aug);
-    } else {
-        r = xasprintf(&result, "%ld", (long) st.st_mtime);
-        ERR_NOMEM(r < 0, aug);
+    if (dc->dir == NULL || strlen(dc->dir) != len
+        || STRNEQLEN(dc->dir, path, len)) {
+        dir_cache_close(dc);
+        dc->dir = strndup(path, len);
+        if (dc->dir == NULL)
+            return -1;
+        dc->fd = open(dc->dir, DIR_OPEN_FLAGS);
+        if (dc->fd < 0)
+            dc->errnum = errno;
     }
- done:
-    return result;
- error:
-    FREE(result);
-    return NULL;
+
+    if (dc->fd < 0) {
+        errno = dc->errnum;
+        return -1;
+    }
+    *dirfd = dc->fd;
+    return 0;
 }
 
+/* Stat PATH, following symlinks, through the directory cache DC */
+static int dir_stat(struct dir_cache *dc, const char *path, struct stat *st) {
+    const char *base;
+    int dirfd;
+
+    if (dir_open(dc, path, &dirfd, &base) < 0)
+        return -1;
+    return fstatat(dirfd, base, st, 0);
+}
+
+/* Open PATH for reading through the directory cache DC */
+static int dir_open_file(struct dir_cache *dc, const char *path) {
+    const char *base;
+    int dirfd;
+
+    if (dir_open(dc, path, &dirfd, &base) < 0)
+        return -1;
+    return openat(dirfd, base, O_RDONLY|O_CLOEXEC);
+}
+
+static bool is_regular_file(struct dir_cache *dc, const char *path) {
+    int r;
+    struct stat st;
+
+    r = dir_stat(dc, path, &st);
+    if (r < 0)
+        return false;
+    return S_ISREG(st.st_mode);
+}
+
+
 /* fnmatch(3) which will match // in a pattern to a path, like glob(3) does */
 static int fnmatch_normalize(const char *pattern, const char *string, int flags) {
     int i, j, r;
@@ -171,8 +245,8 @@ static int fnmatch_normalize(const char *pattern, const char *string, int flags)
     return -1;
 }
 
-static bool file_current(struct augeas *aug, const char *fname,
-                         struct tree *finfo) {
+static bool file_current(struct augeas *aug, struct dir_cache *dc,
+                         const char *fname, struct tree *finfo) {
     struct tree *mtime = tree_child(finfo, s_mtime);
     struct tree *file = NULL, *path = NULL;
     int r;
@@ -188,7 +262,7 @@ static bool file_current(struct augeas *aug, const char *fname,
         return false;
     }
 
-    r = stat(fname, &st);
+    r = dir_stat(dc, fname, &st);
     if (r < 0)
         return false;
 
@@ -204,6 +278,7 @@ static bool file_current(struct augeas *aug, const char *fname,
 }
 
 static int filter_generate(struct tree *xfm, const char *root,
+                           struct dir_cache *dc,
                            int *nmatches, char ***matches) {
     glob_t globbuf;
     int gl_flags = glob_flags;
@@ -255,7 +330,7 @@ static int filter_generate(struct tree *xfm, const char *root,
         }
 
         if (include)
-            include = is_regular_file(globbuf.gl_pathv[i]);
+            include = is_regular_file(dc, globbuf.gl_pathv[i]);
 
         if (include) {
             pathv[pathind] = strdup(globbuf.gl_pathv[i]);
@@ -377,11 +452,15 @@ static struct tree *err_lens_entry(struct augeas *aug, struct tree *where,
  * the tree where the lens application happened. When STATUS is NULL, just
  * clear any error associated with FILENAME in the tree.
  */
+static int store_file_error(struct augeas *aug, struct tree *finfo,
+                            const char *path, const char *status, int errnum,
+                            const struct lns_error *err, const char *text);
+
 static int store_error(struct augeas *aug,
                        const char *filename, const char *path,
                        const char *status, int errnum,
                        const struct lns_error *err, const char *text) {
-    struct tree *err_info = NULL, *finfo = NULL;
+    struct tree *finfo = NULL;
     char *fip = NULL;
     int r;
     int result = -1;
@@ -396,6 +475,21 @@ static int store_error(struct augeas *aug,
     finfo = tree_fpath_cr(aug, fip);
     ERR_BAIL(aug);
 
+    result = store_file_error(aug, finfo, path, status, errnum, err, text);
+ error:
+    free(fip);
+    return result;
+}
+
+/* Like store_error, but record the error in the entry FINFO that the
+ * caller already looked up */
+static int store_file_error(struct augeas *aug, struct tree *finfo,
+                            const char *path, const char *status, int errnum,
+                            const struct lns_error *err, const char *text) {
+    struct tree *err_info = NULL;
+    int r;
+    int result = -1;
+
     if (status != NULL) {
         err_info = tree_child_cr(finfo, s_error);
         ERR_NOMEM(err_info == NULL, aug);
@@ -438,36 +532,29 @@ static int store_error(struct augeas *aug,
     tree_clean(finfo);
     result = 0;
  error:
-    free(fip);
     return result;
 }
 
-/* Set up the file information in the /augeas tree.
+/* Fill in the file information in the entry FILE in the /augeas tree.
  *
  * NODE must be the path to the file contents, and start with /files.
- * LENS is the lens used to transform the file.
- * Create entries under /augeas/NODE with some metadata about the file.
+ * LENS_NAME is the name of the lens used to transform the file, and
+ * LENS_INFO where that lens was defined.
+ * ST is the result of stat'ing the file, or NULL if that failed; in that
+ * case, or if FORCE_RELOAD is true, record an impossible mtime.
  *
  * Returns 0 on success, -1 on error
  */
-static int add_file_info(struct augeas *aug, const char *node,
-                         struct lens *lens, const char *lens_name,
-                         const char *filename, bool force_reload) {
-    struct tree *file, *tree;
-    char *tmp = NULL;
+static int set_file_info(struct augeas *aug, struct tree *file,
+                         const char *node, const char *lens_name,
+                         const char *lens_info,
+                         const struct stat *st, bool force_reload) {
+    struct tree *tree;
+    char mtime[3 * sizeof(long) + 2] = "0";
     int r;
-    char *path = NULL;
     int result = -1;
 
-    if (lens == NULL)
-        return -1;
-
-    r = pathjoin(&path, 2, AUGEAS_META_TREE, node);
-    ERR_NOMEM(r < 0, aug);
-
-    file = tree_fpath_cr(aug, path);
     file->file = true;
-    ERR_BAIL(aug);
 
     /* Set 'path' */
     tree = tree_child_cr(file, s_path);
@@ -476,25 +563,18 @@ static int add_file_info(struct augeas *aug, const char *node,
     ERR_NOMEM(r < 0, aug);
 
     /* Set 'mtime' */
-    if (force_reload) {
-        tmp = strdup("0");
-        ERR_NOMEM(tmp == NULL, aug);
-    } else {
-        tmp = mtime_as_string(aug, filename);
-        ERR_BAIL(aug);
-    }
+    if (! force_reload && st != NULL)
+        snprintf(mtime, sizeof(mtime), "%ld", (long) st->st_mtime);
     tree = tree_child_cr(file, s_mtime);
     ERR_NOMEM(tree == NULL, aug);
-    tree_store_value(tree, &tmp);
+    r = tree_set_value(tree, mtime);
+    ERR_NOMEM(r < 0, aug);
 
     /* Set 'lens/info' */
-    tmp = format_info(lens->info);
-    ERR_NOMEM(tmp == NULL, aug);
     tree = tree_path_cr(file, 2, s_lens, s_info);
     ERR_NOMEM(tree == NULL, aug);
-    r = tree_set_value(tree, tmp);
+    r = tree_set_value(tree, lens_info);
     ERR_NOMEM(r < 0, aug);
-    FREE(tmp);
 
     /* Set 'lens' */
     tree = tree->parent;
@@ -504,12 +584,171 @@ static int add_file_info(struct augeas *aug, const char *node,
     tree_clean(file);
 
     result = 0;
+ error:
+    return result;
+}
+
+/* Set up the file information in the /augeas tree.
+ *
+ * NODE must be the path to the file contents, and start with /files.
+ * LENS is the lens used to transform the file.
+ * Create entries under /augeas/NODE with some metadata about the file,
+ * as described for set_file_info.
+ *
+ * Returns 0 on success, -1 on error
+ */
+static int add_file_info(struct augeas *aug, const char *node,
+                         struct lens *lens, const char *lens_name,
+                         const struct stat *st, bool force_reload) {
+    struct tree *file;
+    char *info = NULL;
+    int r;
+    char *path = NULL;
+    int result = -1;
+
+    if (lens == NULL)
+        return -1;
+
+    r = pathjoin(&path, 2, AUGEAS_META_TREE, node);
+    ERR_NOMEM(r < 0, aug);
+
+    file = tree_fpath_cr(aug, path);
+    ERR_BAIL(aug);
+
+    info = format_info(lens->info);
+    ERR_NOMEM(info == NULL, aug);
+
+    result = set_file_info(aug, file, node, lens_name, info, st,
+                           force_reload);
  error:
     free(path);
-    free(tmp);
+    free(info);
     return result;
 }
 
+/* The entries under AUGEAS_META_FILES for the files in one directory,
+ * indexed by their labels, so that finding the entry for each file a
+ * transform loads does not mean scanning all the entries for the other
+ * files in the same directory. Like struct dir_cache, this only
+ * remembers the directory used last.
+ *
+ * PATH is the directory, relative to the root, TREE its node underneath
+ * AUGEAS_META_FILES, or NULL if there is none yet, and FILES maps the
+ * labels of TREE's children to the first child with that label. The
+ * index is only valid while nothing but meta_file adds or removes
+ * children of TREE, i.e., during one transform_load. */
+struct meta_dir {
+    char        *path;
+    struct tree *tree;
+    hash_t      *files;
+};
+
+static void meta_dir_release(struct meta_dir *md) {
+    if (md->files != NULL) {
+        hash_free_nodes(md->files);
+        hash_destroy(md->files);
+    }
+    FREE(md->path);
+    md->tree = NULL;
+    md->files = NULL;
+}
+
+/* Make MD index the directory DIR, which is LEN characters long and
+ * relative to the root */
+static int meta_dir_open(struct augeas *aug, struct meta_dir *md,
+                         const char *dir, size_t len) {
+    char *path = NULL;
+    int r;
+
+    meta_dir_release(md);
+    md->path = strndup(dir, len);
+    ERR_NOMEM(md->path == NULL, aug);
+    md->files = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
+    ERR_NOMEM(md->files == NULL, aug);
+
+    r = xasprintf(&path, "%s%s", AUGEAS_META_FILES, md->path);
+    ERR_NOMEM(r < 0, aug);
+    md->tree = tree_fpath(aug, path);
+    ERR_BAIL(aug);
+    free(path);
+
+    if (md->tree != NULL) {
+        list_for_each(child, md->tree->children) {
+            if (child->label == NULL
+                || hash_lookup(md->files, child->label) != NULL)
+                continue;
+            r = hash_alloc_insert(md->files, child->label, child);
+            ERR_NOMEM(r < 0, aug);
+        }
+    }
+    return 0;
+ error:
+    free(path);
+    meta_dir_release(md);
+    return -1;
+}
+
+/* Find the entry for FNAME underneath AUGEAS_META_FILES, where FNAME is
+ * relative to the root. If there is no entry yet and CREATE is true,
+ * make one; otherwise return NULL. */
+static struct tree *meta_file(struct augeas *aug, struct meta_dir *md,
+                              const char *fname, bool create) {
+    const char *base = strrchr(fname, SEP);
+    char *path = NULL, *label = NULL;
+    hnode_t *node;
+    struct tree *result = NULL;
+    size_t len;
+    int r;
+
+    len = (base == NULL) ? 0 : base - fname;
+    base = (base == NULL) ? fname : base + 1;
+    /* Glob patterns with // produce file names with // in them */
+    while (len > 0 && fname[len - 1] == SEP)
+        len -= 1;
+
+    if (md->path == NULL || strlen(md->path) != len
+        || STRNEQLEN(md->path, fname, len)) {
+        if (meta_dir_open(aug, md, fname, len) < 0)
+            return NULL;
+    }
+
+    node = hash_lookup(md->files, base);
+    if (node != NULL)
+        return hnode_get(node);
+    if (! create)
+        return NULL;
+
+    if (md->tree == NULL) {
+        r = xasprintf(&path, "%s%s", AUGEAS_META_FILES, md->path);
+        ERR_NOMEM(r < 0, aug);
+        md->tree = tree_fpath_cr(aug, path);
+        ERR_BAIL(aug);
+    }
+
+    label = strdup(base);
+    ERR_NOMEM(label == NULL, aug);
+    result = tree_append(md->tree, label, NULL);
+    ERR_NOMEM(result == NULL, aug);
+    label = NULL;
+    r = hash_alloc_insert(md->files, result->label, result);
+    ERR_NOMEM(r < 0, aug);
+ error:
+    free(label);
+    free(path);
+    return result;
+}
+
+/* What transform_load needs while it loads the files one transform
+ * matches. LENS_INFO is where LENS was defined, formatted once for all
+ * files. */
+struct load_state {
+    struct lens      *lens;
+    const char       *lens_name;
+    char             *lens_info;
+    struct dir_cache  dir;
+    struct meta_dir   meta;
+};
+
 static char *append_newline(char *text, size_t len) {
     /* Try to append a newline; this is a big hack to work */
     /* around the fact that lenses generally break if the  */
@@ -541,8 +780,10 @@ static void tree_freplace(struct augeas *aug, const char *fpath,
     ERR_RET(aug);
 
     parent->file = true;
+    parent->lazy = false;
     tree_unlink_children(aug, parent);
     list_append(parent->children, sub);
+    tree_children_changed(parent);
     list_for_each(s, sub) {
         s->parent = parent;
     }
@@ -577,6 +818,74 @@ make_lns_info(struct augeas *aug, const char *filename,
     return NULL;
 }
 
+/* Remember AST, the parse that lns_get kept for the tree at PATH, in place
+ * of any parse we had for PATH before; an AST of NULL forgets the old
+ * parse. Since lns_put checks that the text it is given is the one AST was
+ * made from, a parse that is out of date only costs memory */
+static void store_ast(struct augeas *aug, const char *path,
+                      struct lns_ast *ast) {
+    hnode_t *node = NULL;
+    char *key = NULL;
+    int r;
+
+    if (aug->asts == NULL) {
+        if (ast == NULL)
+            return;
+        aug->asts = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
+        ERR_NOMEM(aug->asts == NULL, aug);
+    }
+
+    node = hash_lookup(aug->asts, path);
+    if (node != NULL) {
+        free_lns_ast(hnode_get(node));
+        if (ast != NULL) {
+            hnode_put(node, ast);
+            return;
+        }
+        key = (char *) hnode_getkey(node);
+        hash_delete_free(aug->asts, node);
+        free(key);
+        return;
+    }
+    if (ast == NULL)
+        return;
+
+    key = strdup(path);
+    ERR_NOMEM(key == NULL, aug);
+    r = hash_alloc_insert(aug->asts, key, ast);
+    ERR_NOMEM(r < 0, aug);
+    return;
+ error:
+    free(key);
+    free_lns_ast(ast);
+}
+
+static struct lns_ast *find_ast(struct augeas *aug, const char *path) {
+    hnode_t *node;
+
+    if (aug->asts == NULL)
+        return NULL;
+    node = hash_lookup(aug->asts, path);
+    return (node == NULL) ? NULL : hnode_get(node);
+}
+
+void transform_free_asts(struct augeas *aug) {
+    hscan_t scan;
+    hnode_t *node;
+
+    if (aug->asts == NULL)
+        return;
+    hash_scan_begin(&scan, aug->asts);
+    while ((node = hash_scan_next(&scan)) != NULL) {
+        char *key = (char *) hnode_getkey(node);
+        free_lns_ast(hnode_get(node));
+        hash_scan_delfree(aug->asts, node);
+        free(key);
+    }
+    hash_destroy(aug->asts);
+    aug->asts = NULL;
+}
+
 /*
  * Do the bookkeeping around calling lns_get that is common to load_file
  * and text_store, in particular, make sure the tree we read gets put into
@@ -594,6 +903,7 @@ static void lens_get(struct augeas *aug,
     struct info *info = NULL;
     struct span *span = NULL;
     struct tree *tree = NULL;
+    struct lns_ast *ast = NULL;
 
     info = make_lns_info(aug, filename, text, text_len);
     ERR_BAIL(aug);
@@ -605,7 +915,10 @@ static void lens_get(struct augeas *aug,
         ERR_NOMEM(span == NULL, info);
     }
 
-    tree = lns_get(info, lens, text, aug->flags & AUG_ENABLE_SPAN, err);
+    tree = lns_get(info, lens, text, aug->flags & AUG_ENABLE_SPAN,
+                   aug->flags & AUG_SHARE_TEXT,
+                   (aug->flags & AUG_KEEP_PARSE) ? &ast : NULL, err);
+    store_ast(aug, path, ast);
 
     if (*err == NULL) {
         // Successful get
@@ -626,30 +939,66 @@ static void lens_get(struct augeas *aug,
     free_tree(tree);
 }
 
-static int load_file(struct augeas *aug, struct lens *lens,
-                     const char *lens_name, char *filename) {
+/* Load FILENAME, which starts with aug->root, with the lens from LS.
+ * FINFO is the file's entry underneath AUGEAS_META_FILES, or NULL if it
+ * does not have one yet */
+static int load_file(struct augeas *aug, struct load_state *ls,
+                     char *filename, struct tree *finfo) {
     char *text = NULL;
     const char *err_status = NULL;
     char *path = NULL;
     struct lns_error *err = NULL;
     int result = -1, r, text_len = 0;
+    int fd = -1, open_errno = 0;
+    FILE *fp = NULL;
+    struct stat st;
+    bool have_st = false;
+    unsigned long long start, read_nsec;
 
     path = file_name_path(aug, filename);
     ERR_NOMEM(path == NULL, aug);
 
-    r = add_file_info(aug, path, lens, lens_name, filename, false);
+    /* Take the mtime from the file we actually read, so that it can not
+       belong to a different version of the file */
+    start = metrics_clock();
+    fd = dir_open_file(&ls->dir, filename);
+    if (fd < 0)
+        open_errno = errno;
+    else
+        have_st = (fstat(fd, &st) == 0);
+    read_nsec = metrics_clock() - start;
+
+    if (finfo == NULL) {
+        finfo = meta_file(aug, &ls->meta, filename + strlen(aug->root) - 1,
+                          true);
+        ERR_BAIL(aug);
+    }
+
+    r = set_file_info(aug, finfo, path, ls->lens_name, ls->lens_info,
+                      have_st ? &st : NULL, false);
     if (r < 0)
         goto done;
 
-    text = xread_file(filename);
+    start = metrics_clock();
+    if (fd >= 0) {
+        fp = fdopen(fd, "r");
+        if (fp == NULL)
+            open_errno = errno;
+        else
+            fd = -1;
+    }
+    text = xfread_file(fp);
+    METRICS_ADD(aug, read, read_nsec + metrics_clock() - start);
     if (text == NULL) {
+        if (fp == NULL)
+            errno = open_errno;
         err_status = "read_failed";
         goto done;
     }
     text_len = strlen(text);
     text = append_newline(text, text_len);
 
-    lens_get(aug, lens, filename, text, text_len, path, &err);
+    lens_get(aug, ls->lens, filename, text, text_len, path, &err);
     if (err != NULL) {
         err_status = "parse_failed";
         goto done;
@@ -658,15 +1007,58 @@ static int load_file(struct augeas *aug, struct lens *lens,
 
     result = 0;
  done:
-    store_error(aug, filename + strlen(aug->root) - 1, path, err_status,
-                errno, err, text);
+    store_file_error(aug, finfo, path, err_status, errno, err, text);
  error:
+    if (fp != NULL)
+        fclose(fp);
+    if (fd >= 0)
+        close(fd);
     free_lns_error(err);
     free(path);
     free(text);
     return result;
 }
 
+/* Instead of loading FILENAME, which starts with aug->root, fill in its
+ * entry FINFO underneath AUGEAS_META_FILES, or make one if FINFO is NULL,
+ * and leave an empty node for it underneath /files that is marked as
+ * lazy. The file is loaded by transform_load_lazy when that node is
+ * first used. */
+static int register_file(struct augeas *aug, struct load_state *ls,
+                         char *filename, struct tree *finfo) {
+    char *path = NULL;
+    struct tree *file;
+    struct stat st;
+    bool have_st;
+    int result = -1, r;
+
+    path = file_name_path(aug, filename);
+    ERR_NOMEM(path == NULL, aug);
+
+    if (finfo == NULL) {
+        finfo = meta_file(aug, &ls->meta, filename + strlen(aug->root) - 1,
+                          true);
+        ERR_BAIL(aug);
+    }
+
+    have_st = (dir_stat(&ls->dir, filename, &st) == 0);
+    r = set_file_info(aug, finfo, path, ls->lens_name, ls->lens_info,
+                      have_st ? &st : NULL, false);
+    if (r < 0)
+        goto error;
+
+    file = tree_fpath_cr(aug, path);
+    ERR_BAIL(aug);
+    tree_unlink_children(aug, file);
+    file->file = true;
+    file->lazy = true;
+
+    result = store_file_error(aug, finfo, path, NULL, 0, NULL, NULL);
+ error:
+    free(path);
+    return result;
+}
+
 /* The lens for a transform can be referred to in one of two ways:
  * either by a fully qualified name "Module.lens" or by the special
  * syntax "@Module"; the latter means we should take the lens from the
@@ -770,6 +1162,8 @@ int transform_validate(struct augeas *aug, struct tree *xfm) {
                        && t->value[0] != SEP) {
             /* Normalize relative paths to absolute ones */
             int r;
+            r = tree_own_value(t);
+            ERR_NOMEM(r < 0, aug);
             r = REALLOC_N(t->value, strlen(t->value) + 2);
             ERR_NOMEM(r < 0, aug);
             memmove(t->value + 1, t->value, strlen(t->value) + 1);
@@ -834,45 +1228,44 @@ void transform_file_error(struct augeas *aug, const char *status,
     free(msg);
 }
 
-static struct tree *file_info(struct augeas *aug, const char *fname) {
-    char *path = NULL;
-    struct tree *result = NULL;
-    int r;
-
-    r = pathjoin(&path, 2, AUGEAS_META_FILES, fname);
-    ERR_NOMEM(r < 0, aug);
-
-    result = tree_fpath(aug, path);
-    ERR_BAIL(aug);
- error:
-    free(path);
-    return result;
-}
-
 int transform_load(struct augeas *aug, struct tree *xfm, const char *file) {
     int nmatches = 0;
-    char **matches;
+    char **matches = NULL;
+    struct load_state ls;
+    struct lens *lens;
     const char *lens_name;
-    struct lens *lens = xfm_lens(aug, xfm, &lens_name);
-    int r;
+    int r, result = -1;
+    unsigned long long start;
 
+    MEMZERO(&ls, 1);
+    ls.dir.fd = -1;
+
+    lens = xfm_lens(aug, xfm, &lens_name);
     if (lens == NULL) {
         // FIXME: Record an error and return 0
         return -1;
     }
+    ls.lens = lens;
+    ls.lens_name = lens_name;
+    ls.lens_info = format_info(lens->info);
+    ERR_NOMEM(ls.lens_info == NULL, aug);
 
-    r = filter_generate(xfm, aug->root, &nmatches, &matches);
+    start = metrics_clock();
+    r = filter_generate(xfm, aug->root, &ls.dir, &nmatches, &matches);
+    METRICS_STOP(aug, glob, start);
     if (r == -1)
-        return -1;
+        goto error;
     for (int i=0; i < nmatches; i++) {
         const char *filename = matches[i] + strlen(aug->root) - 1;
-        struct tree *finfo = file_info(aug, filename);
+        struct tree *finfo;
 
         if (file != NULL && STRNEQ(filename, file)) {
             FREE(matches[i]);
             continue;
         }
 
+        finfo = meta_file(aug, &ls.meta, filename, false);
+
         if (finfo != NULL && !finfo->dirty &&
             tree_child(finfo, s_lens) != NULL) {
             /* We have a potential conflict: since FINFO is not marked as
@@ -894,16 +1287,107 @@ int transform_load(struct augeas *aug, struct tree *xfm, const char *file) {
                 aug_rm(aug, fpath);
                 free(fpath);
             }
-        } else if (!file_current(aug, matches[i], finfo)) {
-            load_file(aug, lens, lens_name, matches[i]);
+        } else if (!file_current(aug, &ls.dir, matches[i], finfo)) {
+            if (file == NULL && (aug->flags & AUG_LAZY_LOAD))
+                register_file(aug, &ls, matches[i], finfo);
+            else
+                load_file(aug, &ls, matches[i], finfo);
         }
         if (finfo != NULL)
             finfo->dirty = 0;
         FREE(matches[i]);
     }
+    result = 0;
+ error:
+    dir_cache_close(&ls.dir);
+    meta_dir_release(&ls.meta);
+    free(ls.lens_info);
     lens_release(lens);
     free(matches);
-    return 0;
+    return result;
+}
+
+/* Return the name of the file for the node FILE underneath /files,
+ * relative to the root, i.e. the labels of FILE and its ancestors below
+ * /files joined with '/', or NULL if FILE is not underneath /files */
+static char *file_name_of_tree(struct tree *file) {
+    size_t len = 0;
+    struct tree *t;
+    char *result = NULL, *p;
+
+    for (t = file; !ROOT_P(t); t = t->parent) {
+        if (t->label == NULL)
+            return NULL;
+        len += strlen(t->label) + 1;
+    }
+    if (t == file || ! streqv(t->label, AUGEAS_FILES_TREE + 1))
+        return NULL;
+
+    if (ALLOC_N(result, len + 1) < 0)
+        return NULL;
+    p = result + len;
+    for (t = file; !ROOT_P(t); t = t->parent) {
+        size_t l = strlen(t->label);
+        p -= l;
+        memcpy(p, t->label, l);
+        *--p = SEP;
+    }
+    return result;
+}
+
+int transform_load_lazy(struct augeas *aug, struct tree *file) {
+    struct load_state ls;
+    struct tree *finfo, *lens;
+    char *fname = NULL, *meta = NULL, *filename = NULL;
+    int result = -1, r;
+
+    MEMZERO(&ls, 1);
+    ls.dir.fd = -1;
+    file->lazy = false;
+
+    fname = file_name_of_tree(file);
+    if (fname == NULL) {
+        result = 0;
+        goto error;
+    }
+
+    r = pathjoin(&meta, 2, AUGEAS_META_FILES, fname);
+    ERR_NOMEM(r < 0, aug);
+    finfo = tree_fpath(aug, meta);
+    ERR_BAIL(aug);
+
+    /* The entry for the file might have been removed since it was
+       registered, in which case we don't know how to load it anymore */
+    lens = (finfo == NULL) ? NULL : tree_child(finfo, s_lens);
+    if (lens == NULL || lens->value == NULL) {
+        result = 0;
+        goto error;
+    }
+
+    ls.lens_name = lens->value;
+    ls.lens = lens_from_name(aug, ls.lens_name);
+    ERR_BAIL(aug);
+    ls.lens_info = format_info(ls.lens->info);
+    ERR_NOMEM(ls.lens_info == NULL, aug);
+
+    r = xasprintf(&filename, "%s%s", aug->root, fname + 1);
+    ERR_NOMEM(r < 0, aug);
+
+    result = load_file(aug, &ls, filename, finfo);
+
+    /* The new contents of FILE are as clean as if aug_load had loaded
+       them */
+    file->dirty = true;
+    tree_clean(file);
+ error:
+    dir_cache_close(&ls.dir);
+    meta_dir_release(&ls.meta);
+    free(ls.lens_info);
+    lens_release(ls.lens);
+    free(fname);
+    free(meta);
+    free(filename);
+    return result;
 }
 
 int transform_applies(struct tree *xfm, const char *path) {
@@ -913,23 +1397,18 @@ int transform_applies(struct tree *xfm, const char *path) {
     return filter_matches(xfm, path + strlen(AUGEAS_FILES_TREE));
 }
 
-static int transfer_file_attrs(FILE *from, FILE *to,
+static int transfer_file_attrs(int from_fd, int to_fd,
                                const char **err_status) {
     struct stat st;
     int ret = 0;
     int selinux_enabled = (is_selinux_enabled() > 0);
     security_context_t con = NULL;
 
-    int from_fd;
-    int to_fd = fileno(to);
-
-    if (from == NULL) {
+    if (from_fd < 0) {
         *err_status = "replace_from_missing";
         return -1;
     }
 
-    from_fd = fileno(from);
-
     ret = fstat(from_fd, &st);
     if (ret < 0) {
         *err_status = "replace_stat";
@@ -960,6 +1439,110 @@ static int transfer_file_attrs(FILE *from, FILE *to,
     return 0;
 }
 
+/* Copy the contents of the file open on FROM_FD to the empty file open on
+ * TO_FD. Try to share the data with a reflink first, then copy within the
+ * kernel with copy_file_range or sendfile, and only read and write the
+ * data ourselves if none of them is available for these files.
+ *
+ * Return 0 on success, and -1 with *ERR_STATUS set on failure */
+static int copy_contents(int from_fd, int to_fd, const char **err_status) {
+    char buf[BUFSIZ];
+    ssize_t len;
+
+#ifdef FICLONE
+    if (ioctl(to_fd, FICLONE, from_fd) == 0)
+        return 0;
+#endif
+
+#if HAVE_COPY_FILE_RANGE
+    while ((len = copy_file_range(from_fd, NULL, to_fd, NULL,
+                                  SSIZE_MAX, 0)) > 0);
+    if (len == 0)
+        return 0;
+    if (errno != ENOSYS && errno != EXDEV && errno != EINVAL
+        && errno != EOPNOTSUPP) {
+        *err_status = "clone_copy_range";
+        return -1;
+    }
+#endif
+
+#if HAVE_SENDFILE && HAVE_SYS_SENDFILE_H
+    while ((len = sendfile(to_fd, from_fd, NULL, SSIZE_MAX)) > 0);
+    if (len == 0)
+        return 0;
+    if (errno != ENOSYS && errno != EINVAL) {
+        *err_status = "clone_sendfile";
+        return -1;
+    }
+#endif
+
+    /* Whatever the calls above copied before failing has advanced both
+     * file offsets, so we can simply copy the rest */
+    while ((len = read(from_fd, buf, sizeof(buf))) != 0) {
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            *err_status = "clone_read";
+            return -1;
+        }
+        for (ssize_t done = 0, n; done < len; done += n) {
+            n = write(to_fd, buf + done, len - done);
+            if (n < 0 && errno == EINTR) {
+                n = 0;
+            } else if (n < 0) {
+                *err_status = "clone_write";
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Copy the contents and attributes of FROM in the directory FROM_DIR
+ * into TO in the directory TO_DIR. If EXCL is true, TO must not exist
+ * yet, otherwise it is truncated. TO is removed if the copy fails.
+ *
+ * Return 0 on success, and -1 with *ERR_STATUS set on failure */
+static int copy_file(int from_dir, const char *from,
+                     int to_dir, const char *to, int excl,
+                     const char **err_status) {
+    int from_fd = -1, to_fd = -1, to_oflags;
+    int result = -1;
+
+    if ((from_fd = openat(from_dir, from, O_RDONLY|O_CLOEXEC)) < 0) {
+        *err_status = "clone_open_src";
+        goto done;
+    }
+
+    to_oflags = O_WRONLY|O_CREAT|O_CLOEXEC|(excl ? O_EXCL : O_TRUNC);
+    if ((to_fd = openat(to_dir, to, to_oflags, S_IRUSR|S_IWUSR)) < 0) {
+        *err_status = "clone_open_dst";
+        goto done;
+    }
+
+    if (transfer_file_attrs(from_fd, to_fd, err_status) < 0)
+        goto done;
+
+    if (copy_contents(from_fd, to_fd, err_status) < 0)
+        goto done;
+
+    if (fsync(to_fd) < 0) {
+        *err_status = "clone_sync";
+        goto done;
+    }
+    result = 0;
+ done:
+    if (from_fd >= 0)
+        close(from_fd);
+    if (to_fd >= 0 && close(to_fd) < 0 && result == 0) {
+        *err_status = "clone_close_dst";
+        result = -1;
+    }
+    if (result != 0 && to_fd >= 0)
+        unlinkat(to_dir, to, 0);
+    return result;
+}
+
 /* Try to rename FROM to TO. If that fails with an error other than EXDEV
  * or EBUSY, return -1. If the failure is EXDEV or EBUSY (which we assume
  * means that FROM or TO is a bindmounted file), and COPY_IF_RENAME_FAILS
@@ -973,16 +1556,13 @@ static int transfer_file_attrs(FILE *from, FILE *to,
  * Return 0 on success (either rename succeeded or we copied the contents
  * over successfully), -1 on failure.
  */
-static int clone_file(const char *from, const char *to,
+static int clone_file(int from_dir, const char *from,
+                      int to_dir, const char *to,
                       const char **err_status, int copy_if_rename_fails,
                       int unlink_if_rename_fails) {
-    FILE *from_fp = NULL, *to_fp = NULL;
-    char buf[BUFSIZ];
-    size_t len;
-    int to_fd = -1, to_oflags, r;
-    int result = -1;
+    int r;
 
-    if (rename(from, to) == 0)
+    if (renameat(from_dir, from, to_dir, to) == 0)
         return 0;
     if ((errno != EXDEV && errno != EBUSY) || !copy_if_rename_fails) {
         *err_status = "rename";
@@ -990,68 +1570,205 @@ static int clone_file(const char *from, const char *to,
     }
 
     /* rename not possible, copy file contents */
-    if (!(from_fp = fopen(from, "r"))) {
-        *err_status = "clone_open_src";
-        goto done;
-    }
-
     if (unlink_if_rename_fails) {
-        r = unlink(to);
-        if (r < 0) {
+        r = unlinkat(to_dir, to, 0);
+        if (r < 0 && errno != ENOENT) {
             *err_status = "clone_unlink_dst";
-            goto done;
+            return -1;
         }
     }
 
-    to_oflags = unlink_if_rename_fails ? O_EXCL : O_TRUNC;
-    if ((to_fd = open(to, O_WRONLY|O_CREAT|to_oflags, S_IRUSR|S_IWUSR)) < 0) {
-        *err_status = "clone_open_dst";
-        goto done;
+    r = copy_file(from_dir, from, to_dir, to, unlink_if_rename_fails,
+                  err_status);
+    if (r == 0)
+        unlinkat(from_dir, from, 0);
+    return r;
+}
+
+/* Make BACKUP a hard link to ORIG, replacing any existing BACKUP. Unlike
+ * moving ORIG out of the way, this leaves ORIG in place until the new
+ * contents are renamed over it, and it does not copy any data. Since a
+ * hard link can not cross mount points, it fails in the same situations
+ * in which renaming the new contents over ORIG would fail, so that we
+ * never have to write the new contents into ORIG while BACKUP still
+ * shares it.
+ *
+ * Return 0 on success, -1 if the link could not be made; in that case
+ * BACKUP does not exist */
+static int link_backup(int orig_dir, const char *orig,
+                       int backup_dir, const char *backup) {
+    if (unlinkat(backup_dir, backup, 0) < 0 && errno != ENOENT)
+        return -1;
+    return linkat(orig_dir, orig, backup_dir, backup, 0);
+}
+
+/* How often we try to come up with an unused name for a temp file */
+#define TEMP_TRIES 100
+
+/* Replace the trailing XXXXXX in TEMPLATE with random characters, the
+ * same way mkstemp(3) does. ATTEMPT is the number of names tried so far.
+ * Everything that goes into the name is local to the call, so that
+ * threads using different handles do not share any state here */
+static void fill_temp_template(char *template, int attempt) {
+    static const char letters[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    char *x = template + strlen(template) - 6;
+    struct timespec ts;
+    uint64_t v;
+
+    /* Threads in the same process differ in the addresses of their stack
+     * and of TEMPLATE; mix everything with the finalizer of splitmix64 so
+     * that each input affects all letters */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    v = ((uint64_t) ts.tv_nsec << 16) ^ (uint64_t) ts.tv_sec
+        ^ ((uint64_t) getpid() << 32) ^ (uint64_t) (uintptr_t) &ts
+        ^ ((uint64_t) (uintptr_t) x << 7)
+        ^ ((uint64_t) attempt * UINT64_C(0x9E3779B97F4A7C15));
+    v = (v ^ (v >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    v = (v ^ (v >> 27)) * UINT64_C(0x94D049BB133111EB);
+    v ^= v >> 31;
+    for (int i=0; i < 6; i++) {
+        x[i] = letters[v % (sizeof(letters) - 1)];
+        v /= sizeof(letters) - 1;
     }
-    if (!(to_fp = fdopen(to_fd, "w"))) {
-        *err_status = "clone_fdopen_dst";
-        goto done;
+}
+
+/* Create a new file for writing in the directory DIRFD, readable and
+ * writable only by us. If UNNAMED is true and the kernel supports
+ * O_TMPFILE, the file is created without a name, so that nobody can see
+ * it before it has been written completely, and *NAMED is set to false;
+ * name_temp must then give it a name. Otherwise, the file is created
+ * under a name made from TEMPLATE, whose last six characters must be
+ * XXXXXX and are changed to make the name unique, and *NAMED is set to
+ * true.
+ *
+ * Return the descriptor for the file, or -1 on error */
+static int open_temp(int dirfd, char *template, bool unnamed, bool *named) {
+    int fd;
+
+#ifdef O_TMPFILE
+    if (unnamed) {
+        fd = openat(dirfd, ".", O_TMPFILE|O_WRONLY|O_CLOEXEC,
+                    S_IRUSR|S_IWUSR);
+        if (fd >= 0) {
+            *named = false;
+            return fd;
+        }
+        /* Older kernels and some file systems do not support O_TMPFILE */
+        if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)
+            return -1;
     }
+#endif
+    *named = true;
+    for (int i=0; i < TEMP_TRIES; i++) {
+        fill_temp_template(template, i);
+        fd = openat(dirfd, template, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC,
+                    S_IRUSR|S_IWUSR);
+        if (fd >= 0 || errno != EEXIST)
+            return fd;
+    }
+    return -1;
+}
 
-    if (transfer_file_attrs(from_fp, to_fp, err_status) < 0)
-        goto done;
+/* Give the unnamed file open on FD a name in the directory DIRFD made from
+ * TEMPLATE like open_temp does.
+ *
+ * Return 0 on success, and -1 on error */
+static int name_temp(int fd, int dirfd, char *template) {
+    char proc_path[sizeof("/proc/self/fd/") + 3 * sizeof(int)];
+
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+    for (int i=0; i < TEMP_TRIES; i++) {
+        fill_temp_template(template, i);
+        if (linkat(AT_FDCWD, proc_path, dirfd, template,
+                   AT_SYMLINK_FOLLOW) == 0)
+            return 0;
+#ifdef AT_EMPTY_PATH
+        /* Without /proc, this works if we are privileged enough */
+        if (errno == ENOENT
+            && linkat(fd, "", dirfd, template, AT_EMPTY_PATH) == 0)
+            return 0;
+#endif
+        if (errno != EEXIST)
+            return -1;
+    }
+    return -1;
+}
 
-    while ((len = fread(buf, 1, BUFSIZ, from_fp)) > 0) {
-        if (fwrite(buf, 1, len, to_fp) != len) {
-            *err_status = "clone_write";
-            goto done;
+/* Write the SIZE bytes in BUF into a new temp file in the directory
+ * DIRFD, named after TEMPLATE as described for open_temp. If ORIG_EXISTS,
+ * give the temp file the owner, permissions and SELinux context of the
+ * file open on ORIG_FD; otherwise, give it the permissions implied by the
+ * umask.
+ *
+ * Return 0 on success, and -1 with *ERR_STATUS set on failure, in which
+ * case no temp file is left behind */
+static int write_temp(int dirfd, char *template, int orig_fd,
+                      bool orig_exists, const char *buf, size_t size,
+                      const char **err_status) {
+    bool unnamed = true, named = false;
+    int fd, saved_errno;
+
+ retry:
+    fd = open_temp(dirfd, template, unnamed, &named);
+    if (fd < 0) {
+        *err_status = "mk_augtemp";
+        return -1;
+    }
+
+    if (orig_exists) {
+        if (transfer_file_attrs(orig_fd, fd, err_status) != 0)
+            goto error;
+    } else {
+        /* The temp file was created with secure permissions instead of
+         * those implied by umask, so change them for new files */
+        mode_t curumsk = umask(022);
+        umask(curumsk);
+
+        if (fchmod(fd, 0666 & ~curumsk) < 0) {
+            *err_status = "create_chmod";
+            goto error;
         }
     }
-    if (ferror(from_fp)) {
-        *err_status = "clone_read";
-        goto done;
+
+    for (size_t done = 0; done < size; ) {
+        ssize_t n = write(fd, buf + done, size - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            *err_status = "error_augtemp";
+            goto error;
+        }
+        done += n;
     }
-    if (fflush(to_fp) != 0) {
-        *err_status = "clone_flush";
-        goto done;
+
+    if (fsync(fd) < 0) {
+        *err_status = "sync_augtemp";
+        goto error;
     }
-    if (fsync(fileno(to_fp)) < 0) {
-        *err_status = "clone_sync";
-        goto done;
+
+    if (!named && name_temp(fd, dirfd, template) < 0) {
+        /* Without /proc, we may not be able to link the unnamed file
+           into the directory; write a named one instead */
+        close(fd);
+        unnamed = false;
+        goto retry;
     }
-    result = 0;
- done:
-    if (from_fp != NULL)
-        fclose(from_fp);
-    if (to_fp != NULL) {
-        if (fclose(to_fp) != 0) {
-            *err_status = "clone_fclose_dst";
-            result = -1;
-        }
-    } else if (to_fd >= 0 && close(to_fd) < 0) {
-        *err_status = "clone_close_dst";
-        result = -1;
+
+    if (close(fd) < 0) {
+        fd = -1;
+        *err_status = "close_augtemp";
+        goto error;
     }
-    if (result != 0)
-        unlink(to);
-    if (result == 0)
-        unlink(from);
-    return result;
+    return 0;
+ error:
+    saved_errno = errno;
+    if (fd >= 0)
+        close(fd);
+    if (named)
+        unlinkat(dirfd, template, 0);
+    errno = saved_errno;
+    return -1;
 }
 
 static char *strappend(const char *s1, const char *s2) {
@@ -1095,13 +1812,20 @@ static int file_saved_event(struct augeas *aug, const char *path) {
 /*
  * Do the bookkeeping around calling LNS_PUT that's needed to update the
  * span after writing a tree to file
+ *
+ * If COMPARE is true, nothing is written to OUT as long as the output is
+ * identical to TEXT. Return 0 if the output was identical to TEXT, and 1
+ * otherwise.
  */
-static void lens_put(struct augeas *aug, const char *filename,
-                     struct lens *lens, const char *text, struct tree *tree,
-                     FILE *out, struct lns_error **err) {
+static int lens_put(struct augeas *aug, const char *filename,
+                    const char *path, struct lens *lens, const char *text,
+                    struct tree *tree, FILE *out, bool compare,
+                    struct lns_error **err) {
     struct info *info = NULL;
+    struct lns_ast *ast = find_ast(aug, path);
     size_t text_len = strlen(text);
     bool with_span = aug->flags & AUG_ENABLE_SPAN;
+    int changed = 1;
 
     info = make_lns_info(aug, filename, text, text_len);
     ERR_BAIL(aug);
@@ -1114,14 +1838,23 @@ static void lens_put(struct augeas *aug, const char *filename,
         tree->span->span_start = ftell(out);
     }
 
-    lns_put(info, out, lens, tree->children, text,
-            aug->flags & AUG_ENABLE_SPAN, err);
+    if (compare) {
+        changed = lns_put_changed(info, out, lens, tree->children, text, ast,
+                                  aug->flags & AUG_ENABLE_SPAN, err);
+    } else {
+        lns_put(info, out, lens, tree->children, text, ast,
+                aug->flags & AUG_ENABLE_SPAN, err);
+    }
 
     if (with_span) {
-        tree->span->span_end = ftell(out);
+        if (changed)
+            tree->span->span_end = ftell(out);
+        else
+            tree->span->span_end = tree->span->span_start + text_len;
     }
  error:
     unref(info, info);
+    return changed;
 }
 
 /*
@@ -1131,7 +1864,10 @@ static void lens_put(struct augeas *aug, const char *filename,
  *
  * Writing the file happens by first writing into a temp file, transferring all
  * file attributes of PATH to the temp file, and then renaming the temp file
- * back to PATH.
+ * back to PATH. All of that happens relative to a descriptor for the
+ * directory containing PATH, which we only look up once. Where possible, the
+ * temp file is created with O_TMPFILE and only linked into the directory
+ * once it has been written completely.
  *
  * Temp files are created alongside the destination file to enable the rename,
  * which may be the canonical path (PATH_canon) if PATH is a symlink.
@@ -1143,6 +1879,11 @@ static void lens_put(struct augeas *aug, const char *filename,
  * If the rename fails, and the entry AUGEAS_COPY_IF_FAILURE exists in
  * AUG->ORIGIN, PATH is instead overwritten by copying file contents.
  *
+ * The tree is rendered into memory first and compared against the
+ * current contents of PATH as it is produced. If they are the same, no
+ * temp file is created and PATH is left alone, and PATH is not listed
+ * under AUGEAS_EVENTS_SAVED.
+ *
  * The table below shows the locations for each permutation.
  *
  * PATH       save flag    temp file           dest file      backup?
@@ -1153,16 +1894,27 @@ static void lens_put(struct augeas *aug, const char *filename,
  * symlink    BACKUP       PATH_canon.XXXX     PATH_canon     PATH.augsave
  * symlink    NEWFILE      PATH.augnew.XXXX    PATH.augnew    -
  *
- * Return 0 on success, -1 on failure.
+ * Return 0 if PATH was unchanged, 1 if it was written (or would have been
+ * written with AUG_SAVE_NOOP), and -1 on failure.
  */
 int transform_save(struct augeas *aug, struct tree *xfm,
                    const char *path, struct tree *tree) {
     int   fd;
-    FILE *fp = NULL, *augorig_canon_fp = NULL;
+    FILE *augorig_canon_fp = NULL;
+    struct dir_cache orig_dir = DIR_CACHE_INIT, canon_dir = DIR_CACHE_INIT;
+    struct dir_cache *dest_dir;
+    int   dest_dirfd, save_dirfd = AT_FDCWD;
+    const char *dest_base, *save_base = NULL;
+    struct stat st;
+    bool  have_st;
+    struct memstream ms;
+    bool ms_open = false;
+    int   changed;
     char *augtemp = NULL, *augnew = NULL, *augorig = NULL, *augsave = NULL;
     char *augorig_canon = NULL, *augdest = NULL;
     int   augorig_exists;
     int   copy_if_rename_fails = 0;
+    bool  backup_linked = false;
     char *text = NULL;
     const char *filename = path + strlen(AUGEAS_FILES_TREE) + 1;
     const char *err_status = NULL;
@@ -1173,7 +1925,9 @@ int transform_save(struct augeas *aug, struct tree *xfm,
     int result = -1, r;
     bool force_reload;
     struct info *info = NULL;
+    unsigned long long start;
 
+    MEMZERO(&ms, 1);
     errno = 0;
 
     if (lens == NULL) {
@@ -1181,6 +1935,15 @@ int transform_save(struct augeas *aug, struct tree *xfm,
         goto done;
     }
 
+    /* A file that AUG_LAZY_LOAD registered becomes dirty without being
+       loaded when only the value of its node changes; rendering its empty
+       subtree would wipe out the file. Load it first, and leave the file
+       alone if that fails; load_file has recorded the error already */
+    if (tree != NULL && tree->lazy) {
+        if (transform_load_lazy(aug, tree) < 0)
+            goto error;
+    }
+
     copy_if_rename_fails =
         aug_get(aug, AUGEAS_COPY_IF_RENAME_FAILS, NULL) == 1;
 
@@ -1201,9 +1964,14 @@ int transform_save(struct augeas *aug, struct tree *xfm,
         }
     }
 
-    if (access(augorig_canon, R_OK) == 0) {
-        augorig_canon_fp = fopen(augorig_canon, "r");
+    start = metrics_clock();
+    fd = dir_open_file(&canon_dir, augorig_canon);
+    if (fd >= 0) {
+        augorig_canon_fp = fdopen(fd, "r");
+        if (augorig_canon_fp == NULL)
+            close(fd);
         text = xfread_file(augorig_canon_fp);
+        METRICS_STOP(aug, read, start);
     } else {
         text = strdup("");
     }
@@ -1215,107 +1983,83 @@ int transform_save(struct augeas *aug, struct tree *xfm,
 
     text = append_newline(text, strlen(text));
 
-    /* Figure out where to put the .augnew and temp file. If no .augnew file
-       then put the temp file next to augorig_canon, else next to .augnew. */
-    if (aug->flags & AUG_SAVE_NEWFILE) {
-        if (xasprintf(&augnew, "%s" EXT_AUGNEW, augorig) < 0) {
-            err_status = "augnew_oom";
-            goto done;
-        }
-        augdest = augnew;
+    /* Render the tree into memory first; if the result is identical to
+       what is in the file already, there is nothing to do, and we do not
+       touch the file system at all */
+    r = init_memstream(&ms);
+    if (r < 0) {
+        err_status = "init_memstream";
+        goto done;
+    }
+    ms_open = true;
+
+    if (tree != NULL) {
+        changed = lens_put(aug, augorig_canon, path, lens, text, tree,
+                           ms.stream, true, &err);
+        ERR_BAIL(aug);
     } else {
-        augdest = augorig_canon;
+        changed = (*text != '\0');
     }
 
-    if (xasprintf(&augtemp, "%s.XXXXXX", augdest) < 0) {
-        err_status = "augtemp_oom";
+    r = close_memstream(&ms);
+    ms_open = false;
+    if (r < 0) {
+        err_status = "close_memstream";
         goto done;
     }
 
-    // FIXME: We might have to create intermediate directories
-    // to be able to write augnew, but we have no idea what permissions
-    // etc. they should get. Just the process default ?
-    fd = mkstemp(augtemp);
-    if (fd < 0) {
-        err_status = "mk_augtemp";
+    if (err != NULL) {
+        err_status = err->pos >= 0 ? "parse_skel_failed" : "put_failed";
         goto done;
     }
-    fp = fdopen(fd, "w");
-    if (fp == NULL) {
-        err_status = "open_augtemp";
+
+    if (! changed) {
+        result = 0;
+        goto done;
+    } else if (aug->flags & AUG_SAVE_NOOP) {
+        result = 1;
         goto done;
     }
 
-    if (augorig_exists) {
-        if (transfer_file_attrs(augorig_canon_fp, fp, &err_status) != 0) {
+    /* Figure out where to put the .augnew and temp file. If no .augnew file
+       then put the temp file next to augorig_canon, else next to .augnew. */
+    if (aug->flags & AUG_SAVE_NEWFILE) {
+        if (xasprintf(&augnew, "%s" EXT_AUGNEW, augorig) < 0) {
+            err_status = "augnew_oom";
             goto done;
         }
+        augdest = augnew;
+        dest_dir = &orig_dir;
     } else {
-        /* Since mkstemp is used, the temp file will have secure permissions
-         * instead of those implied by umask, so change them for new files */
-        mode_t curumsk = umask(022);
-        umask(curumsk);
-
-        if (fchmod(fileno(fp), 0666 & ~curumsk) < 0) {
-            err_status = "create_chmod";
-            goto done;
-        }
-    }
-
-    if (tree != NULL) {
-        lens_put(aug, augorig_canon, lens, text, tree, fp, &err);
-        ERR_BAIL(aug);
-    }
-
-    if (ferror(fp)) {
-        err_status = "error_augtemp";
-        goto done;
-    }
-
-    if (fflush(fp) != 0) {
-        err_status = "flush_augtemp";
-        goto done;
+        augdest = augorig_canon;
+        dest_dir = &canon_dir;
     }
 
-    if (fsync(fileno(fp)) < 0) {
-        err_status = "sync_augtemp";
+    // FIXME: We might have to create intermediate directories
+    // to be able to write augnew, but we have no idea what permissions
+    // etc. they should get. Just the process default ?
+    if (dir_open(dest_dir, augdest, &dest_dirfd, &dest_base) < 0) {
+        err_status = "mk_augtemp";
         goto done;
     }
 
-    if (fclose(fp) != 0) {
-        err_status = "close_augtemp";
-        fp = NULL;
+    if (xasprintf(&augtemp, "%s.XXXXXX", dest_base) < 0) {
+        err_status = "augtemp_oom";
         goto done;
     }
 
-    fp = NULL;
-
-    if (err != NULL) {
-        err_status = err->pos >= 0 ? "parse_skel_failed" : "put_failed";
-        unlink(augtemp);
+    fd = augorig_canon_fp == NULL ? -1 : fileno(augorig_canon_fp);
+    start = metrics_clock();
+    r = write_temp(dest_dirfd, augtemp, fd, augorig_exists,
+                   ms.buf, ms.size, &err_status);
+    METRICS_STOP(aug, write, start);
+    if (r < 0)
         goto done;
-    }
 
-    {
-        char *new_text = xread_file(augtemp);
-        int same = 0;
-        if (new_text == NULL) {
-            err_status = "read_augtemp";
-            goto done;
-        }
-        same = STREQ(text, new_text);
-        FREE(new_text);
-        if (same) {
-            result = 0;
-            unlink(augtemp);
-            goto done;
-        } else if (aug->flags & AUG_SAVE_NOOP) {
-            result = 1;
-            unlink(augtemp);
-            goto done;
-        }
-    }
+    start = metrics_clock();
 
+    /* Without AUG_SAVE_NEWFILE, DEST_DIRFD and DEST_BASE refer to
+       augorig_canon */
     if (!(aug->flags & AUG_SAVE_NEWFILE)) {
         if (augorig_exists && (aug->flags & AUG_SAVE_BACKUP)) {
             r = xasprintf(&augsave, "%s" EXT_AUGSAVE, augorig);
@@ -1324,17 +2068,51 @@ int transform_save(struct augeas *aug, struct tree *xfm,
                 goto done;
             }
 
-            r = clone_file(augorig_canon, augsave, &err_status, 1, 1);
-            if (r != 0) {
-                dyn_err_status = strappend(err_status, "_augsave");
-                goto done;
+            r = dir_open(&orig_dir, augsave, &save_dirfd, &save_base);
+            if (r == 0
+                && link_backup(dest_dirfd, dest_base,
+                               save_dirfd, save_base) == 0) {
+                backup_linked = true;
+            } else {
+                /* Not being able to get at the directory for the backup
+                 * is the same as not being able to create it there */
+                if (r == 0)
+                    r = clone_file(dest_dirfd, dest_base,
+                                   save_dirfd, save_base, &err_status, 1, 1);
+                else
+                    err_status = "clone_open_dst";
+                if (r != 0) {
+                    unlinkat(dest_dirfd, augtemp, 0);
+                    dyn_err_status = strappend(err_status, "_augsave");
+                    goto done;
+                }
             }
         }
     }
 
-    r = clone_file(augtemp, augdest, &err_status, copy_if_rename_fails, 0);
+    r = clone_file(dest_dirfd, augtemp, dest_dirfd, dest_base, &err_status,
+                   copy_if_rename_fails && !backup_linked, 0);
+    if (r != 0 && backup_linked && copy_if_rename_fails
+        && (errno == EXDEV || errno == EBUSY)) {
+        /* We are about to write into AUGDEST, which the backup still
+         * shares; turn the backup into a copy of its own first */
+        r = unlinkat(save_dirfd, save_base, 0);
+        if (r == 0)
+            r = copy_file(dest_dirfd, dest_base, save_dirfd, save_base, 1,
+                          &err_status);
+        else
+            err_status = "clone_unlink_dst";
+        if (r != 0) {
+            unlinkat(dest_dirfd, augtemp, 0);
+            dyn_err_status = strappend(err_status, "_augsave");
+            goto done;
+        }
+        r = clone_file(dest_dirfd, augtemp, dest_dirfd, dest_base,
+                       &err_status, 1, 0);
+    }
+    METRICS_STOP(aug, rename, start);
     if (r != 0) {
-        unlink(augtemp);
+        unlinkat(dest_dirfd, augtemp, 0);
         dyn_err_status = strappend(err_status, "_augtemp");
         goto done;
     }
@@ -1343,7 +2121,14 @@ int transform_save(struct augeas *aug, struct tree *xfm,
 
  done:
     force_reload = aug->flags & AUG_SAVE_NEWFILE;
-    r = add_file_info(aug, path, lens, lens_name, augorig, force_reload);
+    have_st = false;
+    if (! force_reload && augorig_canon != NULL) {
+        int saved_errno = errno;
+        have_st = (dir_stat(&canon_dir, augorig_canon, &st) == 0);
+        errno = saved_errno;
+    }
+    r = add_file_info(aug, path, lens, lens_name, have_st ? &st : NULL,
+                      force_reload);
     if (r < 0) {
         err_status = "file_info";
         result = -1;
@@ -1354,6 +2139,9 @@ int transform_save(struct augeas *aug, struct tree *xfm,
             err_status = "saved_event";
             result = -1;
         }
+        /* The parse of the old contents is of no use anymore */
+        if (! force_reload)
+            store_ast(aug, path, NULL);
     }
     {
         const char *emsg =
@@ -1373,10 +2161,13 @@ int transform_save(struct augeas *aug, struct tree *xfm,
     free_lns_error(err);
     unref(info, info);
 
-    if (fp != NULL)
-        fclose(fp);
+    if (ms_open)
+        close_memstream(&ms);
+    free(ms.buf);
     if (augorig_canon_fp != NULL)
         fclose(augorig_canon_fp);
+    dir_cache_close(&orig_dir);
+    dir_cache_close(&canon_dir);
     return result;
 }
 
@@ -1408,7 +2199,8 @@ int text_retrieve(struct augeas *aug, const char *lens_name,
     ms_open = true;
 
     if (tree != NULL) {
-        lens_put(aug, path, lens, text_in, tree, ms.stream, &err);
+        lens_put(aug, path, path, lens, text_in, tree, ms.stream, false,
+                 &err);
         ERR_BAIL(aug);
     }
 
@@ -1500,7 +2292,8 @@ int remove_file(struct augeas *aug, struct tree *tree) {
                 goto error;
         }
 
-        r = clone_file(augorig_canon, augsave, &err_status, 1, 1);
+        r = clone_file(AT_FDCWD, augorig_canon, AT_FDCWD, augsave,
+                       &err_status, 1, 1);
         if (r != 0) {
             dyn_err_status = strappend(err_status, "_augsave");
             goto error;
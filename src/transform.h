@@ -65,10 +65,21 @@ int transform_validate(struct augeas *aug, struct tree *xfm);
  * applying the TRANSFORM's lens to their contents and putting the
  * resulting tree under "/files" + filename. Also stores some information
  * about filename underneath "/augeas/files" + filename
- * If a FILE is passed, only this FILE will be loaded.
+ * If a FILE is passed, only this FILE will be loaded. Otherwise, with
+ * AUG_LAZY_LOAD, files are only registered, and transform_load_lazy
+ * loads them later.
  */
 int transform_load(struct augeas *aug, struct tree *xfm, const char *file);
 
+/* Load the contents of the file for FILE, a node underneath "/files" that
+ * transform_load only registered because of AUG_LAZY_LOAD, using the lens
+ * recorded for it underneath "/augeas/files".
+ */
+int transform_load_lazy(struct augeas *aug, struct tree *file);
+
+/* Free the parses that lns_get kept because of AUG_KEEP_PARSE */
+void transform_free_asts(struct augeas *aug);
+
 /* Return 1 if TRANSFORM applies to PATH, 0 otherwise.
  * PATH must not include "/files/".
  */
@@ -81,7 +92,11 @@ int filter_matches(struct tree *xfm, const char *path);
 int transform_applies(struct tree *xfm, const char *path);
 
 /* Save TREE into the file corresponding to PATH. It is assumed that the
- * TRANSFORM applies to that PATH
+ * TRANSFORM applies to that PATH. If the file would not change, it is not
+ * touched at all.
+ *
+ * Return 0 if the file was left unchanged, 1 if it was (or, with
+ * AUG_SAVE_NOOP, would have been) written, and -1 on error
  */
 int transform_save(struct augeas *aug, struct tree *xfm,
                    const char *path, struct tree *tree);
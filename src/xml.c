@@ -154,6 +154,7 @@ static int tree_to_xml(struct pathx *p, xmlNode **xml, const char *pathin) {
     for (tree = pathx_first(p); tree != NULL; tree = pathx_next(p)) {
         if (TREE_HIDDEN(tree))
             continue;
+        tree_load_lazy_all(aug_of_pathx(p), tree);
         path = path_of_tree(tree);
         if (path == NULL)
             goto error;
@@ -186,7 +187,7 @@ int aug_to_xml(const struct augeas *aug, const char *pathin,
         pathin = "/*";
     }
 
-    p = pathx_aug_parse(aug, aug->origin, tree_root_ctx(aug), pathin, true);
+    p = pathx_aug_parse_ctx(aug, pathin, true);
     ERR_BAIL(aug);
     result = tree_to_xml(p, xmldoc, pathin);
     ERR_THROW(result < 0, aug, AUG_ENOMEM, NULL);
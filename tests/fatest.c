@@ -585,6 +585,28 @@ static void testNoCase(CuTest *tc) {
     CuAssertIntEquals(tc, 1, r);
 }
 
+static void testClone(CuTest *tc) {
+    struct fa *fa1 = make_good_fa(tc, "[a-z]+(=[0-9]*)?");
+    struct fa *fa2 = make_good_fa(tc, "x");
+    struct fa *fa;
+
+    fa_nocase(fa2);
+    fa = mark(fa_clone(fa1));
+    CuAssertPtrNotNull(tc, fa);
+    CuAssertIntEquals(tc, 1, fa_equals(fa, fa1));
+    CuAssertIntEquals(tc, 0, fa_is_nocase(fa));
+
+    /* Changing the copy leaves the original alone */
+    fa_nocase(fa);
+    CuAssertIntEquals(tc, 1, fa_is_nocase(fa));
+    CuAssertIntEquals(tc, 0, fa_is_nocase(fa1));
+
+    fa = mark(fa_clone(fa2));
+    CuAssertPtrNotNull(tc, fa);
+    CuAssertIntEquals(tc, 1, fa_is_nocase(fa));
+    CuAssertIntEquals(tc, 1, fa_equals(fa, fa2));
+}
+
 static void testExpandNoCase(CuTest *tc) {
     const char *p1 = "aB";
     const char *p2 = "[a-cUV]";
@@ -704,6 +726,7 @@ int main(int argc, char **argv) {
         SUITE_ADD_TEST(suite, testRestrictAlphabet);
         SUITE_ADD_TEST(suite, testExpandCharRanges);
         SUITE_ADD_TEST(suite, testNoCase);
+        SUITE_ADD_TEST(suite, testClone);
         SUITE_ADD_TEST(suite, testExpandNoCase);
         SUITE_ADD_TEST(suite, testNoCaseComplement);
         SUITE_ADD_TEST(suite, testEnumerate);
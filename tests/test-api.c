@@ -33,6 +33,7 @@
 #include <libxml/tree.h>
 
 static const char *abs_top_srcdir;
+static const char *abs_top_builddir;
 static char *root;
 static char *loadpath;
 
@@ -122,6 +123,15 @@ static void testGet(CuTest *tc) {
     CuAssertPtrNotNull(tc, value);
     CuAssertIntEquals(tc, AUG_NOERROR, aug_error(aug));
 
+    /* augeas should recreate the context node after it was removed */
+    r = aug_rm(aug, "/context");
+    CuAssertIntEquals(tc, 3, r);
+    r = aug_set(aug, "bar", "other");
+    CuAssertIntEquals(tc, 0, r);
+    r = aug_get(aug, "/context/foo/bar", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "other", value);
+
     /* aug_get should set VALUE to NULL even if the path expression is invalid
        Issue #372 */
     value = (const char *) 7;
@@ -155,7 +165,11 @@ static void testSet(CuTest *tc) {
     r = aug_set(aug, "/augeas/context", "( /files | /augeas )");
     CuAssertIntEquals(tc, 0, r);
     CuAssertIntEquals(tc, AUG_NOERROR, aug_error(aug));
+    /* Absolute paths do not depend on the context; relative ones fail */
     r = aug_get(aug, "/augeas/version", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertIntEquals(tc, AUG_NOERROR, aug_error(aug));
+    r = aug_get(aug, "version", &value);
     CuAssertIntEquals(tc, -1, r);
     CuAssertIntEquals(tc, AUG_EMMATCH, aug_error(aug));
     r = aug_set(aug, "/augeas/context", "/files");
@@ -203,6 +217,22 @@ static void testSetM(CuTest *tc) {
     r = aug_match(aug, "/augeas/version/save/*[last()][. = 'newmode']", NULL);
     CuAssertIntEquals(tc, 1, r);
 
+    /* Create and then change subnodes of several base nodes; SUB has
+     * literals that must survive being evaluated against each base */
+    r = aug_setm(aug, "/augeas/version/save/*", "opt[. =~ regexp('x.*')]",
+                 "x1");
+    CuAssertIntEquals(tc, 5, r);
+
+    r = aug_setm(aug, "/augeas/version/save/*", "opt[. =~ regexp('x.*')]",
+                 "x2");
+    CuAssertIntEquals(tc, 5, r);
+
+    r = aug_match(aug, "/augeas/version/save/*/opt[. = 'x2']", NULL);
+    CuAssertIntEquals(tc, 5, r);
+
+    r = aug_match(aug, "/augeas/version/save/*/opt", NULL);
+    CuAssertIntEquals(tc, 5, r);
+
     /* Noexistent base */
     r = aug_setm(aug, "/augeas/version/save[last()+1]", "mode", "newmode");
     CuAssertIntEquals(tc, 0, r);
@@ -679,6 +709,359 @@ static void testRm(CuTest *tc) {
     aug_close(aug);
 }
 
+/* Positional lookups must stay correct when siblings are appended,
+ * removed, inserted and renamed in any order */
+static void testAppendPosition(CuTest *tc) {
+    struct augeas *aug;
+    const char *value;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    r = aug_set(aug, "/t/a[1]", "1");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/t/a[2]", "2");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/t/b[1]", "b");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/t/a[3]", "3");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_get(aug, "/t/a[3]", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "3", value);
+    r = aug_get(aug, "/t/a[4]", &value);
+    CuAssertIntEquals(tc, 0, r);
+
+    r = aug_rm(aug, "/t/a[2]");
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_get(aug, "/t/a[3]", &value);
+    CuAssertIntEquals(tc, 0, r);
+    r = aug_get(aug, "/t/a[2]", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "3", value);
+
+    r = aug_insert(aug, "/t/a[2]", "a", 0);
+    CuAssertRetSuccess(tc, r);
+    r = aug_get(aug, "/t/a[3]", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertPtrEquals(tc, NULL, value);
+
+    r = aug_rename(aug, "/t/b", "a");
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_get(aug, "/t/a[4]", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertPtrEquals(tc, NULL, value);
+    r = aug_get(aug, "/t/a[2]", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "b", value);
+
+    r = aug_set(aug, "/t/a[5]", "5");
+    CuAssertRetSuccess(tc, r);
+    r = aug_match(aug, "/t/a", NULL);
+    CuAssertIntEquals(tc, 5, r);
+    r = aug_get(aug, "/t/a[5]", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "5", value);
+
+    aug_close(aug);
+}
+
+/* Loading, parsing and writing text must work the same with frozen
+ * modules, and closing must free them */
+static void testFreezeModules(CuTest *tc) {
+    static const char *const hosts = "192.168.0.1 rtr.example.com router\n";
+    const char *v;
+    struct augeas *aug;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_FREEZE_MODULES);
+    CuAssertPtrNotNull(tc, aug);
+    CuAssertIntEquals(tc, AUG_NOERROR, aug_error(aug));
+
+    r = aug_get(aug, "/files/etc/hosts/1/ipaddr", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "127.0.0.1", v);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_set(aug, "/raw/hosts", hosts);
+    CuAssertRetSuccess(tc, r);
+    r = aug_text_store(aug, "Hosts.lns", "/raw/hosts", "/t1");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/t1/1/canonical", "gw.example.com");
+    CuAssertRetSuccess(tc, r);
+    r = aug_text_retrieve(aug, "Hosts.lns", "/raw/hosts", "/t1", "/out");
+    CuAssertRetSuccess(tc, r);
+    r = aug_get(aug, "/out", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "192.168.0.1 gw.example.com router\n", v);
+
+    /* Xml has recursive and square lenses, whose parser and registers
+     * are computed while freezing */
+    r = aug_set(aug, "/raw/xml", "<a><b>x</b></a>\n");
+    CuAssertRetSuccess(tc, r);
+    r = aug_text_store(aug, "Xml.lns", "/raw/xml", "/t2");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/t2/a/b/#text", "y");
+    CuAssertRetSuccess(tc, r);
+    r = aug_text_retrieve(aug, "Xml.lns", "/raw/xml", "/t2", "/out");
+    CuAssertRetSuccess(tc, r);
+    r = aug_get(aug, "/out", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "<a><b>y</b></a>\n", v);
+
+    aug_close(aug);
+}
+
+static size_t test_allocs;
+
+static void *test_calloc(size_t nmemb, size_t size) {
+    test_allocs += 1;
+    return calloc(nmemb, size);
+}
+
+static void *test_realloc(void *ptr, size_t size) {
+    test_allocs += 1;
+    return realloc(ptr, size);
+}
+
+static void testAllocator(CuTest *tc) {
+    static const char *const subsystems[] = {
+        "tree", "pathx", "get", "put", "fa", "jmt", "interpreter", "other"
+    };
+    size_t before[8], count, bytes;
+    struct augeas *aug;
+    int r;
+#if ENABLE_ALLOC_STATS
+    const int stats = 0;
+#else
+    const int stats = -1;
+#endif
+
+    for (int i=0; i < 8; i++) {
+        r = aug_alloc_stats(subsystems[i], &before[i], &bytes);
+        CuAssertIntEquals(tc, stats, r);
+    }
+    r = aug_alloc_stats("nothere", &count, &bytes);
+    CuAssertIntEquals(tc, -1, r);
+
+    aug_set_allocator(test_calloc, test_realloc);
+    test_allocs = 0;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+    r = aug_load_file(aug, "/etc/hosts");
+    CuAssertRetSuccess(tc, r);
+    r = aug_match(aug, "/files/etc/hosts/*[ipaddr = '127.0.0.1']", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    aug_close(aug);
+
+    aug_set_allocator(NULL, NULL);
+    CuAssertTrue(tc, test_allocs > 0);
+
+    /* Everything but jmt, which is only used for recursive lenses, and
+     * put, which we never ran, must have allocated something */
+    for (int i=0; i < 8; i++) {
+        if (STREQ(subsystems[i], "jmt") || STREQ(subsystems[i], "put"))
+            continue;
+        r = aug_alloc_stats(subsystems[i], &count, &bytes);
+        CuAssertIntEquals(tc, stats, r);
+        if (stats == 0)
+            CuAssertTrue(tc, count > before[i]);
+    }
+}
+
+/* Errors inside a session must still be reported for the call that
+ * caused them, and cleared by the next call */
+static void testSession(CuTest *tc) {
+    struct augeas *aug;
+    const char *value;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    r = aug_session_end(aug);
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_EBADARG, aug_error(aug));
+
+    r = aug_session_begin(aug);
+    CuAssertIntEquals(tc, 0, r);
+    CuAssertIntEquals(tc, AUG_NOERROR, aug_error(aug));
+    r = aug_session_begin(aug);
+    CuAssertIntEquals(tc, 0, r);
+
+#if HAVE_USELOCALE
+    locale_t loc = uselocale((locale_t) 0);
+    CuAssertTrue(tc, loc != LC_GLOBAL_LOCALE);
+#endif
+
+    r = aug_get(aug, "/augeas/version", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertPtrNotNull(tc, value);
+
+    r = aug_get(aug, "/augeas/version[", &value);
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_EPATHX, aug_error(aug));
+    r = aug_match(aug, "/augeas//error", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertIntEquals(tc, AUG_NOERROR, aug_error(aug));
+
+    r = aug_get(aug, "/augeas/version", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertIntEquals(tc, AUG_NOERROR, aug_error(aug));
+
+    r = aug_session_end(aug);
+    CuAssertIntEquals(tc, 0, r);
+#if HAVE_USELOCALE
+    CuAssertTrue(tc, uselocale((locale_t) 0) == loc);
+#endif
+    r = aug_session_end(aug);
+    CuAssertIntEquals(tc, 0, r);
+#if HAVE_USELOCALE
+    CuAssertTrue(tc, uselocale((locale_t) 0) == LC_GLOBAL_LOCALE);
+#endif
+
+    /* aug_close ends sessions that are still open */
+    r = aug_session_begin(aug);
+    CuAssertIntEquals(tc, 0, r);
+    aug_close(aug);
+#if HAVE_USELOCALE
+    CuAssertTrue(tc, uselocale((locale_t) 0) == LC_GLOBAL_LOCALE);
+#endif
+}
+
+/* Nodes loaded with AUG_SHARE_TEXT must behave like any other node when
+ * they are changed, moved, renamed and removed */
+static void testShareText(CuTest *tc) {
+    struct augeas *aug;
+    const char *value;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD|AUG_SHARE_TEXT);
+    CuAssertPtrNotNull(tc, aug);
+    r = aug_load_file(aug, "/etc/hosts");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_get(aug, "/files/etc/hosts/1/ipaddr", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "127.0.0.1", value);
+    r = aug_match(aug, "/files/etc/hosts/*/alias", NULL);
+    CuAssertTrue(tc, r > 1);
+
+    r = aug_set(aug, "/files/etc/hosts/1/ipaddr", "127.0.0.2");
+    CuAssertRetSuccess(tc, r);
+    r = aug_get(aug, "/files/etc/hosts/1/ipaddr", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "127.0.0.2", value);
+
+    r = aug_rename(aug, "/files/etc/hosts/1/canonical", "name");
+    CuAssertIntEquals(tc, 1, r);
+
+    r = aug_mv(aug, "/files/etc/hosts/2", "/moved");
+    CuAssertRetSuccess(tc, r);
+    r = aug_match(aug, "/moved/ipaddr", NULL);
+    CuAssertIntEquals(tc, 1, r);
+
+    r = aug_rm(aug, "/files/etc/hosts");
+    CuAssertTrue(tc, r > 0);
+
+    /* The moved nodes must outlive the file they were loaded from */
+    r = aug_get(aug, "/moved/canonical", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertPtrNotNull(tc, value);
+
+    aug_close(aug);
+}
+
+static void testSetTake(CuTest *tc) {
+    struct augeas *aug;
+    const char *value;
+    char *v;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    v = strdup("taken");
+    r = aug_set_take(aug, "/test/node", v);
+    CuAssertRetSuccess(tc, r);
+    r = aug_get(aug, "/test/node", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertPtrEquals(tc, v, (void *) value);
+
+    r = aug_set_take(aug, "/test/node", NULL);
+    CuAssertRetSuccess(tc, r);
+    r = aug_get(aug, "/test/node", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertPtrEquals(tc, NULL, (void *) value);
+
+    /* VALUE is freed on failure */
+    r = aug_set_take(aug, "/test/node[", strdup("lost"));
+    CuAssertIntEquals(tc, -1, r);
+
+    aug_close(aug);
+}
+
+/* Called by __aug_walk_matches; remember the last node it saw */
+static void walk_last(void *data, const char *prefix, int level,
+                      const char *label, ATTRIBUTE_UNUSED int index,
+                      ATTRIBUTE_UNUSED const char *value) {
+    char **last = data;
+
+    free(*last);
+    if (asprintf(last, "%s:%d:%s", prefix, level, label) < 0)
+        *last = NULL;
+}
+
+/* Walking matches below nodes without a label; none of the lenses we
+ * ship make such nodes with children, so we bring our own */
+static void testWalkMatchesUnlabeled(CuTest *tc) {
+    static const char *const module =
+        "module Unlabeled =\n"
+        "  let lns = [ [ key /[a-z]+/ . del \"=\" \"=\" . store /[a-z]+/ ]\n"
+        "              . del \"\\n\" \"\\n\" ]*\n";
+    struct augeas *aug;
+    char *dir = NULL, *fname = NULL, *lp = NULL, *last = NULL;
+    FILE *fp;
+    int r;
+
+    r = asprintf(&dir, "%s/build/test-api", abs_top_builddir);
+    CuAssertPositive(tc, r);
+    run(tc, "mkdir -p %s", dir);
+    r = asprintf(&fname, "%s/unlabeled.aug", dir);
+    CuAssertPositive(tc, r);
+    fp = fopen(fname, "w");
+    CuAssertPtrNotNull(tc, fp);
+    fputs(module, fp);
+    fclose(fp);
+
+    r = asprintf(&lp, "%s:%s", loadpath, dir);
+    CuAssertPositive(tc, r);
+    aug = aug_init(root, lp, AUG_NO_STDINC|AUG_NO_LOAD|AUG_NO_MODL_AUTOLOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    r = aug_set(aug, "/raw/pairs", "a=b\nc=d\n");
+    CuAssertRetSuccess(tc, r);
+    r = aug_text_store(aug, "Unlabeled.lns", "/raw/pairs", "/t");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/context", "/t");
+    CuAssertRetSuccess(tc, r);
+
+    r = __aug_walk_matches(aug, "descendant::c", false, walk_last, &last);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "\\(none\\)[2]/c:0:c", last);
+
+    free(last);
+    aug_close(aug);
+    free(lp);
+    free(fname);
+    free(dir);
+}
+
 static void testLoadFile(CuTest *tc) {
     struct augeas *aug;
     const char *value;
@@ -851,6 +1234,118 @@ static void testAugSource(CuTest *tc) {
 
 }
 
+static void testMetrics(CuTest *tc) {
+    struct augeas *aug;
+    struct aug_metrics m;
+    struct aug_timer old[2];
+    const char *value, *value2;
+    struct memstream ms[2];
+    int r;
+
+    r = aug_metrics(NULL, &m, sizeof(m));
+    CuAssertIntEquals(tc, -1, r);
+    r = aug_metrics_reset(NULL);
+    CuAssertIntEquals(tc, -1, r);
+
+    aug = aug_init(root, loadpath,
+                   AUG_NO_STDINC|AUG_NO_LOAD|AUG_SAVE_NOOP);
+    CuAssertPtrNotNull(tc, aug);
+
+    r = aug_metrics(aug, NULL, sizeof(m));
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_EBADARG, aug_error(aug));
+    r = aug_metrics(aug, &m, 3);
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, AUG_EBADARG, aug_error(aug));
+
+    /* aug_init autoloads modules and sets up /augeas */
+    r = aug_metrics(aug, &m, sizeof(m));
+    CuAssertIntEquals(tc, 0, r);
+    CuAssertIntEquals(tc, AUG_NOERROR, aug_error(aug));
+    CuAssertTrue(tc, m.module_load.count > 0);
+    CuAssertTrue(tc, m.module_load.nsec > 0);
+    CuAssertTrue(tc, m.pathx_parse.count > 0);
+
+    /* A caller that knows fewer timers only gets those */
+    MEMZERO(old, ARRAY_CARDINALITY(old));
+    old[1].count = 42;
+    r = aug_metrics(aug, (struct aug_metrics *) old, sizeof(old[0]));
+    CuAssertIntEquals(tc, 0, r);
+    CuAssertIntEquals(tc, m.module_load.count, old[0].count);
+    CuAssertIntEquals(tc, 42, old[1].count);
+
+    /* Taking a snapshot leaves the tree clean */
+    tree_clean(aug->origin);
+    r = aug_metrics_reset(aug);
+    CuAssertIntEquals(tc, 0, r);
+    CuAssertIntEquals(tc, 0, aug->origin->dirty);
+    r = aug_metrics(aug, &m, sizeof(m));
+    CuAssertIntEquals(tc, 0, r);
+    CuAssertIntEquals(tc, 0, m.module_load.count);
+    CuAssertTrue(tc, m.pathx_parse.nsec == 0);
+
+    r = aug_load_file(aug, "/etc/hosts");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/files/etc/hosts/1/alias[last()+1]", "metrics");
+    CuAssertRetSuccess(tc, r);
+    r = aug_save(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_metrics(aug, &m, sizeof(m));
+    CuAssertIntEquals(tc, 0, r);
+    CuAssertIntEquals(tc, 1, m.glob.count);
+    CuAssertIntEquals(tc, 2, m.read.count);
+    CuAssertIntEquals(tc, 1, m.get.count);
+    CuAssertIntEquals(tc, 1, m.parse.count);
+    CuAssertIntEquals(tc, 1, m.put.count);
+    CuAssertTrue(tc, m.get.nsec > 0);
+    /* AUG_SAVE_NOOP does not touch any files */
+    CuAssertIntEquals(tc, 0, m.write.count);
+    CuAssertIntEquals(tc, 0, m.rename.count);
+    CuAssertTrue(tc, m.pathx_eval.count > 0);
+
+    /* aug_save copied the timers into the tree */
+    r = aug_get(aug, "/augeas/metrics/get/count", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "1", value);
+    r = aug_match(aug, "/augeas/metrics/*/nsec", NULL);
+    CuAssertIntEquals(tc, 10, r);
+
+    /* Looking at the tree does not change it, even though that runs
+     * pathx_parse and pathx_eval */
+    r = aug_get(aug, "/augeas/metrics/pathx_eval/count", &value2);
+    CuAssertIntEquals(tc, 1, r);
+    for (int i=0; i < ARRAY_CARDINALITY(ms); i++) {
+        r = init_memstream(ms + i);
+        CuAssertIntEquals(tc, 0, r);
+        r = aug_print(aug, ms[i].stream, "/augeas/metrics");
+        CuAssertIntEquals(tc, 0, r);
+        r = close_memstream(ms + i);
+        CuAssertIntEquals(tc, 0, r);
+    }
+    CuAssertStrEquals(tc, ms[0].buf, ms[1].buf);
+    free(ms[0].buf);
+    free(ms[1].buf);
+    r = aug_get(aug, "/augeas/metrics/pathx_eval/count", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertPtrEquals(tc, (void *) value2, (void *) value);
+
+    /* Changes to the tree last until the next snapshot */
+    r = aug_set(aug, "/augeas/metrics/get/count", "42");
+    CuAssertRetSuccess(tc, r);
+    r = aug_get(aug, "/augeas/metrics/get/count", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "42", value);
+
+    r = aug_metrics_reset(aug);
+    CuAssertIntEquals(tc, 0, r);
+    r = aug_get(aug, "/augeas/metrics/get/count", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "0", value);
+
+    aug_close(aug);
+}
+
 int main(void) {
     char *output = NULL;
     CuSuite* suite = CuSuiteNew();
@@ -871,6 +1366,14 @@ int main(void) {
     SUITE_ADD_TEST(suite, testTextRetrieve);
     SUITE_ADD_TEST(suite, testAugEscape);
     SUITE_ADD_TEST(suite, testRm);
+    SUITE_ADD_TEST(suite, testAppendPosition);
+    SUITE_ADD_TEST(suite, testFreezeModules);
+    SUITE_ADD_TEST(suite, testAllocator);
+    SUITE_ADD_TEST(suite, testSession);
+    SUITE_ADD_TEST(suite, testMetrics);
+    SUITE_ADD_TEST(suite, testShareText);
+    SUITE_ADD_TEST(suite, testSetTake);
+    SUITE_ADD_TEST(suite, testWalkMatchesUnlabeled);
     SUITE_ADD_TEST(suite, testLoadFile);
     SUITE_ADD_TEST(suite, testLoadBadPath);
     SUITE_ADD_TEST(suite, testLoadBadLens);
@@ -881,6 +1384,10 @@ int main(void) {
     if (abs_top_srcdir == NULL)
         die("env var abs_top_srcdir must be set");
 
+    abs_top_builddir = getenv("abs_top_builddir");
+    if (abs_top_builddir == NULL)
+        die("env var abs_top_builddir must be set");
+
     if (asprintf(&root, "%s/tests/root", abs_top_srcdir) < 0) {
         die("failed to set root");
     }
@@ -52,3 +52,23 @@ act=$(augmatch -q -m "dir['/not_there']" /etc/exports)
 ret=$?
 assert_eq '' "$act" "t7: expected no output"
 assert_eq 1 $ret "t7: expected exit code 1 but got $ret"
+
+# several files, printed in the order given, with and without parallel jobs
+for jobs in 1 3; do
+    act=$(augmatch -j $jobs -eom 'dir["/home"]/client' /etc/exports /etc/hosts /etc/exports)
+    ret=$?
+    exp=$(printf "/etc/exports:207.46.0.0/16\n/etc/exports:192.168.50.2/32\n/etc/exports:207.46.0.0/16\n/etc/exports:192.168.50.2/32\n")
+    assert_eq "$exp" "$act" "t8/$jobs: expected '$exp' but got '$act'"
+    assert_eq 0 $ret "t8/$jobs: expected exit code 0 but got $ret"
+
+    augmatch -j $jobs -qm 'dir' /etc/hosts /etc/hosts
+    ret=$?
+    assert_eq 1 $ret "t9/$jobs: expected exit code 1 but got $ret"
+
+    # an error with one file does not stop the others
+    act=$(augmatch -j $jobs -L /etc/hosts /etc /etc/exports 2>/dev/null)
+    ret=$?
+    exp=$(printf "/etc/hosts:Hosts\n/etc/exports:Exports\n")
+    assert_eq "$exp" "$act" "t10/$jobs: expected '$exp' but got '$act'"
+    assert_eq 2 $ret "t10/$jobs: expected exit code 2 but got $ret"
+done
@@ -0,0 +1,44 @@
+#!/bin/sh
+
+# Tests for running several modules with one augparse invocation
+
+TOPDIR=$(cd $(dirname $0)/.. && pwd)
+[ -n "$abs_top_srcdir" ] || abs_top_srcdir=$TOPDIR
+
+LENSES=$abs_top_srcdir/lenses
+MODULES=$abs_top_srcdir/tests/modules
+
+fail() {
+    echo "failed: $*"
+    exit 1
+}
+
+assert_eq() {
+    if [ "$1" != "$2" ]; then
+        shift 2
+        fail $*
+    fi
+}
+
+pass="$LENSES/tests/test_hosts.aug $LENSES/tests/test_shells.aug $MODULES/pass_unit.aug"
+
+for jobs in 1 2; do
+    # all modules pass, results are reported in the order of the arguments
+    out=$(augparse --nostdinc -I $LENSES --timing -j $jobs $pass 2>&1)
+    ret=$?
+    assert_eq 0 $ret "t1/$jobs: expected exit code 0 but got $ret"
+    act=$(echo "$out" | grep ' PASS (' | sed -e 's,.*/,,' -e 's/ *PASS (.*//' \
+          | tr '\n' ' ')
+    assert_eq "test_hosts.aug test_shells.aug pass_unit.aug " "$act" \
+              "t1/$jobs: unexpected output '$act'"
+
+    # --timing also reports each test
+    act=$(echo "$out" | grep -c 'test_shells.aug:.* test passed (')
+    assert_eq 1 "$act" "t1/$jobs: expected one timed test in test_shells.aug"
+
+    # one failing module makes the whole run fail
+    augparse --nostdinc -I $LENSES -j $jobs $pass $MODULES/fail_del_maybe.aug \
+             >/dev/null 2>&1
+    ret=$?
+    assert_eq 1 $ret "t2/$jobs: expected exit code 1 but got $ret"
+done
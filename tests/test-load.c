@@ -652,6 +652,96 @@ static void testMultipleXfm(CuTest *tc) {
     aug_close(aug);
 }
 
+/* With AUG_LAZY_LOAD, a file is only read when its tree is first used */
+static void testLazyLoad(CuTest *tc) {
+    augeas *aug = NULL;
+    char *build_root = setup_hosts(tc);
+    const char *v;
+    int r;
+
+    aug = aug_init(build_root, loadpath,
+                   AUG_NO_MODL_AUTOLOAD|AUG_NO_LOAD|AUG_LAZY_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    r = aug_set(aug, "/augeas/load/Hosts/lens", "Hosts.lns");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/augeas/load/Hosts/incl", "/etc/hosts");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/files/etc/*", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    r = aug_get(aug, "/augeas/files/etc/hosts/lens", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "Hosts.lns", v);
+
+    /* The file has not been read yet, so we see this change */
+    run(tc, "echo '192.168.0.1 lazyhost' >> %s/etc/hosts", build_root);
+
+    r = aug_match(aug, "/files/etc/hosts/*[canonical = 'lazyhost']", NULL);
+    CuAssertIntEquals(tc, 1, r);
+
+    r = aug_set(aug, "/files/etc/hosts/1/alias[last()+1]", "lazy");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_save(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_get(aug, "/augeas/events/saved", &v);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "/files/etc/hosts", v);
+
+    /* Reloading reads the file we just saved */
+    r = aug_load(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/files/etc/hosts/1/alias[. = 'lazy']", NULL);
+    CuAssertIntEquals(tc, 1, r);
+
+    aug_close(aug);
+    free(build_root);
+}
+
+/* Setting the value of the node for a file that has not been loaded yet
+ * marks it dirty without going into its children; saving must not
+ * replace the file with an empty one */
+static void testLazyLoadSetValue(CuTest *tc) {
+    for (int i=0; i < 2; i++) {
+        augeas *aug = NULL;
+        char *build_root = setup_hosts(tc);
+        int r;
+
+        aug = aug_init(build_root, loadpath,
+                       AUG_NO_MODL_AUTOLOAD|AUG_NO_LOAD|AUG_LAZY_LOAD);
+        CuAssertPtrNotNull(tc, aug);
+
+        r = aug_set(aug, "/augeas/load/Hosts/lens", "Hosts.lns");
+        CuAssertRetSuccess(tc, r);
+        r = aug_set(aug, "/augeas/load/Hosts/incl", "/etc/hosts");
+        CuAssertRetSuccess(tc, r);
+        r = aug_load(aug);
+        CuAssertRetSuccess(tc, r);
+
+        if (i == 0) {
+            r = aug_setm(aug, "/files/etc/hosts", NULL, "x");
+            CuAssertIntEquals(tc, 1, r);
+        } else {
+            r = aug_set_take(aug, "/files/etc/hosts", strdup("x"));
+            CuAssertRetSuccess(tc, r);
+        }
+
+        r = aug_save(aug);
+        CuAssertRetSuccess(tc, r);
+
+        run(tc, "cmp -s %s/etc/hosts %s/etc/hosts", root, build_root);
+
+        aug_close(aug);
+        free(build_root);
+    }
+}
+
 int main(void) {
     char *output = NULL;
     CuSuite* suite = CuSuiteNew();
@@ -675,6 +765,8 @@ int main(void) {
     SUITE_ADD_TEST(suite, testLoadExclWithRoot);
     SUITE_ADD_TEST(suite, testLoadTrailingExcl);
     SUITE_ADD_TEST(suite, testMultipleXfm);
+    SUITE_ADD_TEST(suite, testLazyLoad);
+    SUITE_ADD_TEST(suite, testLazyLoadSetValue);
 
     abs_top_srcdir = getenv("abs_top_srcdir");
     if (abs_top_srcdir == NULL)
@@ -0,0 +1,175 @@
+/*
+ * test-oahash.c: test the open addressing hash tables used by libfa
+ *
+ * Copyright (C) 2026 The Augeas authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "oahash.h"
+#include "cutest.h"
+#include "internal.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Keys are unsigned ints; the value stored for key K is K + 1 cast to a
+ * pointer, so that no value is NULL */
+#define VAL(k) ((void *) (uintptr_t) ((k) + 1))
+
+static size_t int_hash(const void *key) {
+    return *(const unsigned int *) key * 2654435761u;
+}
+
+/* Puts every key into the same slot */
+static size_t same_hash(ATTRIBUTE_UNUSED const void *key) {
+    return 42;
+}
+
+/* Puts keys into one of four slots; the hash 0 is reserved for empty slots
+ * in the table and must still work */
+static size_t few_hash(const void *key) {
+    return *(const unsigned int *) key % 4;
+}
+
+static int int_eq(const void *key1, const void *key2) {
+    return *(const unsigned int *) key1 == *(const unsigned int *) key2;
+}
+
+static struct oahash *make_table(CuTest *tc, oahash_hash_fn hash,
+                                 unsigned int n) {
+    struct oahash *table = oahash_create(sizeof(unsigned int), hash, NULL);
+    CuAssertPtrNotNull(tc, table);
+    for (unsigned int k = 0; k < n; k++) {
+        int r = oahash_insert(table, &k, VAL(k));
+        CuAssertIntEquals(tc, 0, r);
+    }
+    CuAssertIntEquals(tc, n, oahash_count(table));
+    return table;
+}
+
+/* Assert that exactly the keys in [0, N) for which PRESENT is nonzero
+ * are in TABLE, with the right values */
+static void assert_keys(CuTest *tc, struct oahash *table, unsigned int n,
+                        const char *present) {
+    size_t count = 0, pos = 0;
+    const void *key;
+    void *value;
+
+    for (unsigned int k = 0; k < n; k++) {
+        const unsigned int *found = oahash_lookup(table, &k, &value);
+        if (present[k]) {
+            CuAssertPtrNotNull(tc, found);
+            CuAssertIntEquals(tc, k, *found);
+            CuAssertPtrEquals(tc, VAL(k), value);
+            count += 1;
+        } else {
+            CuAssertPtrEquals(tc, NULL, (void *) found);
+        }
+    }
+    CuAssertIntEquals(tc, count, oahash_count(table));
+
+    /* Iteration visits every entry exactly once */
+    count = 0;
+    while (oahash_next(table, &pos, &key, &value)) {
+        unsigned int k = *(const unsigned int *) key;
+        CuAssertTrue(tc, k < n && present[k]);
+        CuAssertPtrEquals(tc, VAL(k), value);
+        count += 1;
+    }
+    CuAssertIntEquals(tc, count, oahash_count(table));
+}
+
+static void testInsertLookup(CuTest *tc) {
+    unsigned int k = 7, missing = 8;
+    const unsigned int *found;
+    void *value = NULL;
+    struct oahash *table;
+
+    table = oahash_create(sizeof(unsigned int), int_hash, int_eq);
+    CuAssertPtrNotNull(tc, table);
+    CuAssertIntEquals(tc, 0, oahash_count(table));
+    CuAssertPtrEquals(tc, NULL, (void *) oahash_lookup(table, &k, NULL));
+
+    CuAssertIntEquals(tc, 0, oahash_insert(table, &k, VAL(k)));
+    CuAssertIntEquals(tc, 1, oahash_count(table));
+
+    /* The table keeps its own copy of the key */
+    found = oahash_lookup(table, &k, &value);
+    CuAssertPtrNotNull(tc, found);
+    CuAssertTrue(tc, found != &k);
+    CuAssertIntEquals(tc, 7, *found);
+    CuAssertPtrEquals(tc, VAL(7), value);
+
+    CuAssertPtrEquals(tc, NULL, (void *) oahash_lookup(table, &missing, NULL));
+    oahash_free(table);
+}
+
+static void testResize(CuTest *tc) {
+    static const unsigned int n = 5000;
+    char present[5000];
+    struct oahash *table;
+
+    /* The table starts with 16 slots and has to grow several times */
+    table = make_table(tc, int_hash, n);
+    memset(present, 1, n);
+    assert_keys(tc, table, n, present);
+    oahash_free(table);
+}
+
+static void testCollisions(CuTest *tc) {
+    static const unsigned int n = 100;
+    char present[100];
+    struct oahash *table;
+
+    memset(present, 1, n);
+
+    table = make_table(tc, same_hash, n);
+    assert_keys(tc, table, n, present);
+    oahash_free(table);
+
+    table = make_table(tc, few_hash, n);
+    assert_keys(tc, table, n, present);
+    oahash_free(table);
+}
+
+int main(void) {
+    char *output = NULL;
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, testInsertLookup);
+    SUITE_ADD_TEST(suite, testResize);
+    SUITE_ADD_TEST(suite, testCollisions);
+
+    CuSuiteRun(suite);
+    CuSuiteSummary(suite, &output);
+    CuSuiteDetails(suite, &output);
+    printf("%s\n", output);
+    free(output);
+    int result = suite->failCount;
+    CuSuiteFree(suite);
+    return result;
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
@@ -76,12 +76,102 @@ static void testPerfPredicate(CuTest *tc) {
     aug_close(aug);
 }
 
+/* Append siblings one at a time with label[count+1]; the append scenario
+ * of augbench times this with many more siblings */
+static void testPerfAppend(CuTest *tc) {
+    const int nsiblings = 10000;
+    const char *value;
+    char *path;
+    struct timeval stop, start;
+    struct augeas *aug;
+    int r;
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    gettimeofday(&start, NULL);
+
+    for (int i=1; i <= nsiblings; i++) {
+        if (asprintf(&path, "/test/service[%i]", i) < 0)
+            die("failed to generate set path");
+        r = aug_set(aug, path, "test");
+        free(path);
+        if (r < 0)
+            die("aug_set failed");
+    }
+
+    gettimeofday(&stop, NULL);
+    printf("testPerfAppend = %lums\n", time_taken(start, stop));
+
+    if (asprintf(&path, "/test/service[%i]", nsiblings) < 0)
+        die("failed to generate get path");
+    r = aug_get(aug, path, &value);
+    free(path);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertStrEquals(tc, "test", value);
+
+    if (asprintf(&path, "/test/service[%i]", nsiblings + 1) < 0)
+        die("failed to generate get path");
+    r = aug_get(aug, path, &value);
+    free(path);
+    CuAssertIntEquals(tc, 0, r);
+
+    aug_close(aug);
+}
+
+/* Putting a file with many entries must take linear time; the entries of
+ * Hosts are numbered with seq, so each one has a different label */
+static void testPerfPutLarge(CuTest *tc) {
+    const int nlines = 50000;
+    const char *line = "192.168.0.1 host.example.com host alias\n";
+    char *text, *p;
+    const char *value;
+    struct timeval stop, start;
+    struct augeas *aug;
+    int r;
+
+    text = malloc(nlines * strlen(line) + 1);
+    if (text == NULL)
+        die("failed to allocate text");
+    p = text;
+    for (int i=0; i < nlines; i++)
+        p = stpcpy(p, line);
+
+    aug = aug_init(root, loadpath, AUG_NO_STDINC|AUG_NO_LOAD);
+    CuAssertPtrNotNull(tc, aug);
+
+    r = aug_set(aug, "/text/hosts", text);
+    CuAssertIntEquals(tc, 0, r);
+    r = aug_text_store(aug, "Hosts.lns", "/text/hosts", "/hosts");
+    CuAssertIntEquals(tc, 0, r);
+    r = aug_set(aug, "/hosts/1/ipaddr", "10.0.0.1");
+    CuAssertIntEquals(tc, 0, r);
+
+    gettimeofday(&start, NULL);
+    r = aug_text_retrieve(aug, "Hosts.lns", "/text/hosts", "/hosts",
+                          "/text/new");
+    gettimeofday(&stop, NULL);
+    CuAssertIntEquals(tc, 0, r);
+    printf("testPerfPutLarge = %lums\n", time_taken(start, stop));
+
+    r = aug_get(aug, "/text/new", &value);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertIntEquals(tc, strlen(text) - strlen("192.168.0.1")
+                      + strlen("10.0.0.1"), strlen(value));
+    CuAssertIntEquals(tc, 0, strncmp(value, "10.0.0.1 ", strlen("10.0.0.1 ")));
+
+    aug_close(aug);
+    free(text);
+}
+
 int main(void) {
     char *output = NULL;
     CuSuite* suite = CuSuiteNew();
     CuSuiteSetup(suite, NULL, NULL);
 
     SUITE_ADD_TEST(suite, testPerfPredicate);
+    SUITE_ADD_TEST(suite, testPerfAppend);
+    SUITE_ADD_TEST(suite, testPerfPutLarge);
 
     abs_top_srcdir = getenv("abs_top_srcdir");
     if (abs_top_srcdir == NULL)
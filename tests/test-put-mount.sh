@@ -52,4 +52,25 @@ if ! grep myhost $TARGET >/dev/null; then
     Exit 1
 fi
 
+# With a backup, the old contents must be copied out of the bind mount
+# into .augsave, and the new contents into the bind mount
+HOSTS_OLD=$(cat $HOSTS)
+
+augtool --nostdinc -I $LENSES -r $ROOT --backup <<EOF
+set /augeas/save/copy_if_rename_fails 1
+set /files/etc/hosts/1/alias[2] otherhost
+save
+print /augeas//error
+EOF
+
+if [ "x${HOSTS_OLD}" != "x$(cat $HOSTS.augsave)" ]; then
+    echo "/etc/hosts.augsave does not contain the old /etc/hosts"
+    Exit 1
+fi
+
+if ! grep otherhost $TARGET >/dev/null; then
+    echo "/other/real_hosts does not contain the second modification"
+    Exit 1
+fi
+
 Exit 0
@@ -191,6 +191,48 @@ static void testMtime(CuTest *tc) {
     free(mtime1);
 }
 
+/* Check that saving a tree that renders to exactly what is in the file
+ * already leaves the file alone, and does not report it as saved
+ */
+static void testSaveUnchanged(CuTest *tc) {
+    struct stat st1, st2;
+    char *path = NULL;
+    int r;
+
+    r = asprintf(&path, "%s/etc/hosts", root);
+    CuAssertPositive(tc, r);
+
+    r = stat(path, &st1);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_set(aug, "/files/etc/hosts/1/alias[1]", "othername");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug, "/files/etc/hosts/1/alias[1]", "localhost");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_save(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/augeas/events/saved", NULL);
+    CuAssertIntEquals(tc, 0, r);
+
+    r = stat(path, &st2);
+    CuAssertRetSuccess(tc, r);
+    CuAssertIntEquals(tc, st1.st_ino, st2.st_ino);
+    CuAssertIntEquals(tc, st1.st_mtime, st2.st_mtime);
+
+    /* A real change still gets written */
+    r = aug_set(aug, "/files/etc/hosts/1/alias[1]", "othername");
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_save(aug);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug, "/augeas/events/saved", NULL);
+    CuAssertIntEquals(tc, 1, r);
+    free(path);
+}
+
 /* Check that loading and saving a file given with a relative path
  * works. Bug #238
  */
@@ -400,6 +442,53 @@ static void testSaveNoPermission(CuTest *tc) {
     free(path);
 }
 
+/* With AUG_KEEP_PARSE, saving a file read with a recursive lens reuses
+ * the parse from loading it, but only as long as the file has not been
+ * changed behind our back */
+static void testKeepParse(CuTest *tc) {
+    struct augeas *aug2;
+    char *lensdir;
+    int r;
+
+    r = asprintf(&lensdir, "%s/lenses", abs_top_srcdir);
+    CuAssertPositive(tc, r);
+
+    run(tc, "printf '<a>\\n  <b x=\"1\">one</b>\\n</a>\\n' > %s/etc/keep1.xml",
+        root);
+    run(tc, "cp %s/etc/keep1.xml %s/etc/keep2.xml", root, root);
+
+    aug2 = aug_init(root, lensdir, AUG_NO_STDINC|AUG_NO_LOAD
+                    |AUG_NO_MODL_AUTOLOAD|AUG_KEEP_PARSE);
+    CuAssertPtrNotNull(tc, aug2);
+    free(lensdir);
+
+    r = aug_set(aug2, "/augeas/load/Xml/lens", "Xml.lns");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug2, "/augeas/load/Xml/incl", "/etc/keep*.xml");
+    CuAssertRetSuccess(tc, r);
+    r = aug_load(aug2);
+    CuAssertRetSuccess(tc, r);
+
+    run(tc, "printf '<a>\\n  <b  x=\"1\">one</b>\\n</a>\\n' > %s/etc/keep2.xml",
+        root);
+
+    r = aug_set(aug2, "/files/etc/keep1.xml/a/b/#text", "two");
+    CuAssertRetSuccess(tc, r);
+    r = aug_set(aug2, "/files/etc/keep2.xml/a/b/#text", "two");
+    CuAssertRetSuccess(tc, r);
+    r = aug_save(aug2);
+    CuAssertRetSuccess(tc, r);
+
+    r = aug_match(aug2, "/augeas/events/saved", NULL);
+    CuAssertIntEquals(tc, 2, r);
+    run(tc, "printf '<a>\\n  <b x=\"1\">two</b>\\n</a>\\n' | cmp - %s/etc/keep1.xml",
+        root);
+    run(tc, "printf '<a>\\n  <b  x=\"1\">two</b>\\n</a>\\n' | cmp - %s/etc/keep2.xml",
+        root);
+
+    aug_close(aug2);
+}
+
 int main(void) {
     char *output = NULL;
     CuSuite* suite = CuSuiteNew();
@@ -424,12 +513,14 @@ int main(void) {
     SUITE_ADD_TEST(suite, testNonExistentLens);
     SUITE_ADD_TEST(suite, testMultipleXfm);
     SUITE_ADD_TEST(suite, testMtime);
+    SUITE_ADD_TEST(suite, testSaveUnchanged);
     SUITE_ADD_TEST(suite, testRelPath);
     SUITE_ADD_TEST(suite, testDoubleSlashPath);
     SUITE_ADD_TEST(suite, testUmask077);
     SUITE_ADD_TEST(suite, testUmask027);
     SUITE_ADD_TEST(suite, testUmask022);
     SUITE_ADD_TEST(suite, testPathEscaping);
+    SUITE_ADD_TEST(suite, testKeepParse);
 
     CuSuiteRun(suite);
     CuSuiteSummary(suite, &output);